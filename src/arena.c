@@ -0,0 +1,165 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file arena.c
+ * Arenas for allocating a job's buffers.
+ *
+ * Allocations are bumped off the current chunk, and a new chunk is started
+ * when it runs out. Allocations bigger than a quarter of a chunk get a chunk
+ * of their own so they don't waste the rest of the current chunk. The arena
+ * itself is at the start of its first chunk, so a job that fits in one chunk
+ * only makes one allocator call. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+#include "arena.h"
+#include "trace.h"
+#include "util.h"
+
+/** The alignment of allocations, enough for any type. */
+#define RS_ARENA_ALIGN 16
+
+/** Round a length up to the alignment. */
+#define rs_arena_round(len) \
+    (((len) + RS_ARENA_ALIGN - 1) & ~(size_t)(RS_ARENA_ALIGN - 1))
+
+/** The header at the start of each chunk. */
+typedef struct rs_arena_chunk {
+    struct rs_arena_chunk *next;        /**< The next older chunk. */
+    size_t size;                /**< The chunk size including the header. */
+} rs_arena_chunk_t;
+
+/** The length of a chunk header, rounded up to the alignment. */
+#define RS_ARENA_CHUNK_HDR rs_arena_round(sizeof(rs_arena_chunk_t))
+
+struct rs_arena {
+    rs_allocator_t const *allocator;    /**< Where chunks come from. */
+    rs_mem_stats_t *mem;        /**< Where to count the chunks, or NULL. */
+    size_t chunk_len;           /**< The length of normal chunks. */
+    rs_arena_chunk_t *chunks;   /**< The chunks, starting with the current
+                                 * one and ending with the arena's one. */
+    char *next;                 /**< The free space in the current chunk. */
+    char *end;                  /**< The end of the current chunk. */
+    char *last;                 /**< The last allocation, or NULL. */
+};
+
+/** Allocate a chunk from the allocator. */
+static rs_arena_chunk_t *rs_arena_chunk_new(rs_allocator_t const *a,
+                                            rs_mem_stats_t *mem, size_t size)
+{
+    rs_arena_chunk_t *chunk;
+
+    if (!(chunk = a->alloc(a->opaque, size))) {
+        rs_fatal("couldn't allocate arena chunk of " FMT_SIZE " bytes", size);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    rs_mem_add(mem, (rs_long_t)size);
+    return chunk;
+}
+
+rs_arena_t *rs_arena_new(rs_heap_t const *heap, size_t chunk_len)
+{
+    const size_t hdr_len =
+        RS_ARENA_CHUNK_HDR + rs_arena_round(sizeof(rs_arena_t));
+    rs_arena_chunk_t *chunk;
+    rs_arena_t *arena;
+
+    if (chunk_len < 2 * hdr_len)
+        chunk_len = 2 * hdr_len;
+    chunk = rs_arena_chunk_new(heap->allocator, heap->mem, chunk_len);
+    arena = (rs_arena_t *)((char *)chunk + RS_ARENA_CHUNK_HDR);
+    arena->allocator = heap->allocator;
+    arena->mem = heap->mem;
+    arena->chunk_len = chunk_len;
+    arena->chunks = chunk;
+    arena->next = (char *)chunk + hdr_len;
+    arena->end = (char *)chunk + chunk_len;
+    arena->last = NULL;
+    return arena;
+}
+
+void rs_arena_free(rs_arena_t *arena)
+{
+    rs_allocator_t const *a = arena->allocator;
+    rs_mem_stats_t *mem = arena->mem;
+    rs_arena_chunk_t *chunk = arena->chunks, *next;
+
+    /* The arena is in the last chunk, so don't touch it after this. */
+    for (; chunk; chunk = next) {
+        next = chunk->next;
+        rs_mem_add(mem, -(rs_long_t)chunk->size);
+        a->free(a->opaque, chunk, chunk->size);
+    }
+}
+
+void *rs_arena_alloc(rs_arena_t *arena, size_t size)
+{
+    const size_t len = rs_arena_round(size);
+    rs_arena_chunk_t *chunk;
+    char *p;
+
+    if (len > (size_t)(arena->end - arena->next)) {
+        if (len > arena->chunk_len / 4) {
+            /* Put it in its own chunk after the current one. */
+            chunk =
+                rs_arena_chunk_new(arena->allocator, arena->mem,
+                                   RS_ARENA_CHUNK_HDR + len);
+            chunk->next = arena->chunks->next;
+            arena->chunks->next = chunk;
+            return (char *)chunk + RS_ARENA_CHUNK_HDR;
+        }
+        chunk =
+            rs_arena_chunk_new(arena->allocator, arena->mem, arena->chunk_len);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = (char *)chunk + RS_ARENA_CHUNK_HDR;
+        arena->end = (char *)chunk + arena->chunk_len;
+    }
+    p = arena->next;
+    arena->next += len;
+    arena->last = p;
+    return p;
+}
+
+void *rs_arena_realloc(rs_arena_t *arena, void *ptr, size_t old_size,
+                       size_t size)
+{
+    void *p;
+
+    if (ptr && ptr == arena->last
+        && rs_arena_round(size) <= (size_t)(arena->end - arena->last)) {
+        arena->next = arena->last + rs_arena_round(size);
+        return ptr;
+    }
+    p = rs_arena_alloc(arena, size);
+    if (ptr)
+        memcpy(p, ptr, old_size < size ? old_size : size);
+    return p;
+}
+
+void rs_arena_release(rs_arena_t *arena, void *ptr)
+{
+    if (ptr == arena->last) {
+        arena->next = arena->last;
+        arena->last = NULL;
+    }
+}
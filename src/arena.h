@@ -0,0 +1,57 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file arena.h
+ * Arenas for allocating a job's buffers.
+ *
+ * An arena hands out memory from big chunks it gets from an allocator, and
+ * only gives it back when the whole arena is freed. Releasing the last
+ * allocation made reuses its memory, but releasing anything else does
+ * nothing.
+ *
+ * \sa rs_job_set_arena() */
+#ifndef ARENA_H
+#  define ARENA_H
+
+#  include <stddef.h>
+#  include "librsync.h"
+#  include "util.h"
+
+/** Create an arena with chunks of chunk_len from the heap's allocator.
+ *
+ * The arena itself is in its first chunk, and the chunks are counted in the
+ * heap's ::rs_mem_stats_t. */
+rs_arena_t *rs_arena_new(rs_heap_t const *heap, size_t chunk_len);
+
+/** Free an arena and everything allocated from it. */
+void rs_arena_free(rs_arena_t *arena);
+
+/** Allocate memory from an arena. */
+void *rs_arena_alloc(rs_arena_t *arena, size_t size);
+
+/** Resize memory allocated from an arena, growing it in place if it was the
+ * last allocation. */
+void *rs_arena_realloc(rs_arena_t *arena, void *ptr, size_t old_size,
+                       size_t size);
+
+/** Release memory allocated from an arena, reusing it if it was the last
+ * allocation. */
+void rs_arena_release(rs_arena_t *arena, void *ptr);
+
+#endif                          /* !ARENA_H */
@@ -30,31 +30,61 @@
 #include <string.h>
 #include "librsync.h"
 #include "buf.h"
+#include "fileutil.h"
 #include "job.h"
 #include "trace.h"
 #include "util.h"
 
+/** Block size used for detecting all-zero output to leave as holes. */
+#define RS_SPARSE_BLOCK_LEN 4096
+
+/** Max pending hole size before seeking, so it fits in a long. */
+#define RS_SPARSE_MAX_SKIP (1L << 30)
+
 struct rs_filebuf {
     FILE *f;
     char *buf;
     size_t buf_len;
+    int sparse;                 /**< Seek over zero blocks instead of writing. */
+    int inplace;                /**< Output overwrites the file being read. */
+    rs_job_t *job;              /**< The job writing in-place output. */
+    char *done;                 /**< Start of output not yet written or skipped. */
+    rs_long_t pos;              /**< File offset of the output at done. */
+    long skip;                  /**< Zero bytes skipped but not yet seeked. */
+    int hole;                   /**< True if the output ended with a hole. */
+    rs_heap_t *heap;            /**< The job's heap. */
 };
 
-rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len)
+rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len, rs_heap_t *heap)
 {
-    rs_filebuf_t *pf = rs_alloc_struct(rs_filebuf_t);
+    rs_filebuf_t *pf = rs_alloc_struct(heap, rs_filebuf_t);
 
-    pf->buf = rs_alloc(buf_len, "file buffer");
+    pf->buf = rs_alloc(heap, buf_len, "file buffer");
+    pf->heap = heap;
     pf->buf_len = buf_len;
     pf->f = f;
+    pf->done = pf->buf;
     return pf;
 }
 
+void rs_filebuf_set_sparse(rs_filebuf_t *fb)
+{
+    fb->sparse = 1;
+}
+
+void rs_filebuf_set_inplace(rs_filebuf_t *fb, rs_job_t *job)
+{
+    fb->inplace = 1;
+    fb->job = job;
+}
+
 void rs_filebuf_free(rs_filebuf_t *fb)
 {
-    free(fb->buf);
+    rs_heap_t *heap = fb->heap;
+
+    rs_free(heap, fb->buf, fb->buf_len);
     rs_bzero(fb, sizeof *fb);
-    free(fb);
+    rs_free(heap, fb, sizeof *fb);
 }
 
 /* If the stream has no more data available, read some from F into BUF, and let
@@ -98,6 +128,141 @@ rs_result rs_infilebuf_fill(rs_job_t *job, rs_buffers_t *buf, void *opaque)
     return RS_DONE;
 }
 
+/* Test if a buffer is all zeros. */
+static inline int rs_iszero(char const *p, size_t len)
+{
+    return !len || (!p[0] && !memcmp(p, p + 1, len - 1));
+}
+
+/* Seek over any skipped zero bytes so the file position is up to date. */
+static rs_result rs_filebuf_seek_skip(rs_filebuf_t *fb)
+{
+    if (fb->skip) {
+        if (fseek(fb->f, fb->skip, SEEK_CUR)) {
+            rs_error("error seeking over hole in file: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        fb->skip = 0;
+    }
+    return RS_DONE;
+}
+
+/* Write LEN bytes from P to the file, seeking over runs of all-zero blocks
+   instead of writing them. Block boundaries are aligned to the output
+   position so that the skipped blocks can become holes in the file. */
+static rs_result rs_filebuf_sparse_write(rs_filebuf_t *fb, char const *p,
+                                         size_t len)
+{
+    rs_result result;
+
+    while (len > 0) {
+        size_t blk = RS_SPARSE_BLOCK_LEN -
+            (size_t)(fb->pos % RS_SPARSE_BLOCK_LEN);
+        int zero = rs_iszero(p, blk < len ? blk : len);
+        size_t n = 0;
+
+        /* Find the length of the run of zero or non-zero blocks. */
+        do {
+            n += blk;
+            blk = RS_SPARSE_BLOCK_LEN;
+        } while (n < len && rs_iszero(p + n, blk < len - n ? blk : len - n)
+                 == zero);
+        if (n > len)
+            n = len;
+        if (zero) {
+            if (fb->skip > RS_SPARSE_MAX_SKIP
+                && (result = rs_filebuf_seek_skip(fb)) != RS_DONE)
+                return result;
+            fb->skip += (long)n;
+        } else {
+            if ((result = rs_filebuf_seek_skip(fb)) != RS_DONE)
+                return result;
+            if (fwrite(p, 1, n, fb->f) != n) {
+                rs_error("error draining buf to file: %s", strerror(errno));
+                return RS_IO_ERROR;
+            }
+        }
+        fb->hole = zero;
+        fb->pos += (rs_long_t)n;
+        p += n;
+        len -= n;
+    }
+    return RS_DONE;
+}
+
+/* Write LEN bytes from P to the file at the output position, which may
+   have been moved by reading from the same file. */
+static rs_result rs_filebuf_inplace_write(rs_filebuf_t *fb, char const *p,
+                                          size_t len)
+{
+    rs_result result;
+
+    if (len > 0) {
+        if ((result = rs_file_seek(fb->f, fb->pos)) != RS_DONE)
+            return result;
+        if (fwrite(p, 1, len, fb->f) != len) {
+            rs_error("error draining buf to file: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        fb->pos += (rs_long_t)len;
+    }
+    return RS_DONE;
+}
+
+rs_result rs_inplace_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
+{
+    rs_filebuf_t *fb = (rs_filebuf_t *)arg;
+    char *out = (char *)*buf;
+    rs_long_t out_pos = fb->pos + (out - fb->done);
+    rs_result result;
+
+    assert(fb->inplace && fb->done <= out && out < fb->buf + fb->buf_len);
+    if (pos < out_pos) {
+        rs_error("copy from " FMT_LONG " before output position " FMT_LONG
+                 " can't be patched in place", pos, out_pos);
+        return RS_CORRUPT;
+    } else if (pos == out_pos) {
+        /* The data is already in place, so write out any output before it
+           and then skip over it, reading it into the output if needed. */
+        rs_trace("skip copy of " FMT_SIZE " bytes already in place at "
+                 FMT_LONG, *len, pos);
+        if ((result = rs_filebuf_inplace_write(fb, fb->done, out - fb->done))
+            != RS_DONE)
+            return result;
+        if (rs_job_hashes_new(fb->job)
+            && (result = rs_file_copy_cb(fb->f, pos, len, buf)) != RS_DONE)
+            return result;
+        fb->pos += (rs_long_t)*len;
+        fb->done = out + *len;
+        return RS_DONE;
+    }
+    /* The data is after the output position so it is not overwritten yet. */
+    return rs_file_copy_cb(fb->f, pos, len, buf);
+}
+
+rs_result rs_outfilebuf_flush(rs_filebuf_t *fb)
+{
+    rs_result result;
+
+    /* Truncate in-place output in case the new file is shorter. */
+    if (fb->inplace)
+        return rs_file_truncate(fb->f, fb->pos);
+
+    /* If the output ended with a hole, write the last zero byte so the file
+       gets the right length. */
+    if (fb->hole) {
+        fb->skip--;
+        if ((result = rs_filebuf_seek_skip(fb)) != RS_DONE)
+            return result;
+        if (fputc(0, fb->f) == EOF) {
+            rs_error("error writing end of file: %s", strerror(errno));
+            return RS_IO_ERROR;
+        }
+        fb->hole = 0;
+    }
+    return RS_DONE;
+}
+
 /* The buf is already using BUF for an output buffer, and probably contains
    some buffered output now. Write this out to F, and reset the buffer cursor. */
 rs_result rs_outfilebuf_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
@@ -117,14 +282,24 @@ rs_result rs_outfilebuf_drain(rs_job_t *job, rs_buffers_t *buf, void *opaque)
 
     size_t present = buf->next_out - fb->buf;
     if (present > 0) {
-        size_t result = fwrite(fb->buf, 1, present, f);
-        if (present != result) {
+        if (fb->inplace) {
+            rs_result result = rs_filebuf_inplace_write(fb, fb->done,
+                                                        buf->next_out -
+                                                        fb->done);
+            if (result != RS_DONE)
+                return result;
+            fb->done = fb->buf;
+        } else if (fb->sparse) {
+            rs_result result = rs_filebuf_sparse_write(fb, fb->buf, present);
+            if (result != RS_DONE)
+                return result;
+        } else if (fwrite(fb->buf, 1, present, f) != present) {
             rs_error("error draining buf to file: %s", strerror(errno));
             return RS_IO_ERROR;
         }
         buf->next_out = fb->buf;
         buf->avail_out = fb->buf_len;
-        job->stats.out_bytes += result;
+        job->stats.out_bytes += present;
     }
     return RS_DONE;
 }
@@ -36,15 +36,45 @@
 
 #  include <stdio.h>
 #  include "librsync.h"
+#  include "util.h"
 
 typedef struct rs_filebuf rs_filebuf_t;
 
-rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len);
+/** Create a file buffer, allocated from a job's heap. */
+rs_filebuf_t *rs_filebuf_new(FILE *f, size_t buf_len, rs_heap_t *heap);
 
 void rs_filebuf_free(rs_filebuf_t *fb);
 
+/** Make an output filebuf seek over all-zero blocks instead of writing them.
+ *
+ * This leaves holes in the output file on filesystems that support sparse
+ * files. The file must be seekable, and rs_outfilebuf_flush() must be called
+ * after the last drain to set the length of a file ending with a hole. */
+void rs_filebuf_set_sparse(rs_filebuf_t *fb);
+
+/** Make an output filebuf write over the file it is also reading from.
+ *
+ * Output is written at its offset in the file, which must be seekable and
+ * opened for both reading and writing. The rs_inplace_copy_cb() must be used
+ * to read from the file, and rs_outfilebuf_flush() must be called after the
+ * last drain to truncate the file to the output length. Data copied from the
+ * same offset is still read into the output buffer if \p job needs to see all
+ * of its output, see rs_job_hashes_new(). */
+void rs_filebuf_set_inplace(rs_filebuf_t *fb, rs_job_t *job);
+
+/** ::rs_copy_cb that reads from the file of an in-place output filebuf.
+ *
+ * Copies from the same offset as the output are skipped without any IO, or
+ * only read if the job needs to see all of its output. It
+ * fails with RS_CORRUPT for copies from before the output offset, since that
+ * data could already have been overwritten. */
+rs_result rs_inplace_copy_cb(void *fb, rs_long_t pos, size_t *len, void **buf);
+
 rs_result rs_infilebuf_fill(rs_job_t *, rs_buffers_t *buf, void *fb);
 
 rs_result rs_outfilebuf_drain(rs_job_t *, rs_buffers_t *, void *fb);
 
+/** Finish writing a drained output filebuf. */
+rs_result rs_outfilebuf_flush(rs_filebuf_t *fb);
+
 #endif                          /* !BUF_H */
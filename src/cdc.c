@@ -0,0 +1,155 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc -- Content defined chunking.
+ *
+ * Copyright (C) 2026 by librsync contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdint.h>
+#include "cdc.h"
+
+/* The gear table of random values for each byte value. These are part of the
+   CDC signature format and must never change. They were generated using
+   splitmix64 seeded with 0x72730156. */
+static const uint64_t gear[256] = {
+    0x33147709ef0a8a4cULL, 0x026e957f42171addULL, 0xceca5f12583ee392ULL,
+    0x0037cff83184ee33ULL, 0xad529b0601ac2453ULL, 0xa373015346f7f092ULL,
+    0xa564dcae9c005ce1ULL, 0x0772210fc83f536bULL, 0x96b07320625f8130ULL,
+    0xd06ecef0012da248ULL, 0x573cb94f963eb36aULL, 0xa14f9be046cea4c3ULL,
+    0xc2400e45e5c0f649ULL, 0xc82173abbd100e17ULL, 0x7f54e40949e227ddULL,
+    0x28467ce3c816ee3fULL, 0x8536648e0d6637d0ULL, 0xc3907cc333de5084ULL,
+    0xd69285cd0d538160ULL, 0x2dec748ebf0c52adULL, 0x5fc5b7d52cf09b4dULL,
+    0x3c085490d93ad3dcULL, 0x97457b64c570cfd9ULL, 0x88518acda5099cd5ULL,
+    0x1f6d5e4bdfaab4e2ULL, 0x08dab8e3e6d5ac27ULL, 0x0e3543671a3a8afcULL,
+    0x02826c1904d20a06ULL, 0xda32cf8089ae30afULL, 0x6c8dd989715cfa8aULL,
+    0x09059133660d981aULL, 0xdd11881b00f573ceULL, 0xf3cb23566db1cc22ULL,
+    0x162c7f317dddec2aULL, 0xf1302c3d38e73305ULL, 0x283460fdac95dd26ULL,
+    0x07fb59e9d012f9beULL, 0xc914b64c7cffbf80ULL, 0x254ce610c43d5009ULL,
+    0xab3a42e51a1e3f46ULL, 0x8e4e2492f3643d26ULL, 0x475a6926cfefaccbULL,
+    0xd2a6e78cf64a3884ULL, 0x0ddd38246c58015bULL, 0xa81a240e7ff549bbULL,
+    0xabaeb9cff3f62024ULL, 0xd7d7a12fee0fae7dULL, 0x918545fa4d1d59faULL,
+    0x7db80e37ff57526eULL, 0xbda2497467e2f074ULL, 0x9bef504599cecf6bULL,
+    0x25e9922e38601d14ULL, 0x4fcad9030219f7e9ULL, 0x591ebfacea0e4160ULL,
+    0xb38d0eb533648186ULL, 0x113a7ea9cee57f50ULL, 0x2218fddc4ea65022ULL,
+    0x9180066802cbb78cULL, 0x9689665efcec8e50ULL, 0xe4d1ea63372a351dULL,
+    0xb8e80f0c071512d5ULL, 0xab1725d563ed1e65ULL, 0xfc469bf27cfc101eULL,
+    0xdff2df6ff6918cf1ULL, 0xc7fe14545fc6e44eULL, 0x633506934f803b15ULL,
+    0xe957fb235879e037ULL, 0xabb4a19c7a83d353ULL, 0xf2d0cdf567ee0322ULL,
+    0xccd613e3f5d9b12dULL, 0xc634c10b26827b09ULL, 0xef5757c456b10a68ULL,
+    0xc180ac69aad2c818ULL, 0xbd3e7497d4993cf8ULL, 0x027c0b78a84824ecULL,
+    0x5057eb3a6d085fd4ULL, 0xa67a10bc9ff0845fULL, 0x4618f9e2cef88eb6ULL,
+    0xfc3af8a5dc2a79f6ULL, 0x2564b799c48bdb10ULL, 0xc1dabdb77ec281bdULL,
+    0x7db95b647b0600d9ULL, 0xc99d9946b92f239aULL, 0xfc361850bd3a0e32ULL,
+    0x867f859463bcc8acULL, 0xdeb28ba41bf61a97ULL, 0xb0c81d395a48e3ffULL,
+    0x142eb3ed5544b19fULL, 0x64a4acb37145fc68ULL, 0x6d152f2c23d97c6cULL,
+    0x87b005fbb7a76e13ULL, 0xf825716934a4a83aULL, 0x0b9d3d02f6317c17ULL,
+    0xb115e31163acde8bULL, 0xac3ed76d48ee70baULL, 0x65b9e85e23f3a0c5ULL,
+    0x171cabf721659adaULL, 0xe1031cf91054b72fULL, 0x9b0a0b16eb1ade03ULL,
+    0x8a2e0aa5c833ba60ULL, 0x6e737183bfdd2638ULL, 0xf2dfbf1b33614398ULL,
+    0x1a795b0d5fd90aa4ULL, 0xeb84a109b4f5811eULL, 0x58ad49b50fb38cfcULL,
+    0x3db35d1e9f12f279ULL, 0x276d6c0e5a791fe1ULL, 0x1c1425770a17f902ULL,
+    0x5ba8893a4860a6c0ULL, 0xad5ad7d59fb6e46fULL, 0xf7c1ef3f9d7301fbULL,
+    0xaecca6530129b6bbULL, 0x8d6bee66ad4d17c5ULL, 0x2467abb3b1b63c74ULL,
+    0x98f25badeca67112ULL, 0xa6ca5b7508352bfbULL, 0x7db8957fc5f2b1f4ULL,
+    0x29eda2e4fef20306ULL, 0x054e2817f2c5175dULL, 0xb4c216a42b0a2194ULL,
+    0xfeb3142d7b76d2fbULL, 0x764c22ea2ca6676cULL, 0xd00896be1cb10514ULL,
+    0x51c9ce74581de146ULL, 0x049998a62d48f61bULL, 0x6de0614f4f1b389aULL,
+    0x4ac19203cca78b6dULL, 0x324ffd98a533cb26ULL, 0x8c5826c305e13b61ULL,
+    0xf1cbf1e97ed1e172ULL, 0xef3e8067d8936c08ULL, 0x54a72d4bd6ec7f1cULL,
+    0x49950bc56103743dULL, 0x10c04b0950134499ULL, 0x5bcd629c7ca4868eULL,
+    0x7f01b828e827d3d0ULL, 0x13781e4fc9e71559ULL, 0xcf12630dfc30fdf6ULL,
+    0x513ac29b42bd402aULL, 0x659b214d65f3a864ULL, 0x97d8ed196eff7dabULL,
+    0x8ea1f98ca67ba79fULL, 0x837269211fe39970ULL, 0x73e7bc8f889a6d89ULL,
+    0x9654ee52b03afea8ULL, 0x74567894061eedaaULL, 0xab077aa5398b18aeULL,
+    0x23ca4261bee02cdaULL, 0xf91cd5648ce7c8f5ULL, 0xf9425ab2f0697f96ULL,
+    0xff1ab9c5f10ae3d6ULL, 0xc9727f3559c25d16ULL, 0x6b172ebdcc45adbfULL,
+    0xc1e32946f0471c74ULL, 0xb39652659fb41d21ULL, 0x7d0a733781b45ef8ULL,
+    0x0b33f8e8a2f80b95ULL, 0xbc10feecb643d5e0ULL, 0x79f2ad7a68b26c41ULL,
+    0xd68f906131d9d2a2ULL, 0x56e07e53dde3cc46ULL, 0x346c18befc5986cbULL,
+    0xcfdadfd5e0f78431ULL, 0x4d7580adc39133daULL, 0xd488fa06b49ebeaaULL,
+    0x7bd29475b7747889ULL, 0x922dfddca7630a79ULL, 0xd06e9ec646df8247ULL,
+    0x4f9f6ef7cb00120fULL, 0x1522380f050bd8d4ULL, 0x543ccedc09a230b2ULL,
+    0xa42d8c6dfa659b25ULL, 0x52e7199a56abd929ULL, 0xfea605fa465ad719ULL,
+    0xf3e97b609cc7655fULL, 0xcec033b67a7d8cd1ULL, 0x77b516ac215d3650ULL,
+    0x9e98873ada0690e9ULL, 0x887834758ca1da99ULL, 0x9f5e149f1534e0aaULL,
+    0x62329d1b52f3d04eULL, 0x45346a7435c71a69ULL, 0x929ef6c4f1715fafULL,
+    0x8a74fd9a61ba2487ULL, 0x7671c9d59eacdb52ULL, 0x68106998038dd3feULL,
+    0x2832a7695bc90251ULL, 0xea704dae6d9e885dULL, 0xce898891eab98cc4ULL,
+    0xd454b458bb2021ecULL, 0xf3681a489d3a7df1ULL, 0x43d8e7a4eb03c528ULL,
+    0x2558e5739785beb1ULL, 0x049f9cda5ac36dbeULL, 0x5d64b60a1e91e146ULL,
+    0xa6ac2fe40c48e3d8ULL, 0x33517222bc9f570aULL, 0x6bb9e9615c8b2c67ULL,
+    0xc63d80de125b6858ULL, 0x9cdaf205bb43d769ULL, 0x917ee50455dc362dULL,
+    0x4f0a0eebd9061df0ULL, 0x711e13cc15bc1aaaULL, 0x5a99e3f4718fa2abULL,
+    0x6cac8039a40dfbf6ULL, 0xd04c9584f8f6f866ULL, 0xcd9df724484e1dbbULL,
+    0xf2f990258095a9b8ULL, 0x906d7147f0410ce3ULL, 0x71501f5d9e1fcac7ULL,
+    0x64fa21d8fbcfcdc9ULL, 0xe336dfaa5d855123ULL, 0xecc47d5645e4fceaULL,
+    0x8766b5a236396739ULL, 0x04f2b86b0aaa309aULL, 0xe815c463e77c2405ULL,
+    0xc2a8d65cde3ffe14ULL, 0x5260bcb855f217ddULL, 0x3fb588e8e9e7d4cfULL,
+    0x08127dfa8a8e54c2ULL, 0xd90b3cfb9a5255aaULL, 0x374fdf234ad9294dULL,
+    0x9acf54451644bf68ULL, 0x5eab3dce6df1b363ULL, 0x048351ba83fde984ULL,
+    0x58d1d06b2761b75dULL, 0x5f508c3847a0786eULL, 0x66a532100a056fe9ULL,
+    0xd905e547162856a9ULL, 0x788a1e9ddcec7fd6ULL, 0x91a3c435d3e962f3ULL,
+    0x9836c4b5c5b96426ULL, 0x850f9877a30fdaedULL, 0xea4295184617cf85ULL,
+    0x0783fb9eb1ed90e1ULL, 0xed6ede7e61a30e27ULL, 0xd7bc9cc9f7c54d95ULL,
+    0x0c115a55a327a811ULL, 0xc86917c743b559cfULL, 0x7a8a2812b19dc11bULL,
+    0x267864d4a0fd5955ULL, 0xeb97b7c7ae87a27dULL, 0x18392f805403e482ULL,
+    0x70c210b6bc66fcfaULL, 0x8bc2dcc368363b99ULL, 0xdd3fcd357c018e0bULL,
+    0xc3dfaeb9bf111af0ULL, 0xe6282266ed2affe1ULL, 0x6b1ca27c9682bac0ULL,
+    0x058bb41afd290753ULL, 0xa2ea2379bd1b1629ULL, 0x734550a0789c40c5ULL,
+    0x82c4752d47444c10ULL, 0xa13a3b628e99f1e6ULL, 0x768d84162fb25245ULL,
+    0x00d845686b6ac6a7ULL
+};
+
+/* Get a mask of the top bits of the 64 bit gear hash. The top bits depend on
+   the last 64 bytes, while the low bits only depend on the last few. */
+static inline uint64_t rs_cdc_mask(int bits)
+{
+    return ~(uint64_t)0 << (64 - bits);
+}
+
+size_t rs_cdc_chunk(const void *buf, size_t len, size_t avg_len)
+{
+    const unsigned char *p = buf;
+    size_t min_len = RS_CDC_MIN_LEN(avg_len), max_len =
+        RS_CDC_MAX_LEN(avg_len), norm_len = avg_len, i;
+    uint64_t hash = 0, mask_s, mask_l;
+    int bits;
+
+    if (len <= min_len)
+        return len;
+    if (len > max_len)
+        len = max_len;
+    if (norm_len > len)
+        norm_len = len;
+    /* Use log2(avg_len) mask bits, with one more before norm_len and one
+       less after it. */
+    for (bits = 2; ((size_t)1 << (bits + 1)) <= avg_len; bits++) ;
+    mask_s = rs_cdc_mask(bits + 1);
+    mask_l = rs_cdc_mask(bits - 1);
+    for (i = min_len; i < norm_len; i++) {
+        hash = (hash << 1) + gear[p[i]];
+        if (!(hash & mask_s))
+            return i + 1;
+    }
+    for (; i < len; i++) {
+        hash = (hash << 1) + gear[p[i]];
+        if (!(hash & mask_l))
+            return i + 1;
+    }
+    return len;
+}
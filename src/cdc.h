@@ -0,0 +1,59 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * cdc -- Content defined chunking.
+ *
+ * Copyright (C) 2026 by librsync contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file cdc.h
+ * Content defined chunking using a FastCDC style gear hash.
+ *
+ * Chunk boundaries are found where the gear hash of the preceding 64 bytes
+ * has enough zero bits, so they depend only on the data near them and not on
+ * their offset. This means inserted or deleted data only changes the chunks
+ * around the change, and a delta only needs to look up chunks at boundaries
+ * instead of every byte offset.
+ *
+ * Normalized chunking uses a harder boundary condition before the average
+ * chunk length and an easier one after it, which narrows the distribution of
+ * chunk lengths around the average. */
+#ifndef CDC_H
+#  define CDC_H
+
+#  include <stddef.h>
+
+/** The minimum chunk length for an average chunk length. */
+#  define RS_CDC_MIN_LEN(avg_len) ((avg_len) / 4)
+
+/** The maximum chunk length for an average chunk length. */
+#  define RS_CDC_MAX_LEN(avg_len) ((avg_len) * 8)
+
+/** Find the length of the first chunk in a buffer.
+ *
+ * The returned chunk length is always RS_CDC_MAX_LEN(avg_len) or less. If no
+ * boundary is found before the end of the buffer, this returns the whole
+ * buffer length, so callers must supply at least RS_CDC_MAX_LEN(avg_len)
+ * bytes unless the buffer is the end of the data.
+ *
+ * \param buf - the data to find the chunk in.
+ *
+ * \param len - the length of data in buf.
+ *
+ * \param avg_len - the target average chunk length. */
+size_t rs_cdc_chunk(const void *buf, size_t len, size_t avg_len);
+
+#endif                          /* !CDC_H */
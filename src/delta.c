@@ -91,13 +91,18 @@
 #include "config.h"             /* IWYU pragma: keep */
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
 #include "checksum.h"
+#include "probes.h"
 #include "scoop.h"
+#include "timing.h"
 #include "emit.h"
 #include "trace.h"
+#include "util.h"
+#include "cdc.h"
 
 /** Max length of a miss is 64K including 3 command bytes. */
 #define MAX_MISS_LEN (MAX_DELTA_CMD - 3)
@@ -106,8 +111,17 @@ static rs_result rs_delta_s_scan(rs_job_t *job);
 static rs_result rs_delta_s_flush(rs_job_t *job);
 static rs_result rs_delta_s_end(rs_job_t *job);
 static inline rs_result rs_getinput(rs_job_t *job, size_t block_len);
+static inline size_t rs_scanlen(rs_job_t *job);
 static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
                                size_t *match_len);
+static inline int rs_findchunk(rs_job_t *job, rs_long_t *match_pos,
+                               size_t *match_len);
+static inline int rs_findfine(rs_job_t *job, rs_long_t *match_pos,
+                              size_t *match_len);
+static inline void rs_rollfine(rs_job_t *job);
+static inline size_t rs_extendfwd(rs_job_t *job, rs_long_t pos, size_t off);
+static inline void rs_extendmatch(rs_job_t *job, rs_long_t *match_pos,
+                                  size_t *match_len);
 static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
                                        size_t match_len);
 static inline rs_result rs_appendmiss(rs_job_t *job, size_t miss_len);
@@ -121,10 +135,11 @@ static inline rs_result rs_processmiss(rs_job_t *job);
  * and input buffer. */
 static rs_result rs_delta_s_scan(rs_job_t *job)
 {
-    const size_t block_len = job->signature->block_len;
+    const size_t block_len = rs_scanlen(job);
     rs_long_t match_pos;
     size_t match_len;
     rs_result result;
+    rs_timer_t timer;
 
     rs_job_check(job);
     /* output any pending output from the tube */
@@ -134,19 +149,28 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
     if ((result = rs_getinput(job, block_len)) != RS_DONE)
         return result;
     /* while output is not blocked and there is a block of data */
+    rs_timer_start(&timer, &job->timing);
     while ((result == RS_DONE) && ((job->scan_pos + block_len) < job->scan_len)) {
-        /* check if this block matches */
-        if (rs_findmatch(job, &match_pos, &match_len)) {
-            /* append the match and reset the weak_sum */
+        if (rs_signature_is_cdc(job->signature)) {
+            /* append the chunk as a match or a miss */
+            if (rs_findchunk(job, &match_pos, &match_len))
+                result = rs_appendmatch(job, match_pos, match_len);
+            else
+                result = rs_appendmiss(job, match_len);
+        } else if (rs_findmatch(job, &match_pos, &match_len)) {
+            /* append the match and reset the weak_sums */
             result = rs_appendmatch(job, match_pos, match_len);
             weaksum_reset(&job->weak_sum);
+            weaksum_reset(&job->fine_sum);
         } else {
-            /* rotate the weak_sum and append the miss byte */
+            /* rotate the weak_sums and append the miss byte */
             weaksum_rotate(&job->weak_sum, job->scan_buf[job->scan_pos],
                            job->scan_buf[job->scan_pos + block_len]);
+            rs_rollfine(job);
             result = rs_appendmiss(job, 1);
         }
     }
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_ROLLSUM);
     /* if we completed OK */
     if (result == RS_DONE) {
         /* if we reached eof, we can flush the last fragment */
@@ -163,10 +187,11 @@ static rs_result rs_delta_s_scan(rs_job_t *job)
 
 static rs_result rs_delta_s_flush(rs_job_t *job)
 {
-    const size_t block_len = job->signature->block_len;
+    const size_t block_len = rs_scanlen(job);
     rs_long_t match_pos;
     size_t match_len;
     rs_result result;
+    rs_timer_t timer;
 
     rs_job_check(job);
     /* output any pending output from the tube */
@@ -176,20 +201,29 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
     if ((result = rs_getinput(job, block_len)) != RS_DONE)
         return result;
     /* while output is not blocked and there is any remaining data */
+    rs_timer_start(&timer, &job->timing);
     while ((result == RS_DONE) && (job->scan_pos < job->scan_len)) {
-        /* check if this block matches */
-        if (rs_findmatch(job, &match_pos, &match_len)) {
-            /* append the match and reset the weak_sum */
+        if (rs_signature_is_cdc(job->signature)) {
+            /* append the chunk as a match or a miss */
+            if (rs_findchunk(job, &match_pos, &match_len))
+                result = rs_appendmatch(job, match_pos, match_len);
+            else
+                result = rs_appendmiss(job, match_len);
+        } else if (rs_findmatch(job, &match_pos, &match_len)) {
+            /* append the match and reset the weak_sums */
             result = rs_appendmatch(job, match_pos, match_len);
             weaksum_reset(&job->weak_sum);
+            weaksum_reset(&job->fine_sum);
         } else {
             /* rollout from weak_sum and append the miss byte */
             weaksum_rollout(&job->weak_sum, job->scan_buf[job->scan_pos]);
             rs_trace("block reduced to " FMT_SIZE "",
                      weaksum_count(&job->weak_sum));
+            rs_rollfine(job);
             result = rs_appendmiss(job, 1);
         }
     }
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_ROLLSUM);
     /* if we are not blocked, flush and set end statefn. */
     if (result == RS_DONE) {
         result = rs_appendflush(job);
@@ -203,6 +237,8 @@ static rs_result rs_delta_s_flush(rs_job_t *job)
 
 static rs_result rs_delta_s_end(rs_job_t *job)
 {
+    if (job->delta_magic == RS_BLAKE2_DELTA_MAGIC)
+        rs_emit_checksum_cmd(job);
     rs_emit_end_cmd(job);
     return RS_DONE;
 }
@@ -217,20 +253,40 @@ static inline rs_result rs_getinput(rs_job_t *job, size_t block_len)
     return rs_scoop_readahead(job, job->scan_len, (void **)&job->scan_buf);
 }
 
+/** Get the length of data needed after scan_pos to scan for a match.
+ *
+ * This is the block_len, or the max chunk length for CDC signatures. */
+static inline size_t rs_scanlen(rs_job_t *job)
+{
+    const size_t block_len = job->signature->block_len;
+
+    return rs_signature_is_cdc(job->signature) ? RS_CDC_MAX_LEN(block_len) :
+        block_len;
+}
+
 /** find a match at scan_pos, returning the match_pos and match_len.
  *
  * Note that this will calculate weak_sum if required. It will also determine
  * the match_len.
  *
- * This routine could be modified to do xdelta style matches that would extend
- * matches past block boundaries by matching backwards and forwards beyond the
- * block boundaries. Extending backwards would require decrementing scan_pos as
- * appropriate. */
+ * If the basis is available this will also do xdelta style matches that
+ * extend matches past block boundaries using rs_extendmatch(). */
 static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
                                size_t *match_len)
 {
     const size_t block_len = job->signature->block_len;
+    rs_timer_t timer;
 
+    if (job->copy_cb && !job->basis_buf)
+        job->basis_buf =
+            rs_alloc(&job->heap, EXTEND_LEN + 1, "basis buffer");
+    /* If the basis is available, try to continue the previous match. */
+    if (job->copy_cb && job->basis_len
+        && (*match_len =
+            rs_extendfwd(job, job->basis_pos + job->basis_len, 0))) {
+        *match_pos = job->basis_pos + job->basis_len;
+        return 1;
+    }
     /* calculate the weak_sum if we don't have one */
     if (weaksum_count(&job->weak_sum) == 0) {
         /* set match_len to min(block_len, scan_avail) */
@@ -247,19 +303,197 @@ static inline int rs_findmatch(rs_job_t *job, rs_long_t *match_pos,
         /* set the match_len to the weak_sum count */
         *match_len = weaksum_count(&job->weak_sum);
     }
+    /* Prefer matches that extend the previous match, then matches at the
+       same offset, so duplicate blocks give fewer and more sequential COPY
+       commands. */
+    rs_timer_start(&timer, &job->timing);
     *match_pos =
-        rs_signature_find_match(job->signature, weaksum_digest(&job->weak_sum),
-                                job->scan_buf + job->scan_pos, *match_len);
+        rs_signature_find_match_near(job->signature,
+                                     weaksum_digest(&job->weak_sum),
+                                     job->scan_buf + job->scan_pos,
+                                     *match_len,
+                                     job->basis_len ? job->basis_pos +
+                                     job->basis_len : -1, job->scan_off,
+                                     &job->match,
+                                     &job->hists.probe_lens, &job->timing);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_HASHTABLE);
+    /* For in-place deltas reject matches before the new file position. */
+    if ((job->flags & RS_DELTA_INPLACE) && *match_pos < job->scan_off)
+        *match_pos = -1;
+    /* For multi-resolution signatures try the fine blocks on a miss. */
+    if (*match_pos == -1 && job->signature->fine)
+        rs_findfine(job, match_pos, match_len);
+    if (*match_pos != -1 && job->copy_cb)
+        rs_extendmatch(job, match_pos, match_len);
     return *match_pos != -1;
 }
 
+/** Find a fine block match at scan_pos for multi-resolution signatures,
+ * returning the match_pos and match_len.
+ *
+ * This is like rs_findmatch() using the fine signature and fine_sum, and is
+ * only called inside misses so fine blocks are only looked up where blocks
+ * don't match. */
+static inline int rs_findfine(rs_job_t *job, rs_long_t *match_pos,
+                              size_t *match_len)
+{
+    rs_signature_t *fine = job->signature->fine;
+    const size_t block_len = fine->block_len;
+    rs_timer_t timer;
+
+    if (weaksum_count(&job->fine_sum) == 0) {
+        *match_len = job->scan_len - job->scan_pos;
+        if (*match_len > block_len)
+            *match_len = block_len;
+        weaksum_update(&job->fine_sum, job->scan_buf + job->scan_pos,
+                       *match_len);
+    } else {
+        *match_len = weaksum_count(&job->fine_sum);
+    }
+    rs_timer_start(&timer, &job->timing);
+    *match_pos =
+        rs_signature_find_match_near(fine, weaksum_digest(&job->fine_sum),
+                                     job->scan_buf + job->scan_pos,
+                                     *match_len,
+                                     job->basis_len ? job->basis_pos +
+                                     job->basis_len : -1, job->scan_off,
+                                     &job->match,
+                                     &job->hists.probe_lens, &job->timing);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_HASHTABLE);
+    if ((job->flags & RS_DELTA_INPLACE) && *match_pos < job->scan_off)
+        *match_pos = -1;
+    return *match_pos != -1;
+}
+
+/** Roll the fine_sum forward one byte for multi-resolution signatures.
+ *
+ * The fine_sum rotates while there is a whole fine block after scan_pos, and
+ * then rolls out to shrink with the remaining data near EOF. */
+static inline void rs_rollfine(rs_job_t *job)
+{
+    const rs_signature_t *fine = job->signature->fine;
+
+    if (!fine || weaksum_count(&job->fine_sum) == 0)
+        return;
+    if (job->scan_pos + fine->block_len < job->scan_len)
+        weaksum_rotate(&job->fine_sum, job->scan_buf[job->scan_pos],
+                       job->scan_buf[job->scan_pos + fine->block_len]);
+    else
+        weaksum_rollout(&job->fine_sum, job->scan_buf[job->scan_pos]);
+}
+
+/** Find the chunk at scan_pos for CDC signatures and see if it matches,
+ * returning the match_pos and match_len.
+ *
+ * The match_len is always set to the chunk length so non-matching chunks can
+ * be appended as a miss. */
+static inline int rs_findchunk(rs_job_t *job, rs_long_t *match_pos,
+                               size_t *match_len)
+{
+    rs_byte_t *chunk = job->scan_buf + job->scan_pos;
+    rs_timer_t timer;
+
+    *match_len =
+        rs_cdc_chunk(chunk, job->scan_len - job->scan_pos,
+                     job->signature->block_len);
+    rs_timer_start(&timer, &job->timing);
+    *match_pos =
+        rs_signature_find_chunk(job->signature, chunk, *match_len,
+                                &job->match, &job->hists.probe_lens,
+                                &job->timing);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_HASHTABLE);
+    /* For in-place deltas reject matches before the new file position. */
+    if ((job->flags & RS_DELTA_INPLACE) && *match_pos < job->scan_off)
+        *match_pos = -1;
+    return *match_pos != -1;
+}
+
+/** Get the length of the scanned data at scan_pos + off that matches the
+ * basis at pos.
+ *
+ * Basis reads ask for one byte more than is compared, so they stop on a short
+ * read before ever reading at the end of the basis. The first read must be
+ * known to have data, which it does if the signature has the basis size, or
+ * if it is not past the start of the last block. */
+static inline size_t rs_extendfwd(rs_job_t *job, rs_long_t pos, size_t off)
+{
+    const rs_signature_t *sig = job->signature;
+    size_t max = job->scan_len - job->scan_pos - off, fwd = 0, want, got, i;
+    rs_byte_t *scan = job->scan_buf + job->scan_pos + off;
+    void *p;
+
+    if (pos > (sig->basis_cb ? sig->basis_size - 1 :
+               (rs_long_t)(sig->count - 1) * sig->block_len))
+        return 0;
+    while (fwd < max) {
+        want = max - fwd < EXTEND_LEN ? max - fwd : EXTEND_LEN;
+        got = want + 1;
+        p = job->basis_buf;
+        if (job->copy_cb(job->copy_arg, pos + (rs_long_t)fwd, &got, &p) !=
+            RS_DONE)
+            break;
+        for (i = 0; i < want && i < got && ((rs_byte_t *)p)[i] == scan[fwd + i];
+             i++) ;
+        fwd += i;
+        if (i < want || got <= want)
+            break;
+    }
+    return fwd;
+}
+
+/** Extend a match backwards and forwards by comparing against the basis.
+ *
+ * Backwards extension moves data from the end of a pending miss into the
+ * match by decrementing scan_pos. Forwards extension includes any following
+ * scanned data that matches. */
+static inline void rs_extendmatch(rs_job_t *job, rs_long_t *match_pos,
+                                  size_t *match_len)
+{
+    size_t back_max, back = 0, fwd, len, i;
+    rs_byte_t *scan;
+    void *p;
+
+    /* We can extend backwards into a pending miss. */
+    back_max = job->basis_len ? 0 : job->scan_pos;
+    if ((rs_long_t)back_max > *match_pos)
+        back_max = (size_t)*match_pos;
+    while (back < back_max) {
+        len = back_max - back < EXTEND_LEN ? back_max - back : EXTEND_LEN;
+        p = job->basis_buf;
+        if (job->copy_cb(job->copy_arg, *match_pos - (rs_long_t)(back + len),
+                         &len, &p) != RS_DONE || !len)
+            break;
+        scan = job->scan_buf + job->scan_pos - back;
+        for (i = len; i > 0 && ((rs_byte_t *)p)[i - 1] == scan[i - len - 1];
+             i--) ;
+        back += len - i;
+        if (i)
+            break;
+    }
+    fwd = rs_extendfwd(job, *match_pos + (rs_long_t)*match_len, *match_len);
+    if (back || fwd) {
+        rs_trace("extended match at " FMT_LONG " back " FMT_SIZE " and forward "
+                 FMT_SIZE " bytes", *match_pos, back, fwd);
+        job->scan_pos -= back;
+        job->scan_off -= (rs_long_t)back;
+        *match_pos -= (rs_long_t)back;
+        *match_len += back + fwd;
+    }
+}
+
 /** Append a match at match_pos of length match_len to the delta, extending a
  * previous match if possible, or flushing any previous miss/match. */
 static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
                                        size_t match_len)
 {
     rs_result result = RS_DONE;
+#ifdef DO_RS_TIMING
+    uint64_t now = rs_timing_now();
 
+    rs_histogram_add(&job->hists.match_gaps, (rs_long_t)(now - job->match_ns));
+    job->match_ns = now;
+#endif
+    rs_probe4(match, job, job->scan_off, match_pos, match_len);
     /* if last was a match that can be extended, extend it */
     if (job->basis_len && (job->basis_pos + job->basis_len) == match_pos) {
         job->basis_len += match_len;
@@ -272,6 +506,7 @@ static inline rs_result rs_appendmatch(rs_job_t *job, rs_long_t match_pos,
     }
     /* increment scan_pos to point at next unscanned data */
     job->scan_pos += match_len;
+    job->scan_off += match_len;
     /* we can only process from the scoop if output is not blocked */
     if (result == RS_DONE) {
         /* process the match data off the scoop */
@@ -289,12 +524,16 @@ static inline rs_result rs_appendmiss(rs_job_t *job, size_t miss_len)
 {
     rs_result result = RS_DONE;
 
-    /* If last was a match, or MAX_MISS_LEN misses, appendflush it. */
-    if (job->basis_len || (job->scan_pos >= MAX_MISS_LEN)) {
+    /* If last was a match, or the miss would grow past MAX_MISS_LEN,
+       appendflush it. CDC misses grow a whole chunk at a time, so this keeps
+       them within MAX_MISS_LEN unless a single chunk is longer. */
+    if (job->basis_len
+        || (job->scan_pos && job->scan_pos + miss_len > MAX_MISS_LEN)) {
         result = rs_appendflush(job);
     }
     /* increment scan_pos */
     job->scan_pos += miss_len;
+    job->scan_off += miss_len;
     return result;
 }
 
@@ -306,6 +545,8 @@ static inline rs_result rs_appendflush(rs_job_t *job)
         rs_trace("matched " FMT_LONG " bytes at " FMT_LONG "!", job->basis_len,
                  job->basis_pos);
         rs_emit_copy_cmd(job, job->basis_pos, job->basis_len);
+        /* Leave basis_pos at the end of the match for rs_job_progress(). */
+        job->basis_pos += job->basis_len;
         job->basis_len = 0;
         return rs_processmatch(job);
         /* else if last is a miss, emit and process it */
@@ -380,10 +621,23 @@ static rs_result rs_delta_s_slack(rs_job_t *job)
     return RS_BLOCKED;
 }
 
+/** State for an unchanged new file skipped by rs_delta_skip_unchanged(),
+ * which is a single COPY of the whole basis. */
+static rs_result rs_delta_s_unchanged(rs_job_t *job)
+{
+    rs_emit_delta_header(job);
+    rs_emit_copy_cmd(job, 0, job->signature->file_len);
+    job->statefn = rs_delta_s_end;
+    return RS_RUNNING;
+}
+
 /** State function for writing out the header of the encoding job. */
 static rs_result rs_delta_s_header(rs_job_t *job)
 {
     rs_emit_delta_header(job);
+#ifdef DO_RS_TIMING
+    job->match_ns = rs_timing_now();
+#endif
     if (job->signature) {
         job->statefn = rs_delta_s_scan;
     } else {
@@ -394,10 +648,23 @@ static rs_result rs_delta_s_header(rs_job_t *job)
 }
 
 rs_job_t *rs_delta_begin(rs_signature_t *sig)
+{
+    return rs_delta_begin_flags(sig, 0);
+}
+
+rs_job_t *rs_delta_begin_flags(rs_signature_t *sig, int flags)
 {
     rs_job_t *job;
 
     job = rs_job_new("delta", rs_delta_s_header);
+    job->flags = flags;
+    job->new_is_input = 1;
+    if (flags & RS_DELTA_CHECKSUM) {
+        job->delta_magic = RS_BLAKE2_DELTA_MAGIC;
+        rs_job_set_digest(job);
+    } else {
+        job->delta_magic = RS_DELTA_MAGIC;
+    }
     /* Caller can pass NULL sig or empty sig for "slack deltas". */
     if (sig && sig->count > 0) {
         rs_signature_check(sig);
@@ -405,6 +672,47 @@ rs_job_t *rs_delta_begin(rs_signature_t *sig)
         assert(sig->hashtable);
         job->signature = sig;
         weaksum_init(&job->weak_sum, rs_signature_weaksum_kind(sig));
+        if (sig->fine)
+            weaksum_init(&job->fine_sum, rs_signature_weaksum_kind(sig->fine));
     }
     return job;
 }
+
+rs_result rs_delta_set_basis(rs_job_t *job, rs_copy_cb * copy_cb,
+                             void *copy_arg)
+{
+    rs_job_check(job);
+    if (job->statefn != rs_delta_s_header)
+        return RS_PARAM_ERROR;
+    job->copy_cb = copy_cb;
+    job->copy_arg = copy_arg;
+    return RS_DONE;
+}
+
+rs_result rs_delta_set_sig(rs_job_t *job, rs_signature_t **sig,
+                           rs_magic_number sig_magic, size_t block_len,
+                           size_t strong_len)
+{
+    rs_job_check(job);
+    if (job->statefn != rs_delta_s_header || job->new_sig)
+        return RS_PARAM_ERROR;
+    return rs_job_set_sig(job, sig, sig_magic, block_len, strong_len);
+}
+
+rs_result rs_delta_skip_unchanged(rs_job_t *job, rs_long_t new_len,
+                                  const void *new_digest)
+{
+    rs_signature_t *sig = job->signature;
+
+    rs_job_check(job);
+    if (job->statefn != rs_delta_s_header || job->new_sig)
+        return RS_PARAM_ERROR;
+    /* Empty signatures are not kept, but their deltas are tiny anyway. */
+    if (!sig || sig->file_len < 0 || sig->file_len != new_len
+        || memcmp(sig->file_digest, new_digest, sizeof sig->file_digest))
+        return RS_RUNNING;
+    rs_trace("new file is unchanged, skipping it");
+    job->digest_new = 0;
+    job->statefn = rs_delta_s_unchanged;
+    return RS_DONE;
+}
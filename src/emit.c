@@ -21,24 +21,32 @@
 
 #include "config.h"             /* IWYU pragma: keep */
 #include <assert.h>
+#include <string.h>
 #include "librsync.h"
 #include "emit.h"
 #include "job.h"
 #include "netint.h"
+#include "probes.h"
 #include "prototab.h"
+#include "scoop.h"
+#include "sumset.h"
+#include "timing.h"
 #include "trace.h"
+#include "util.h"
 
 void rs_emit_delta_header(rs_job_t *job)
 {
-    rs_trace("emit DELTA magic");
-    rs_squirt_n4(job, RS_DELTA_MAGIC);
+    rs_trace("emit DELTA magic %#x", job->delta_magic);
+    rs_squirt_n4(job, job->delta_magic);
 }
 
 void rs_emit_literal_cmd(rs_job_t *job, int len)
 {
     int cmd;
     int param_len = len <= 64 ? 0 : rs_int_len(len);
+    rs_timer_t timer;
 
+    rs_timer_start(&timer, &job->timing);
     if (param_len == 0) {
         cmd = len;
         rs_trace("emit LITERAL_%d, cmd_byte=%#04x", len, cmd);
@@ -61,6 +69,9 @@ void rs_emit_literal_cmd(rs_job_t *job, int len)
     job->stats.lit_cmds++;
     job->stats.lit_bytes += len;
     job->stats.lit_cmdbytes += 1 + param_len;
+    rs_histogram_add(&job->hists.lit_lens, len);
+    rs_probe2(literal, job, len);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_EMIT);
 }
 
 void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
@@ -69,7 +80,9 @@ void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
     rs_stats_t *stats = &job->stats;
     const int where_bytes = rs_int_len(where);
     const int len_bytes = rs_int_len(len);
+    rs_timer_t timer;
 
+    rs_timer_start(&timer, &job->timing);
     /* Commands ascend (1,1), (1,2), ... (8, 8) */
     if (where_bytes == 8)
         cmd = RS_OP_COPY_N8_N1;
@@ -100,6 +113,29 @@ void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len)
     stats->copy_cmds++;
     stats->copy_bytes += len;
     stats->copy_cmdbytes += 1 + where_bytes + len_bytes;
+    rs_histogram_add(&job->hists.copy_lens, len);
+    rs_probe3(copy, job, where, len);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_EMIT);
+}
+
+void rs_emit_checksum_cmd(rs_job_t *job)
+{
+    int cmd = RS_OP_CHECKSUM;
+    rs_byte_t digest[RS_MAX_STRONG_SUM_LENGTH];
+
+    /* Skipped unchanged new files have the digest of the basis. */
+    if (job->digest_new) {
+        blake2b_final(&job->new_digest, digest, sizeof digest);
+        /* The new signature can keep the digest too. */
+        if (job->new_sig) {
+            job->new_sig->file_len = job->new_len;
+            memcpy(job->new_sig->file_digest, digest, sizeof digest);
+        }
+    } else
+        memcpy(digest, job->signature->file_digest, sizeof digest);
+    rs_trace("emit CHECKSUM, cmd_byte=%#04x", cmd);
+    rs_squirt_byte(job, (rs_byte_t)cmd);
+    rs_tube_write(job, digest, sizeof digest);
 }
 
 void rs_emit_end_cmd(rs_job_t *job)
@@ -41,6 +41,12 @@ void rs_emit_literal_cmd(rs_job_t *, int len);
  * representation for the parameters. */
 void rs_emit_copy_cmd(rs_job_t *job, rs_long_t where, rs_long_t len);
 
+/** Write a CHECKSUM command with the BLAKE2 digest of the new file.
+ *
+ * This is the digest of the new file read by the job, or the digest of the
+ * basis in the signature if the new file was skipped as unchanged. */
+void rs_emit_checksum_cmd(rs_job_t *);
+
 /** Write an END command. */
 void rs_emit_end_cmd(rs_job_t *);
 
@@ -0,0 +1,180 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file events.c
+ * Per-thread lock-free rings of binary trace events.
+ *
+ * Each ring has a single producer, the thread it is set for, and a single
+ * consumer. The producer only writes head and the consumer only writes tail,
+ * so they only need atomic loads and stores with acquire/release ordering to
+ * hand over events. They are in separate cache lines so the producer and
+ * consumer don't keep taking the line from each other. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+#include "events.h"
+#include "timing.h"
+#include "trace.h"
+
+static char const *const rs_event_names[] = {
+    "unknown", "job_start", "job_end", "fill", "drain", "scoop_resize",
+    "match", "strong_sum", "literal", "copy", "patch_literal", "patch_copy"
+};
+
+#define RS_EVENT_TYPES (int)(sizeof(rs_event_names) / sizeof(*rs_event_names))
+
+/** The ring buffer, with events[0..size] holding events from tail to head. */
+struct rs_event_ring {
+    uint64_t head;              /**< The count of events written. */
+    uint64_t dropped;           /**< The count of events dropped. */
+    char head_pad[64 - 2 * sizeof(uint64_t)];
+    uint64_t tail;              /**< The count of events read. */
+    char tail_pad[64 - sizeof(uint64_t)];
+    uint64_t mask;              /**< The size of events minus one. */
+    rs_event_t events[];
+};
+
+#ifdef DO_RS_EVENTS
+__thread rs_event_ring_t *rs_event_ring_thread;
+
+void rs_event_put(rs_event_ring_t *ring, int type, int nargs, int64_t a1,
+                  int64_t a2, int64_t a3, int64_t a4, int64_t a5)
+{
+    uint64_t head = ring->head;
+    rs_event_t *e;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    e = &ring->events[head & ring->mask];
+    e->ns = rs_timing_now();
+    e->type = type;
+    e->nargs = nargs;
+    e->args[0] = a1;
+    e->args[1] = a2;
+    e->args[2] = a3;
+    e->args[3] = a4;
+    e->args[4] = a5;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+int rs_supports_events(void)
+{
+#ifdef DO_RS_EVENTS
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+rs_event_ring_t *rs_event_ring_new(size_t capacity)
+{
+    rs_event_ring_t *ring;
+    size_t size;
+
+    for (size = 1; size < capacity; size <<= 1) ;
+    if (!(ring = calloc(1, sizeof(*ring) + size * sizeof(rs_event_t))))
+        return NULL;
+    ring->mask = size - 1;
+    return ring;
+}
+
+void rs_event_ring_free(rs_event_ring_t *ring)
+{
+    free(ring);
+}
+
+rs_event_ring_t *rs_event_ring_set(rs_event_ring_t *ring)
+{
+#ifdef DO_RS_EVENTS
+    rs_event_ring_t *prev = rs_event_ring_thread;
+
+    rs_event_ring_thread = ring;
+    return prev;
+#else
+    (void)ring;
+    return NULL;
+#endif
+}
+
+size_t rs_event_ring_read(rs_event_ring_t *ring, rs_event_t *events,
+                          size_t max)
+{
+#ifdef DO_RS_EVENTS
+    uint64_t tail = ring->tail;
+    uint64_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+    size_t i, n = avail < max ? (size_t)avail : max;
+
+    for (i = 0; i < n; i++)
+        events[i] = ring->events[(tail + i) & ring->mask];
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+    return n;
+#else
+    (void)ring;
+    (void)events;
+    (void)max;
+    return 0;
+#endif
+}
+
+uint64_t rs_event_ring_dropped(rs_event_ring_t const *ring)
+{
+#ifdef DO_RS_EVENTS
+    return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+#else
+    return ring->dropped;
+#endif
+}
+
+char const *rs_event_name(int type)
+{
+    if (type <= 0 || type >= RS_EVENT_TYPES)
+        return rs_event_names[0];
+    return rs_event_names[type];
+}
+
+char *rs_format_event(rs_event_t const *event, char *buf, size_t size)
+{
+    size_t len;
+    int i;
+
+    len = (size_t)snprintf(buf, size, "%llu.%09llu %s(%p",
+                           (unsigned long long)(event->ns / 1000000000),
+                           (unsigned long long)(event->ns % 1000000000),
+                           rs_event_name(event->type),
+                           (void *)(intptr_t)event->args[0]);
+    for (i = 1; i < event->nargs && len < size; i++) {
+        /* The job events have the job name as their second argument. */
+        if (i == 1 && (event->type == RS_EVENT_JOB_START
+                       || event->type == RS_EVENT_JOB_END))
+            len += (size_t)snprintf(buf + len, size - len, ", %s",
+                                    (char const *)(intptr_t)event->args[i]);
+        else
+            len += (size_t)snprintf(buf + len, size - len, ", " FMT_LONG,
+                                    (rs_long_t)event->args[i]);
+    }
+    if (len < size)
+        snprintf(buf + len, size - len, ")");
+    return buf;
+}
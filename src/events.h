@@ -0,0 +1,64 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file events.h
+ * Recording binary trace events in per-thread rings.
+ *
+ * Events are recorded by the rs_probe*() macros in probes.h. Each thread has
+ * a pointer to the ::rs_event_ring_t it records in, so recording an event when
+ * there is no ring is just a thread local load and a branch.
+ *
+ * Unless DO_RS_EVENTS is defined here for platforms that support it, these
+ * all compile to nothing and their arguments are not evaluated.
+ *
+ * \sa \ref api_trace */
+#ifndef EVENTS_H
+#  define EVENTS_H
+
+#  include <stdint.h>
+#  include "librsync.h"
+
+#  if defined(__GNUC__) && UINTPTR_MAX == UINT64_MAX
+#    define DO_RS_EVENTS 1
+#  endif
+
+#  ifdef DO_RS_EVENTS
+/** The calling thread's ring, or NULL if it doesn't record events. */
+extern __thread rs_event_ring_t *rs_event_ring_thread;
+
+/** Record an event in a ring. */
+void rs_event_put(rs_event_ring_t *ring, int type, int nargs, int64_t a1,
+                  int64_t a2, int64_t a3, int64_t a4, int64_t a5);
+
+#    define rs_event(type, nargs, a1, a2, a3, a4, a5) do {\
+    rs_event_ring_t *const _ring = rs_event_ring_thread;\
+    if (__builtin_expect(_ring != NULL, 0))\
+        rs_event_put(_ring, type, nargs, (int64_t)(a1), (int64_t)(a2),\
+                     (int64_t)(a3), (int64_t)(a4), (int64_t)(a5));\
+} while (0)
+#  else
+/* Use the arguments in sizeof() so they are not evaluated but don't give
+   unused variable warnings. */
+#    define rs_event(type, nargs, a1, a2, a3, a4, a5) do {\
+    (void)sizeof(a1); (void)sizeof(a2); (void)sizeof(a3); (void)sizeof(a4);\
+    (void)sizeof(a5);\
+} while (0)
+#  endif
+
+#endif                          /* !EVENTS_H */
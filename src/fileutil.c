@@ -47,6 +47,7 @@
 #  include <io.h>               /* IWYU pragma: keep */
 #endif
 #include "librsync.h"
+#include "fileutil.h"
 #include "trace.h"
 
 /* Use fseeko64, _fseeki64, or fseeko for long files if they exist. */
@@ -78,6 +79,14 @@
 #  define fileno(f) _fileno((f))
 #endif
 
+/* Use ftruncate64 or _chsize_s for long file truncate if they exist. */
+#if defined(HAVE_FTRUNCATE64) && (SIZEOF_OFF_T < 8)
+#  define ftruncate(f, s) ftruncate64((f), (s))
+#elif defined(HAVE__CHSIZE_S)
+#  define ftruncate(f, s) _chsize_s((f), (s))
+#  define HAVE_FTRUNCATE 1
+#endif
+
 FILE *rs_file_open(char const *filename, char const *mode, int force)
 {
     FILE *f;
@@ -132,6 +141,29 @@ rs_long_t rs_file_size(FILE *f)
     return -1;
 }
 
+rs_result rs_file_seek(FILE *f, rs_long_t pos)
+{
+    if (fseek(f, pos, SEEK_SET)) {
+        rs_error("seek failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+}
+
+rs_result rs_file_truncate(FILE *f, rs_long_t size)
+{
+#ifdef HAVE_FTRUNCATE
+    if (fflush(f) || ftruncate(fileno(f), size)) {
+        rs_error("truncate failed: %s", strerror(errno));
+        return RS_IO_ERROR;
+    }
+    return RS_DONE;
+#else
+    rs_error("truncate is not supported on this platform");
+    return RS_UNIMPLEMENTED;
+#endif
+}
+
 rs_result rs_file_copy_cb(void *arg, rs_long_t pos, size_t *len, void **buf)
 {
     FILE *f = (FILE *)arg;
@@ -1,8 +1,8 @@
 /*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
  *
- * rabinkarp_perf -- peformance tests for the rabinkarp checksum.
+ * librsync -- the library for network deltas
  *
- * Copyright (C) 2003 by Donovan Baarda <abo@minkirri.apana.org.au>
+ * Copyright (C) 2000, 2001 by Martin Pool <mbp@sourcefrog.net>
  *
  * This program is free software; you can redistribute it and/or
  * modify it under the terms of the GNU Lesser General Public License
@@ -19,23 +19,21 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
-#include <stdio.h>
-#include <inttypes.h>
-#include "rabinkarp.h"
+/** \file fileutil.h
+ * Internal platform independent file operations.
+ *
+ * These use the large file versions of the stdio operations where they are
+ * available, and are used by the whole-file API. */
+#ifndef FILEUTIL_H
+#  define FILEUTIL_H
+
+#  include <stdio.h>
+#  include "librsync.h"
+
+/** Seek to an absolute position in a file. */
+rs_result rs_file_seek(FILE *f, rs_long_t pos);
 
-int main(int argc, char **argv)
-{
-    rabinkarp_t r;
-    int i;
-    uint8_t buf[1024];
-    uint32_t sum;
+/** Flush and truncate a file to a size. */
+rs_result rs_file_truncate(FILE *f, rs_long_t size);
 
-    rabinkarp_init(&r);
-    for (i = 0; i < 1024 * 1024; i++) {
-        fread(buf, 1024, 1, stdin);
-        rabinkarp_update(&r, buf, 1024);
-    }
-    sum = rabinkarp_digest(&r);
-    printf("%08" PRIx32 "\n", sum);
-    return 0;
-}
+#endif                          /* !FILEUTIL_H */
@@ -20,7 +20,9 @@
  */
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include "hashtable.h"
+#include "util.h"
 
 /* Open addressing works best if it can take advantage of memory caches using
    locality for probes of adjacent buckets on collisions. So we pack the keys
@@ -33,7 +35,7 @@
 #define HASHTABLE_LOADFACTOR_NUM 7
 #define HASHTABLE_LOADFACTOR_DEN 10
 
-hashtable_t *_hashtable_new(int size)
+hashtable_t *_hashtable_new(int size, rs_heap_t *heap)
 {
     hashtable_t *t;
     unsigned size2, bits2;
@@ -42,20 +44,16 @@ hashtable_t *_hashtable_new(int size)
     size = 1 + size * HASHTABLE_LOADFACTOR_DEN / HASHTABLE_LOADFACTOR_NUM;
     /* Use next power of 2 larger than the requested size and get mask bits. */
     for (size2 = 2, bits2 = 1; (int)size2 < size; size2 <<= 1, bits2++) ;
-    if (!(t = calloc(1, sizeof(hashtable_t)+ size2 * sizeof(unsigned))))
-        return NULL;
-    if (!(t->etable = calloc(size2, sizeof(void *)))) {
-        _hashtable_free(t);
-        return NULL;
-    }
+    t = rs_alloc_struct0(heap, sizeof(hashtable_t) + size2 * sizeof(unsigned),
+                         "hashtable");
+    t->etable =
+        rs_alloc_struct0(heap, size2 * sizeof(void *), "hashtable->etable");
+    t->heap = heap;
     t->size = (int)size2;
     t->count = 0;
     t->tmask = size2 - 1;
 #ifndef HASHTABLE_NBLOOM
-    if (!(t->kbloom = calloc((size2 + 7) / 8, sizeof(unsigned char)))) {
-        _hashtable_free(t);
-        return NULL;
-    }
+    t->kbloom = rs_alloc_struct0(heap, (size2 + 7) / 8, "hashtable->kbloom");
     t->bshift = (unsigned)sizeof(unsigned) * 8 - bits2;
     assert(t->tmask == (unsigned)-1 >> t->bshift);
 #endif
@@ -67,11 +65,69 @@ hashtable_t *_hashtable_new(int size)
 
 void _hashtable_free(hashtable_t *t)
 {
+    size_t size;
+
     if (t) {
-        free(t->etable);
+        size = (size_t)t->size;
+        rs_free(t->heap, t->etable, size * sizeof(void *));
 #ifndef HASHTABLE_NBLOOM
-        free(t->kbloom);
+        rs_free(t->heap, t->kbloom, (size + 7) / 8);
 #endif
-        free(t);
+        rs_free(t->heap, t, sizeof(hashtable_t) + size * sizeof(unsigned));
     }
 }
+
+/** Count a probe length in a probe histogram. */
+static inline void hashtable_probes_add(long *probes, unsigned n)
+{
+    probes[n < HASHTABLE_PROBES ? n : HASHTABLE_PROBES - 1]++;
+}
+
+void hashtable_layout(hashtable_t const *t, hashtable_layout_t *layout)
+{
+    unsigned const *const ktable = t->ktable;
+    unsigned const tmask = t->tmask;
+    unsigned j, i, s, h, n, dups;
+    bool first;
+
+    memset(layout, 0, sizeof(*layout));
+    layout->size = t->size;
+    layout->count = t->count;
+    for (j = 0; j <= tmask; j++) {
+        /* Count the probes for a miss starting at this bucket. */
+        for (i = j, s = 0; ktable[i]; i = (i + ++s) & tmask) ;
+        hashtable_probes_add(layout->miss_probes, s + 1);
+        layout->miss_probes_sum += s + 1;
+        if (!(h = ktable[j]))
+            continue;
+        /* Probe for this entry from its hash's bucket, counting the entries
+           with the same hash. They are all in the same probe sequence, so the
+           cluster is counted for the first one found. */
+        first = true;
+        dups = 0;
+        for (i = h & tmask, s = 0, n = 0; ktable[i]; i = (i + ++s) & tmask) {
+            if (i == j) {
+                n = s + 1;
+                first = !dups;
+            }
+            if (ktable[i] == h)
+                dups++;
+        }
+        hashtable_probes_add(layout->hit_probes, n);
+        layout->hit_probes_sum += n;
+        if (dups > 1) {
+            layout->dup_count++;
+            if (first) {
+                layout->dup_clusters++;
+                if ((int)dups > layout->dup_max)
+                    layout->dup_max = (int)dups;
+            }
+        }
+    }
+#ifndef HASHTABLE_NBLOOM
+    for (j = 0; j <= tmask; j++)
+        layout->bloom_bits += (t->kbloom[j / 8] >> (j % 8)) & 1;
+#else
+    layout->bloom_bits = t->size;
+#endif
+}
@@ -36,8 +36,11 @@
  * particular entries by more than just their key. There is an iterator for
  * iterating through all entries in the hashtable. There are optional
  * NAME_find() find/match/hashcmp/entrycmp stats counters that can be disabled
- * by defining HASHTABLE_NSTATS. There is an optional simple k=1 bloom filter
- * for speed that can be disabled by defining HASHTABLE_NBLOOM.
+ * by defining HASHTABLE_NSTATS. NAME_find_r() is the same as NAME_find()
+ * except it counts the stats in a caller provided hashtable_stats_t instead
+ * of the hashtable, so it doesn't modify the hashtable and multiple threads
+ * can use it at once. There is an optional simple k=1 bloom filter for speed
+ * that can be disabled by defining HASHTABLE_NBLOOM.
  *
  * The types and methods of the hashtable and its contents are specified by
  * using \#define parameters set to their basenames (the prefixes for the *_t
@@ -74,7 +77,7 @@
  *   mykey_t k;
  *   myentry_t *e;
  *
- *   t = myentry_hashtable_new(300);
+ *   t = myentry_hashtable_new(300, NULL);
  *   myentry_init(&entries[5], ...);
  *   myentry_hashtable_add(t, &entries[5]);
  *   k = ...;
@@ -109,7 +112,7 @@
  *   ...
  *   mymatch_t m;
  *
- *   t = myentry_hashtable_new(300);
+ *   t = myentry_hashtable_new(300, NULL);
  *   ...
  *   m = ...;
  *   e = myentry_hashtable_find(t, &m);
@@ -124,11 +127,22 @@
 
 #  include <stdbool.h>
 
+struct rs_heap;
+
+/** Stats counters for NAME_find_r(). */
+typedef struct hashtable_stats {
+    long find_count;            /**< The count of finds tried. */
+    long match_count;           /**< The count of matches found. */
+    long hashcmp_count;         /**< The count of hash compares done. */
+    long entrycmp_count;        /**< The count of entry compares done. */
+} hashtable_stats_t;
+
 /** The hashtable type. */
 typedef struct hashtable {
     int size;                   /**< Size of allocated hashtable. */
     int count;                  /**< Number of entries in hashtable. */
     unsigned tmask;             /**< Mask to get the hashtable index. */
+    struct rs_heap *heap;       /**< Where it was allocated from, or NULL. */
 #  ifndef HASHTABLE_NBLOOM
     unsigned bshift;            /**< Shift to get the bloomfilter index. */
 #  endif
@@ -146,10 +160,41 @@ typedef struct hashtable {
     unsigned ktable[];          /**< Table of hash keys. */
 } hashtable_t;
 
+/** The length of the probe histograms in hashtable_layout_t. */
+#  define HASHTABLE_PROBES 16
+
+/** Stats of how entries are laid out in a hashtable from hashtable_layout().
+ *
+ * The probe histograms count the buckets a find compares, including the
+ * empty bucket that ends a miss, with the last element also counting all
+ * longer probes. */
+typedef struct hashtable_layout {
+    int size;                   /**< Size of allocated hashtable. */
+    int count;                  /**< Number of entries in hashtable. */
+    int dup_count;              /**< Entries with the same hash as others. */
+    int dup_clusters;           /**< Hashes shared by more than one entry. */
+    int dup_max;                /**< Most entries with the same hash. */
+    int bloom_bits;             /**< Bloom filter bits set, or size if there
+                                 * is no bloom filter. */
+    long hit_probes[HASHTABLE_PROBES];  /**< Count of entries found with n
+                                         * probes. */
+    long miss_probes[HASHTABLE_PROBES]; /**< Count of buckets a miss starting
+                                         * there does n probes from. */
+    long hit_probes_sum;        /**< Total probes to find every entry. */
+    long miss_probes_sum;       /**< Total probes for a miss from every
+                                 * bucket. */
+} hashtable_layout_t;
+
 /* void* implementations for the type-safe static inline wrappers below. */
-hashtable_t *_hashtable_new(int size);
+hashtable_t *_hashtable_new(int size, struct rs_heap *heap);
 void _hashtable_free(hashtable_t *t);
 
+/** Get the layout stats of a hashtable.
+ *
+ * This walks the whole hashtable without modifying it, and doesn't need the
+ * entry type, so it can be used on any hashtable instance. */
+void hashtable_layout(hashtable_t const *t, hashtable_layout_t *layout);
+
 #  ifndef HASHTABLE_NBLOOM
 static inline void hashtable_setbloom(hashtable_t *t, unsigned const h)
 {
@@ -158,7 +203,7 @@ static inline void hashtable_setbloom(hashtable_t *t, unsigned const h)
     t->kbloom[i / 8] |= (unsigned char)(1 << (i % 8));
 }
 
-static inline bool hashtable_getbloom(hashtable_t *t, unsigned const h)
+static inline bool hashtable_getbloom(hashtable_t const *t, unsigned const h)
 {
     /* Use upper bits for a "different hash". */
     unsigned const i = h >> t->bshift;
@@ -177,6 +222,17 @@ static inline unsigned mix32(unsigned h)
     return h;
 }
 
+/** The inverse of mix32(). */
+static inline unsigned unmix32(unsigned h)
+{
+    h ^= h >> 16;
+    h *= 0x7ed1b41d;
+    h ^= (h >> 13) ^ (h >> 26);
+    h *= 0xa5cb9243;
+    h ^= h >> 16;
+    return h;
+}
+
 /** Ensure hash's are never zero. */
 static inline unsigned nozero(unsigned h)
 {
@@ -217,6 +273,7 @@ static inline unsigned nozero(unsigned h)
 #  define NAME_stats_init _JOIN(NAME, _stats_init)
 #  define NAME_add _JOIN(NAME, _add)
 #  define NAME_find _JOIN(NAME, _find)
+#  define NAME_find_r _JOIN(NAME, _find_r)
 #  define NAME_iter _JOIN(NAME, _iter)
 #  define NAME_next _JOIN(NAME, _next)
 
@@ -252,10 +309,13 @@ static inline unsigned nozero(unsigned h)
  *
  * \param size - The desired minimum size of the hash table.
  *
- * \return The initialized hashtable instance or NULL if it failed. */
-static inline hashtable_t *NAME_new(int size)
+ * \param *heap - The heap to allocate it from, or NULL for the calling
+ * thread's allocator. The heap must outlive the hashtable.
+ *
+ * \return The initialized hashtable instance. */
+static inline hashtable_t *NAME_new(int size, struct rs_heap *heap)
 {
-    return _hashtable_new(size);
+    return _hashtable_new(size, heap);
 }
 
 /** Destroy and free a hashtable instance.
@@ -309,42 +369,74 @@ static inline ENTRY_t *NAME_add(hashtable_t *t, ENTRY_t *e)
     return t->etable[i] = e;
 }
 
-/** Find an entry in a hashtable.
+/** Find an entry in a hashtable without modifying it.
  *
  * Uses MATCH_cmp() to find the first matching entry in the table in the same
- * hash() bucket.
+ * hash() bucket, counting the find stats in \p stats. This doesn't modify the
+ * hashtable, so it can be used by multiple threads at once if MATCH_cmp()
+ * doesn't modify the entries.
  *
  * \param *t - The hashtable to search.
  *
  * \param *m - The key or match object to search for.
  *
+ * \param *stats - The stats to count the find in.
+ *
  * \return The first found entry, or NULL if nothing was found. */
-static inline ENTRY_t *NAME_find(hashtable_t *t, MATCH_t *m)
+static inline ENTRY_t *NAME_find_r(hashtable_t const *t, MATCH_t *m,
+                                   hashtable_stats_t *stats)
 {
     assert(m != NULL);
+    assert(stats != NULL);
     unsigned hm = _KEY_HASH(m);
     ENTRY_t *e;
 
-    _stats_inc(t->find_count);
+#  ifdef HASHTABLE_NSTATS
+    (void)stats;
+#  endif
+    _stats_inc(stats->find_count);
 #  ifndef HASHTABLE_NBLOOM
     if (!hashtable_getbloom(t, hm))
         return NULL;
 #  endif
     _for_probe(t, hm, i, he) {
-        _stats_inc(t->hashcmp_count);
+        _stats_inc(stats->hashcmp_count);
         if (hm == he) {
-            _stats_inc(t->entrycmp_count);
+            _stats_inc(stats->entrycmp_count);
             if (!MATCH_cmp(m, e = t->etable[i])) {
-                _stats_inc(t->match_count);
+                _stats_inc(stats->match_count);
                 return e;
             }
         }
     }
     /* Also count the compare for the empty bucket. */
-    _stats_inc(t->hashcmp_count);
+    _stats_inc(stats->hashcmp_count);
     return NULL;
 }
 
+/** Find an entry in a hashtable.
+ *
+ * This is NAME_find_r() counting the find stats in the hashtable.
+ *
+ * \param *t - The hashtable to search.
+ *
+ * \param *m - The key or match object to search for.
+ *
+ * \return The first found entry, or NULL if nothing was found. */
+static inline ENTRY_t *NAME_find(hashtable_t *t, MATCH_t *m)
+{
+    hashtable_stats_t s = { 0, 0, 0, 0 };
+    ENTRY_t *e = NAME_find_r(t, m, &s);
+
+#  ifndef HASHTABLE_NSTATS
+    t->find_count += s.find_count;
+    t->match_count += s.match_count;
+    t->hashcmp_count += s.hashcmp_count;
+    t->entrycmp_count += s.entrycmp_count;
+#  endif
+    return e;
+}
+
 static inline ENTRY_t *NAME_next(hashtable_t *t, int *i);
 
 /** Initialize a iteration and return the first entry.
@@ -404,6 +496,7 @@ static inline ENTRY_t *NAME_next(hashtable_t *t, int *i)
 #  undef NAME_stats_init
 #  undef NAME_add
 #  undef NAME_find
+#  undef NAME_find_r
 #  undef NAME_iter
 #  undef NAME_next
 #  undef _KEY_HASH
@@ -28,10 +28,15 @@
 #include "config.h"             /* IWYU pragma: keep */
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "librsync.h"
+#include "arena.h"
 #include "job.h"
+#include "probes.h"
 #include "scoop.h"
+#include "sumset.h"
+#include "timing.h"
 #include "trace.h"
 #include "util.h"
 
@@ -40,8 +45,13 @@ static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers);
 rs_job_t *rs_job_new(char const *job_name, rs_result (*statefn)(rs_job_t *))
 {
     rs_job_t *job;
+    rs_heap_t heap;
 
-    job = rs_alloc_struct(rs_job_t);
+    rs_heap_init(&heap, NULL);
+    job = rs_alloc_struct(&heap, rs_job_t);
+    job->heap = heap;
+    job->heap.mem = &job->mem;
+    rs_mem_add(&job->mem, sizeof(*job));
 
     job->job_name = job_name;
     job->dogtag = RS_JOB_TAG;
@@ -49,23 +59,161 @@ rs_job_t *rs_job_new(char const *job_name, rs_result (*statefn)(rs_job_t *))
 
     job->stats.op = job_name;
     job->stats.start = time(NULL);
+#ifdef DO_RS_TIMING
+    job->timing_start = rs_timing_now();
+#endif
 
     rs_trace("start %s job", job_name);
+    rs_probe2(job_start, job, job_name);
 
     return job;
 }
 
 rs_result rs_job_free(rs_job_t *job)
 {
-    free(job->scoop_buf);
+    rs_heap_t heap = job->heap;
+
+    rs_free(&job->heap, job->scoop_buf, job->scoop_alloc);
+    rs_free(&job->heap, job->basis_buf, EXTEND_LEN + 1);
+    rs_free(&job->heap, job->sig_buf, job->sig_buf_size);
     if (job->job_owns_sig)
         rs_free_sumset(job->signature);
+    rs_heap_done(&job->heap);
     rs_bzero(job, sizeof *job);
-    free(job);
+    /* The job itself was allocated before its arena and stats. */
+    heap.arena = NULL;
+    heap.mem = NULL;
+    rs_free(&heap, job, sizeof *job);
+
+    return RS_DONE;
+}
+
+rs_result rs_job_set_arena(rs_job_t *job, size_t chunk_len)
+{
+    rs_job_check(job);
+    if (job->heap.arena || job->iter_in || job->iter_out || job->scoop_buf
+        || job->basis_buf || job->sig_buf)
+        return RS_PARAM_ERROR;
+    job->heap.arena =
+        rs_arena_new(&job->heap, chunk_len ? chunk_len : RS_ARENA_CHUNK_LEN);
+    return RS_DONE;
+}
+
+rs_result rs_job_set_sig(rs_job_t *job, rs_signature_t **sig,
+                         rs_magic_number sig_magic, size_t block_len,
+                         size_t strong_len)
+{
+    rs_allocator_t const *prev;
+    rs_signature_t *new_sig;
+    rs_result result;
 
+    /* Allocate the signature with the job's allocator. */
+    prev = rs_set_allocator(job->heap.allocator);
+    new_sig = rs_alloc_struct(NULL, rs_signature_t);
+    result = rs_signature_init(new_sig, sig_magic, block_len, strong_len, -1);
+    if (result != RS_DONE)
+        rs_free(NULL, new_sig, sizeof(*new_sig));
+    rs_set_allocator(prev);
+    if (result != RS_DONE)
+        return result;
+    if (rs_signature_is_cdc(new_sig) || new_sig->fine) {
+        rs_error("can't generate signatures with magic %#x in %s jobs",
+                 new_sig->magic, job->job_name);
+        rs_free_sumset(new_sig);
+        return RS_UNIMPLEMENTED;
+    }
+    job->new_sig = new_sig;
+    job->sig_buf_size = (size_t)new_sig->block_len;
+    job->sig_buf =
+        rs_alloc(&job->heap, job->sig_buf_size, "signature block buffer");
+    *sig = new_sig;
     return RS_DONE;
 }
 
+void rs_job_set_digest(rs_job_t *job)
+{
+    blake2b_init(&job->new_digest, RS_MAX_STRONG_SUM_LENGTH);
+    job->new_len = 0;
+    job->digest_new = 1;
+}
+
+/** Calculate and add the sums of a block of the new file to the new_sig. */
+static void rs_job_sign_block(rs_job_t *job, const void *block, size_t len)
+{
+    rs_signature_t *sig = job->new_sig;
+    rs_weak_sum_t weak_sum;
+    rs_strong_sum_t strong_sum;
+    rs_timer_t timer;
+
+    rs_timer_start(&timer, &job->timing);
+    weak_sum = rs_signature_calc_weak_sum(sig, block, len);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_ROLLSUM);
+    rs_timer_start(&timer, &job->timing);
+    rs_signature_calc_strong_sum(sig, block, len, &strong_sum);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_STRONGSUM);
+    rs_signature_add_block(sig, weak_sum, &strong_sum);
+    job->stats.sig_blocks++;
+}
+
+/** Add new file data processed by the job to the new_sig.
+ *
+ * Whole blocks in the input or output buffer are summed where they are, and
+ * partial blocks are accumulated in sig_buf. The last partial block is added
+ * when the job is done. */
+static void rs_job_sign(rs_job_t *job, const rs_byte_t *buf, size_t len,
+                        int done)
+{
+    const size_t block_len = job->new_sig->block_len;
+    size_t n;
+
+    while (len) {
+        if (!job->sig_buf_len && len >= block_len) {
+            rs_job_sign_block(job, buf, block_len);
+            n = block_len;
+        } else {
+            n = block_len - job->sig_buf_len;
+            if (n > len)
+                n = len;
+            memcpy(job->sig_buf + job->sig_buf_len, buf, n);
+            job->sig_buf_len += n;
+            if (job->sig_buf_len == block_len) {
+                rs_job_sign_block(job, job->sig_buf, block_len);
+                job->sig_buf_len = 0;
+            }
+        }
+        buf += n;
+        len -= n;
+    }
+    if (done && job->sig_buf_len) {
+        rs_job_sign_block(job, job->sig_buf, job->sig_buf_len);
+        job->sig_buf_len = 0;
+    }
+}
+
+/** Add new file data the job has read or written to its new_sig and
+ * new_digest. */
+static void rs_job_hash_new(rs_job_t *job, size_t in_len, size_t out_len,
+                            int done)
+{
+    rs_buffers_t *stream = job->stream;
+    const rs_byte_t *buf;
+    size_t len;
+
+    if (job->new_is_input) {
+        buf = (const rs_byte_t *)stream->next_in - in_len;
+        len = in_len;
+    } else {
+        buf = (const rs_byte_t *)stream->next_out - out_len;
+        len = out_len;
+    }
+    if (job->digest_new && len) {
+        blake2b_update(&job->new_digest, buf, len);
+        job->new_len += len;
+    }
+    if (job->new_sig)
+        rs_job_sign(job, buf, len, done);
+}
+
 static rs_result rs_job_complete(rs_job_t *job, rs_result result)
 {
     rs_job_check(job);
@@ -74,6 +222,12 @@ static rs_result rs_job_complete(rs_job_t *job, rs_result result)
 
     job->final_result = result;
     job->stats.end = time(NULL);
+    job->stats.false_matches = (int)job->match.false_matches;
+#ifdef DO_RS_TIMING
+    job->timing.elapsed_ns = rs_timing_now() - job->timing_start;
+#endif
+    rs_probe5(job_end, job, job->job_name, result, job->stats.in_bytes,
+              job->stats.out_bytes);
     if (result != RS_DONE) {
         rs_error("%s job failed: %s", job->job_name, rs_strerror(result));
     } else {
@@ -82,9 +236,52 @@ static rs_result rs_job_complete(rs_job_t *job, rs_result result)
     return result;
 }
 
+void rs_job_set_progress_cb(rs_job_t *job, rs_long_t interval,
+                            rs_progress_cb *cb, void *arg)
+{
+    rs_job_check(job);
+    job->progress_cb = cb;
+    job->progress_arg = arg;
+    job->progress_interval = interval;
+    job->progress_in = job->iter_in;
+    job->progress_out = job->iter_out;
+    job->progress_start = job->progress_ns = rs_timing_now();
+}
+
+/** Get the position in the basis a job is at, or -1 if it has no basis. */
+static rs_long_t rs_job_basis_pos(rs_job_t *job)
+{
+    if (job->new_is_input && job->signature && !job->job_owns_sig)
+        return job->basis_pos + job->basis_len;
+    if (!job->new_is_input && job->copy_cb)
+        return job->basis_pos;
+    return -1;
+}
+
+/** Report a job's progress to its progress_cb. */
+static rs_result rs_job_progress(rs_job_t *job)
+{
+    rs_progress_t p;
+    uint64_t now = rs_timing_now(), dt = now - job->progress_ns;
+    rs_long_t matched = job->stats.copy_bytes + job->stats.lit_bytes;
+
+    p.in_bytes = job->iter_in;
+    p.out_bytes = job->iter_out;
+    p.basis_pos = rs_job_basis_pos(job);
+    p.match_ratio = matched ? (double)job->stats.copy_bytes / matched : 0.0;
+    /* Bytes per ns times 1000 is MB/s. */
+    p.in_mb_per_s = dt ? (job->iter_in - job->progress_in) * 1e3 / dt : 0.0;
+    p.out_mb_per_s = dt ? (job->iter_out - job->progress_out) * 1e3 / dt : 0.0;
+    p.elapsed_ns = now - job->progress_start;
+    job->progress_in = job->iter_in;
+    job->progress_out = job->iter_out;
+    job->progress_ns = now;
+    return job->progress_cb(job, &p, job->progress_arg);
+}
+
 rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
 {
-    rs_result result;
+    rs_result result, cb_result;
     size_t orig_in, orig_out;
 
     rs_job_check(job);
@@ -102,28 +299,61 @@ rs_result rs_job_iter(rs_job_t *job, rs_buffers_t *buffers)
                      buffers->avail_in, buffers->avail_out);
             return RS_INTERNAL_ERROR;
         }
+    job->iter_in += (rs_long_t)(orig_in - buffers->avail_in);
+    job->iter_out += (rs_long_t)(orig_out - buffers->avail_out);
+    if (job->progress_cb) {
+        if (result == RS_DONE) {
+            rs_job_progress(job);
+        } else if (result == RS_BLOCKED
+                   && job->iter_in + job->iter_out - job->progress_in -
+                   job->progress_out >= job->progress_interval) {
+            if ((cb_result = rs_job_progress(job)) != RS_DONE) {
+                /* A job can't complete with these, so they are errors. */
+                if (cb_result == RS_RUNNING || cb_result == RS_BLOCKED)
+                    cb_result = RS_PARAM_ERROR;
+                return rs_job_complete(job, cb_result);
+            }
+        }
+    }
     return result;
 }
 
 static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
 {
     rs_result result;
+    size_t avail_in, avail_out;
 
     rs_job_check(job);
     assert(buffers);
 
     job->stream = buffers;
     while (1) {
+        avail_in = buffers->avail_in;
+        avail_out = buffers->avail_out;
         result = rs_tube_catchup(job);
+        /* Hash the new file data copied by the tube before the state runs,
+           because it may be the state that finishes the digest. */
+        if (rs_job_hashes_new(job)) {
+            rs_job_hash_new(job, avail_in - buffers->avail_in,
+                            avail_out - buffers->avail_out, 0);
+            avail_in = buffers->avail_in;
+            avail_out = buffers->avail_out;
+        }
         if (result == RS_DONE && job->statefn) {
             result = job->statefn(job);
             if (result == RS_DONE) {
                 /* The job is done so clear statefn. */
                 job->statefn = NULL;
                 /* There might be stuff in the tube, so keep running. */
-                continue;
+                result = RS_RUNNING;
             }
         }
+        /* Hash the new file data after each step so it is up to date for the
+           next state. */
+        if (rs_job_hashes_new(job))
+            rs_job_hash_new(job, avail_in - buffers->avail_in,
+                            avail_out - buffers->avail_out,
+                            result == RS_DONE);
         if (result == RS_BLOCKED)
             return result;
         if (result != RS_RUNNING)
@@ -133,19 +363,46 @@ static rs_result rs_job_work(rs_job_t *job, rs_buffers_t *buffers)
 
 const rs_stats_t *rs_job_statistics(rs_job_t *job)
 {
+    job->stats.false_matches = (int)job->match.false_matches;
     return &job->stats;
 }
 
+const rs_timing_t *rs_job_timing(rs_job_t *job)
+{
+    return &job->timing;
+}
+
+const rs_match_stats_t *rs_job_match_stats(rs_job_t *job)
+{
+    return &job->match;
+}
+
+const rs_histograms_t *rs_job_histograms(rs_job_t *job)
+{
+    return &job->hists;
+}
+
+const rs_mem_stats_t *rs_job_mem_stats(rs_job_t *job)
+{
+    return &job->mem;
+}
+
 rs_result rs_job_drive(rs_job_t *job, rs_buffers_t *buf, rs_driven_cb in_cb,
                        void *in_opaque, rs_driven_cb out_cb, void *out_opaque)
 {
     rs_result result, iores;
+    rs_timer_t timer;
+    size_t avail;
 
     rs_bzero(buf, sizeof *buf);
 
     do {
         if (!buf->eof_in && in_cb) {
+            avail = buf->avail_in;
+            rs_timer_start(&timer, &job->timing);
             iores = in_cb(job, buf, in_opaque);
+            rs_timer_stop(&timer, &job->timing, RS_TIMING_FILL);
+            rs_probe3(fill, job, buf->avail_in - avail, buf->eof_in);
             if (iores != RS_DONE)
                 return iores;
         }
@@ -155,7 +412,11 @@ rs_result rs_job_drive(rs_job_t *job, rs_buffers_t *buf, rs_driven_cb in_cb,
             return result;
 
         if (out_cb) {
+            avail = buf->avail_out;
+            rs_timer_start(&timer, &job->timing);
             iores = (out_cb) (job, buf, out_opaque);
+            rs_timer_stop(&timer, &job->timing, RS_TIMING_DRAIN);
+            rs_probe2(drain, job, buf->avail_out - avail);
             if (iores != RS_DONE)
                 return iores;
         }
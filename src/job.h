@@ -31,9 +31,11 @@
 
 #  include <assert.h>
 #  include <stddef.h>
-#  include "mdfour.h"
+#  include <stdint.h>
+#  include "blake2.h"
 #  include "checksum.h"
 #  include "librsync.h"
+#  include "util.h"
 
 /** Magic job tag number for checking jobs have been initialized. */
 #  define RS_JOB_TAG 20010225
@@ -43,6 +45,9 @@
  * This is used to constrain and set the internal buffer sizes. */
 #  define MAX_DELTA_CMD (1<<16)
 
+/** Length of basis reads when extending matches in delta.c. */
+#  define EXTEND_LEN 4096
+
 /** The contents of this structure are private. */
 struct rs_job {
     int dogtag;
@@ -68,12 +73,34 @@ struct rs_job {
      * initializing the signature to preallocate memory. */
     rs_long_t sig_fsize;
 
+    /** The remaining length of the block to generate fine block sums for in
+     * mksum.c for multi-resolution signatures. */
+    size_t sig_fine_len;
+
     /** Pointer to the signature that's being used by the operation. */
     rs_signature_t *signature;
 
     /** Flag indicating signature should be destroyed with the job. */
     int job_owns_sig;
 
+    /** Whether the new file is the job's input like for delta jobs, instead
+     * of its output like for patch jobs. */
+    int new_is_input;
+
+    /** The signature of the new file being generated as it is read by delta
+     * jobs or written by patch jobs, set by rs_job_set_sig(). */
+    rs_signature_t *new_sig;
+
+    /** The delta format being generated or patched. */
+    rs_magic_number delta_magic;
+
+    /** The BLAKE2 digest and length of the new file for
+     * ::RS_BLAKE2_DELTA_MAGIC deltas and ::RS_SIG_DIGEST signatures,
+     * calculated if digest_new is set. */
+    blake2b_state new_digest;
+    rs_long_t new_len;
+    int digest_new;
+
     /** Command byte currently being processed, if any. */
     unsigned char op;
 
@@ -83,15 +110,47 @@ struct rs_job {
     /** The rollsum weak signature accumulator used by delta.c */
     weaksum_t weak_sum;
 
+    /** The fine block weak signature accumulator used by delta.c for
+     * multi-resolution signatures. */
+    weaksum_t fine_sum;
+
     /** Lengths of expected parameters. */
     rs_long_t param1, param2;
 
     struct rs_prototab_ent const *cmd;
-    rs_mdfour_t output_md4;
 
     /** Encoding statistics. */
     rs_stats_t stats;
 
+    /** Signature match statistics counted by delta jobs. */
+    rs_match_stats_t match;
+
+    /** Phase timing, and the time the job started for its elapsed_ns. */
+    rs_timing_t timing;
+    uint64_t timing_start;
+
+    /** Command and match histograms. */
+    rs_histograms_t hists;
+
+    /** Memory allocated for the job and its buffers. */
+    rs_mem_stats_t mem;
+
+    /** The time of the last match found by delta.c, for the match_gaps
+     * histogram. This is only used with DO_RS_TIMING. */
+    uint64_t match_ns;
+
+    /** The progress callback set by rs_job_set_progress_cb(). */
+    rs_progress_cb *progress_cb;
+    void *progress_arg;
+    rs_long_t progress_interval;
+    /** The bytes consumed and produced by rs_job_iter() so far. */
+    rs_long_t iter_in, iter_out;
+    /** The bytes and time at the last progress report. */
+    rs_long_t progress_in, progress_out;
+    uint64_t progress_ns;
+    /** The time the progress callback was set, for its elapsed_ns. */
+    uint64_t progress_start;
+
     /** Buffer of data in the scoop. Allocation is scoop_buf[0..scoop_alloc],
      * and scoop_next[0..scoop_avail] contains data yet to be processed. */
     rs_byte_t *scoop_buf;       /**< The buffer allocation pointer. */
@@ -104,6 +163,7 @@ struct rs_job {
     rs_byte_t *scan_buf;        /**< The delta scan buffer pointer. */
     size_t scan_len;            /**< The delta scan buffer length. */
     size_t scan_pos;            /**< The delta scan position. */
+    rs_long_t scan_off;         /**< The new file offset of scan_pos. */
 
     /** If USED is >0, then buf contains that much write data to be sent out. */
     rs_byte_t write_buf[36];
@@ -119,10 +179,44 @@ struct rs_job {
     /** Callback used to copy data from the basis into the output. */
     rs_copy_cb *copy_cb;
     void *copy_arg;
+
+    /** Buffer for reading the basis to extend matches in delta.c. */
+    rs_byte_t *basis_buf;
+
+    /** Buffer for accumulating a block of new file data to calculate its
+     * sums for a new signature. */
+    rs_byte_t *sig_buf;
+    size_t sig_buf_len;         /**< The length of data in sig_buf. */
+    size_t sig_buf_size;        /**< The allocated size of sig_buf. */
+
+    /** Options for the job, like ::rs_delta_flags for delta jobs. */
+    int flags;
+
+    /** Where the job allocates its buffers from. */
+    rs_heap_t heap;
 };
 
 rs_job_t *rs_job_new(const char *, rs_result (*statefn)(rs_job_t *));
 
+/** Generate the signature of the job's input or output as it is processed.
+ *
+ * This is used by rs_delta_set_sig() and rs_patch_set_sig() after checking
+ * the job. The signature arguments are the same as rs_sig_begin(), but
+ * content defined chunking and multi-resolution signatures are not
+ * supported. */
+rs_result rs_job_set_sig(rs_job_t *job, rs_signature_t **sig,
+                         rs_magic_number sig_magic, size_t block_len,
+                         size_t strong_len);
+
+/** Start calculating the BLAKE2 digest of the new file in new_digest. */
+void rs_job_set_digest(rs_job_t *job);
+
+/** Whether the job needs to see all of the new file data it processes.
+ *
+ * This is true if it generates the new file's signature or digest, so
+ * in-place patches must read data they would otherwise skip over. */
+#  define rs_job_hashes_new(job) ((job)->new_sig || (job)->digest_new)
+
 /** Assert that a job is valid.
  *
  * We don't use a static inline function here so that assert failure output
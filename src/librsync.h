@@ -64,12 +64,21 @@ typedef intmax_t rs_long_t;
  * librsync files. */
 typedef enum {
     /** A delta file.
-     *
-     * At present, there's only one delta format.
      *
      * The four-byte literal \c "rs\x026". */
     RS_DELTA_MAGIC = 0x72730236,
 
+    /** A delta file with a BLAKE2 digest of the new file.
+     *
+     * This is the same as ::RS_DELTA_MAGIC but ends with a CHECKSUM command
+     * before the END command, with the BLAKE2 digest of the whole new file
+     * that patch checks. Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x027".
+     *
+     * \sa ::RS_DELTA_CHECKSUM */
+    RS_BLAKE2_DELTA_MAGIC = 0x72730237,
+
     /** A signature file with MD4 signatures.
      *
      * Backward compatible with librsync < 1.0, but strongly deprecated because
@@ -108,6 +117,66 @@ typedef enum {
      * \sa rs_sig_begin() */
     RS_RK_BLAKE2_SIG_MAGIC = 0x72730147,
 
+    /** A signature file with content defined chunks and MD4 hash.
+     *
+     * Uses variable length chunks with FastCDC style content defined
+     * boundaries instead of fixed size blocks, and the block_len is the
+     * average chunk length. Each chunk has its length and strong sum instead
+     * of a weak sum, and deltas only look up chunks at boundaries instead of
+     * every byte offset. Discouraged because of MD4's security vulnerability.
+     * Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01V".
+     *
+     * \sa rs_sig_begin() */
+    RS_CDC_MD4_SIG_MAGIC = 0x72730156,
+
+    /** A signature file with content defined chunks and BLAKE2 hash.
+     *
+     * Like ::RS_CDC_MD4_SIG_MAGIC but using the safer BLAKE2 hash. Supported
+     * since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01W".
+     *
+     * \sa rs_sig_begin() */
+    RS_CDC_BLAKE2_SIG_MAGIC = 0x72730157,
+
+    /** A multi-resolution signature file with RabinKarp rollsum and MD4 hash.
+     *
+     * Each block is followed by the signatures of its fine blocks that are
+     * 1/8 of the block_len. Deltas find large unchanged regions using the
+     * blocks, and only look up fine blocks inside misses to give smaller
+     * deltas. Discouraged because of MD4's security vulnerability. Supported
+     * since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01f".
+     *
+     * \sa rs_sig_begin() */
+    RS_MR_MD4_SIG_MAGIC = 0x72730166,
+
+    /** A multi-resolution signature file with RabinKarp rollsum and BLAKE2
+     * hash.
+     *
+     * Like ::RS_MR_MD4_SIG_MAGIC but using the safer BLAKE2 hash. Supported
+     * since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01g".
+     *
+     * \sa rs_sig_begin() */
+    RS_MR_BLAKE2_SIG_MAGIC = 0x72730167,
+
+    /** A prefix for signature files with a digest of the whole file.
+     *
+     * This is followed by a normal signature file, and then the length of the
+     * whole file as a 8 byte integer and its 32 byte BLAKE2 digest. Deltas
+     * against these signatures can skip an unchanged new file, see
+     * rs_delta_skip_unchanged(). Supported since librsync 2.3.5.
+     *
+     * The four-byte literal \c "rs\x01\x07".
+     *
+     * \sa ::RS_SIG_DIGEST */
+    RS_DIGEST_SIG_MAGIC = 0x72730107,
+
 } rs_magic_number;
 
 /** Log severity levels.
@@ -161,6 +230,115 @@ LIBRSYNC_EXPORT void rs_trace_stderr(rs_loglevel level, char const *msg);
  * \sa \ref api_trace */
 LIBRSYNC_EXPORT int rs_supports_trace(void);
 
+/** Types of ::rs_event_t trace events.
+ *
+ * These are the same as the USDT static probes, and have the same arguments.
+ *
+ * \sa \ref api_trace */
+typedef enum {
+    RS_EVENT_JOB_START = 1,     /**< job, job name. */
+    RS_EVENT_JOB_END = 2,       /**< job, job name, result, in bytes, out
+                                 * bytes. */
+    RS_EVENT_FILL = 3,          /**< job, bytes read by rs_job_drive(), eof. */
+    RS_EVENT_DRAIN = 4,         /**< job, bytes written by rs_job_drive(). */
+    RS_EVENT_SCOOP_RESIZE = 5,  /**< job, old size, new size. */
+    RS_EVENT_MATCH = 6,         /**< job, new file offset, basis offset,
+                                 * length. */
+    RS_EVENT_STRONG_SUM = 7,    /**< signature, length. */
+    RS_EVENT_LITERAL = 8,       /**< job, length of LITERAL emitted. */
+    RS_EVENT_COPY = 9,          /**< job, basis offset, length of COPY
+                                 * emitted. */
+    RS_EVENT_PATCH_LITERAL = 10,        /**< job, length of LITERAL patched. */
+    RS_EVENT_PATCH_COPY = 11,   /**< job, basis offset, length of COPY
+                                 * patched. */
+} rs_event_type;
+
+/** The number of arguments in an ::rs_event_t. */
+#  define RS_EVENT_ARGS 5
+
+/** A binary trace event record.
+ *
+ * The arguments are integers, or the addresses of the job, signature, or job
+ * name (a static string) for the first arguments, so they can only be decoded
+ * in the same process.
+ *
+ * \sa rs_event_ring_read() \sa rs_format_event() */
+typedef struct rs_event {
+    uint64_t ns;                /**< Monotonic time of the event in ns. */
+    int type;                   /**< The ::rs_event_type. */
+    int nargs;                  /**< The number of arguments used. */
+    int64_t args[RS_EVENT_ARGS];        /**< The event arguments. */
+} rs_event_t;
+
+/** A ring buffer of trace events for a thread.
+ *
+ * \sa rs_event_ring_new() */
+typedef struct rs_event_ring rs_event_ring_t;
+
+/** Check whether the library supports recording events.
+ *
+ * This needs a 64 bit platform and a compiler with GNU atomic and thread
+ * local extensions like GCC or Clang.
+ *
+ * \returns True if events are recorded in rings; otherwise false.
+ *
+ * \sa \ref api_trace */
+LIBRSYNC_EXPORT int rs_supports_events(void);
+
+/** Allocate a ring buffer of trace events.
+ *
+ * \param capacity The number of events it can hold, rounded up to a power of
+ * 2.
+ *
+ * \returns The ring, or NULL if it couldn't be allocated. */
+LIBRSYNC_EXPORT rs_event_ring_t *rs_event_ring_new(size_t capacity);
+
+/** Free a ring buffer of trace events.
+ *
+ * It must not be set as the ring of any thread. */
+LIBRSYNC_EXPORT void rs_event_ring_free(rs_event_ring_t *ring);
+
+/** Set the ring buffer that the calling thread records trace events in.
+ *
+ * Recording an event only writes a fixed size record into the ring without
+ * any locks or formatting, so it can be left on in production. If the ring is
+ * full the event is dropped and counted instead of waiting for the consumer.
+ * Threads without a ring don't record events.
+ *
+ * \param ring The ring to record events in, or NULL to stop recording.
+ *
+ * \returns The previous ring of the thread.
+ *
+ * \sa \ref api_trace */
+LIBRSYNC_EXPORT rs_event_ring_t *rs_event_ring_set(rs_event_ring_t *ring);
+
+/** Take events out of a ring buffer.
+ *
+ * Each ring can have one consumer thread calling this at the same time as the
+ * thread recording into it, without any locks.
+ *
+ * \param ring The ring to read.
+ *
+ * \param events The array to receive the events.
+ *
+ * \param max The size of the events array.
+ *
+ * \returns The number of events read, which is 0 if the ring is empty. */
+LIBRSYNC_EXPORT size_t rs_event_ring_read(rs_event_ring_t *ring,
+                                          rs_event_t *events, size_t max);
+
+/** Get the number of events dropped because a ring buffer was full. */
+LIBRSYNC_EXPORT uint64_t rs_event_ring_dropped(rs_event_ring_t const *ring);
+
+/** Return the lowercase name of an event type, like "job_start". */
+LIBRSYNC_EXPORT char const *rs_event_name(int type);
+
+/** Decode an event into text.
+ *
+ * \return \p buf. */
+LIBRSYNC_EXPORT char *rs_format_event(rs_event_t const *event, char *buf,
+                                      size_t size);
+
 /** Convert \p from_len bytes at \p from_buf into a hex representation in \p
  * to_buf, which must be twice as long plus one byte for the null terminator. */
 LIBRSYNC_EXPORT void rs_hexify(char *to_buf, void const *from_buf,
@@ -204,6 +382,29 @@ typedef enum rs_result {
 /** Return an English description of a ::rs_result value. */
 LIBRSYNC_EXPORT char const *rs_strerror(rs_result r);
 
+/** The number of buckets in an ::rs_histogram_t. */
+#  define RS_HISTOGRAM_BUCKETS 32
+
+/** A histogram of values in power of 2 sized buckets.
+ *
+ * Bucket 0 counts values of 0, and bucket i counts values from 2^(i-1) to
+ * 2^i - 1, so it is indexed by the number of bits in the value. The last
+ * bucket also counts all larger values.
+ *
+ * \sa ::rs_histograms_t */
+typedef struct rs_histogram {
+    rs_long_t count[RS_HISTOGRAM_BUCKETS];      /**< The count of values in
+                                                 * each bucket. */
+} rs_histogram_t;
+
+/** Memory allocated by a job or signature.
+ *
+ * \sa rs_job_mem_stats() \sa rs_signature_mem_stats() */
+typedef struct rs_mem_stats {
+    rs_long_t bytes;            /**< Bytes currently allocated. */
+    rs_long_t peak;             /**< Most bytes allocated at once. */
+} rs_mem_stats_t;
+
 /** Performance statistics from a librsync encoding or decoding operation.
  *
  * \sa api_stats \sa rs_format_stats() \sa rs_log_stats() */
@@ -217,7 +418,8 @@ typedef struct rs_stats {
 
     rs_long_t copy_cmds, copy_bytes, copy_cmdbytes;
     rs_long_t sig_cmds, sig_bytes;
-    int false_matches;
+    int false_matches;          /**< Number of weak sum matches where the
+                                 * block didn't match. */
 
     rs_long_t sig_blocks;       /**< Number of blocks described by the
                                  * signature. */
@@ -230,6 +432,49 @@ typedef struct rs_stats {
     time_t start, end;
 } rs_stats_t;
 
+/** Signature match statistics of a delta job, for tuning block_len and
+ * strong_len.
+ *
+ * These are kept separately from ::rs_stats_t so that struct keeps its size.
+ * The false_matches count is also copied into rs_stats_t::false_matches.
+ *
+ * \sa api_stats \sa rs_job_match_stats() */
+typedef struct rs_match_stats {
+    rs_long_t match_searches;   /**< Number of signature searches. */
+    rs_long_t match_hits;       /**< Number of searches that found a
+                                 * matching block. */
+    rs_long_t match_probes;     /**< Number of hashtable buckets probed by
+                                 * searches. This is always 0 if librsync was
+                                 * built with HASHTABLE_NSTATS defined. */
+    rs_long_t weak_matches;     /**< Number of blocks with matching weak sums
+                                 * that were checked. */
+    rs_long_t strong_sums;      /**< Number of strong sums calculated to check
+                                 * weak sum matches. */
+    rs_long_t false_matches;    /**< Number of weak sum matches where the
+                                 * block didn't match. */
+} rs_match_stats_t;
+
+/** Histograms of how a delta was made, for monitoring delta efficiency.
+ *
+ * These are kept separately from ::rs_stats_t so that struct keeps its size,
+ * and are only reported by rs_format_stats_json().
+ *
+ * \sa api_stats \sa rs_job_histograms() */
+typedef struct rs_histograms {
+    rs_histogram_t copy_lens;   /**< Lengths of COPY commands. */
+    rs_histogram_t lit_lens;    /**< Lengths of LITERAL commands. Delta splits
+                                 * literal runs longer than 32KB into several
+                                 * commands. */
+    rs_histogram_t probe_lens;  /**< Number of hashtable buckets probed by
+                                 * each signature search. This is always 0 if
+                                 * librsync was built with HASHTABLE_NSTATS
+                                 * defined. */
+    rs_histogram_t match_gaps;  /**< Time in ns between each signature match
+                                 * found by delta and the previous one, or the
+                                 * start of the delta. This is only collected
+                                 * if librsync was built with ENABLE_TIMING. */
+} rs_histograms_t;
+
 /** MD4 message-digest accumulator.
  *
  * \sa rs_mdfour(), rs_mdfour_begin(), rs_mdfour_update(), rs_mdfour_result() */
@@ -278,12 +523,136 @@ LIBRSYNC_EXPORT char *rs_format_stats(rs_stats_t const *stats, char *buf,
  * \sa \ref api_stats \sa \ref api_trace */
 LIBRSYNC_EXPORT int rs_log_stats(rs_stats_t const *stats);
 
+/** Phases of processing timed in ::rs_timing_t.
+ *
+ * \sa api_stats */
+typedef enum {
+    RS_TIMING_FILL = 0,         /**< Taking input, in rs_job_drive()'s input
+                                 * callback and buffering it in the job. */
+    RS_TIMING_ROLLSUM = 1,      /**< Calculating and rolling weak sums,
+                                 * including scanning for matches in delta. */
+    RS_TIMING_HASHTABLE = 2,    /**< Probing the signature hashtable. */
+    RS_TIMING_STRONGSUM = 3,    /**< Calculating strong sums. */
+    RS_TIMING_EMIT = 4,         /**< Emitting delta commands. */
+    RS_TIMING_DRAIN = 5         /**< Writing output queued by the job and in
+                                 * rs_job_drive()'s output callback. */
+} rs_timing_phase;
+
+/** The number of ::rs_timing_phase values. */
+#  define RS_TIMING_PHASES 6
+
+/** High-resolution timing of the phases of a job.
+ *
+ * This is only collected if librsync was built with the ENABLE_TIMING CMake
+ * option, otherwise it is all zeros. Times are in nanoseconds from a
+ * monotonic clock, and the time for each phase excludes the time for other
+ * phases nested inside it, like strong sums calculated while probing the
+ * hashtable. Reading the clock has some overhead, particularly for phases
+ * timed per byte like probing the hashtable in delta.
+ *
+ * \sa api_stats \sa rs_job_timing() \sa rs_format_timing() */
+typedef struct rs_timing {
+    uint64_t ns[RS_TIMING_PHASES];      /**< Time spent in each phase. */
+    uint64_t calls[RS_TIMING_PHASES];   /**< Number of times each phase was
+                                         * timed. */
+    uint64_t total_ns;          /**< Time spent in all phases. */
+    uint64_t elapsed_ns;        /**< Time from starting to completing the
+                                 * job, or 0 if it has not completed. */
+} rs_timing_t;
+
+/** Check whether the library was compiled with phase timing.
+ *
+ * \returns True if jobs collect ::rs_timing_t; otherwise false. */
+LIBRSYNC_EXPORT int rs_supports_timing(void);
+
+/** Return the lowercase name of a timing phase, like "rollsum". */
+LIBRSYNC_EXPORT char const *rs_timing_phase_name(rs_timing_phase phase);
+
+/** Return a human-readable representation of timing.
+ *
+ * The string is truncated if it does not fit. 300 characters should be
+ * sufficient space.
+ *
+ * \param timing Timing from an encoding or decoding operation.
+ *
+ * \param buf Buffer to receive result.
+ *
+ * \param size Size of buffer.
+ *
+ * \return \p buf.
+ *
+ * \sa \ref api_stats */
+LIBRSYNC_EXPORT char *rs_format_timing(rs_timing_t const *timing, char *buf,
+                                       size_t size);
+
+/** Write timing into the current log as text.
+ *
+ * \sa \ref api_stats \sa \ref api_trace */
+LIBRSYNC_EXPORT int rs_log_timing(rs_timing_t const *timing);
+
 /** The signature datastructure type. */
 typedef struct rs_signature rs_signature_t;
 
-/** Log the rs_signature_delta match stats. */
+/** Log the signature's block and hashtable stats.
+ *
+ * The match stats for each delta are in its ::rs_match_stats_t. */
 LIBRSYNC_EXPORT void rs_signature_log_stats(rs_signature_t const *sig);
 
+/** The length of the probe histograms in ::rs_hashtable_stats_t. */
+#  define RS_HASHTABLE_PROBES 16
+
+/** Stats of a signature's hashtable from rs_signature_hashtable_stats().
+ *
+ * These show how fast delta can search the signature, so pathological
+ * signatures that slow down scanning can be detected. The probe histograms
+ * count the hashtable buckets a search compares, with the last element also
+ * counting all longer probes. */
+typedef struct rs_hashtable_stats {
+    int blocks;                 /**< Number of blocks in the signature. */
+    int unique_blocks;          /**< Number of unique blocks in the
+                                 * hashtable. */
+    int buckets;                /**< Number of hashtable buckets. */
+    double load_factor;         /**< Fraction of the buckets used. */
+    int dup_weak_blocks;        /**< Unique blocks with the same weak sum as
+                                 * other blocks, which need strong sums
+                                 * calculated to tell them apart. */
+    int dup_weak_sums;          /**< Weak sums shared by more than one unique
+                                 * block. */
+    int dup_weak_max;           /**< Most unique blocks with the same weak
+                                 * sum. */
+    rs_long_t hit_probes[RS_HASHTABLE_PROBES];  /**< Count of unique blocks
+                                                 * found with n probes. */
+    rs_long_t miss_probes[RS_HASHTABLE_PROBES]; /**< Count of buckets a miss
+                                                 * starting there does n
+                                                 * probes from, if it passes
+                                                 * the bloom filter. */
+    double hit_probes_mean;     /**< Mean probes to find a block. */
+    double miss_probes_mean;    /**< Mean probes for a miss. */
+    double bloom_fp_rate;       /**< Fraction of misses that pass the bloom
+                                 * filter and probe the hashtable. */
+} rs_hashtable_stats_t;
+
+/** Get the stats of a signature's hashtable.
+ *
+ * This walks the whole hashtable, so it takes time proportional to the
+ * signature size. It doesn't modify the signature. For multi-resolution
+ * signatures this is for the hashtable of the blocks, not the fine blocks.
+ *
+ * \return RS_DONE, or RS_PARAM_ERROR if rs_build_hash_table() has not been
+ * called for the signature. */
+LIBRSYNC_EXPORT rs_result rs_signature_hashtable_stats(rs_signature_t const
+                                                       *sig,
+                                                       rs_hashtable_stats_t
+                                                       *stats);
+
+/** Get the memory allocated for a signature's blocks and hashtable.
+ *
+ * This includes the fine blocks of multi-resolution signatures. It doesn't
+ * include the rs_signature_t itself, and it doesn't change while delta jobs
+ * use the signature, so it can be called while they run. */
+LIBRSYNC_EXPORT void rs_signature_mem_stats(rs_signature_t const *sig,
+                                            rs_mem_stats_t *stats);
+
 /** Deep deallocation of checksums. */
 LIBRSYNC_EXPORT void rs_free_sumset(rs_signature_t *);
 
@@ -414,9 +783,163 @@ LIBRSYNC_EXPORT rs_result rs_job_drive(rs_job_t *job, rs_buffers_t *buf,
 /** Return a pointer to the statistics in a job. */
 LIBRSYNC_EXPORT const rs_stats_t *rs_job_statistics(rs_job_t *job);
 
+/** Return a pointer to the phase timing in a job.
+ *
+ * \sa rs_supports_timing() */
+LIBRSYNC_EXPORT const rs_timing_t *rs_job_timing(rs_job_t *job);
+
+/** Return a pointer to the signature match statistics in a job.
+ *
+ * These are only counted by delta jobs. */
+LIBRSYNC_EXPORT const rs_match_stats_t *rs_job_match_stats(rs_job_t *job);
+
+/** Return a pointer to the command and match histograms in a job. */
+LIBRSYNC_EXPORT const rs_histograms_t *rs_job_histograms(rs_job_t *job);
+
+/** Return a pointer to the memory allocated by a job.
+ *
+ * This counts the job itself and its buffers, including the file buffers of
+ * the whole-file functions. Signatures account for their own memory. It is
+ * kept separately from ::rs_stats_t so that struct keeps its size. */
+LIBRSYNC_EXPORT const rs_mem_stats_t *rs_job_mem_stats(rs_job_t *job);
+
+/** The size of buffer that is always big enough for rs_format_stats_json(). */
+#  define RS_STATS_JSON_SIZE 8192
+
+/** Format statistics and timing as a JSON object.
+ *
+ * This has all the fields of ::rs_stats_t, and the match stats, histograms,
+ * memory and timing of the job if it is given and timing is supported, with the
+ * histograms as arrays of bucket counts without trailing empty buckets, so it
+ * can be ingested by monitoring. The output is truncated if it doesn't fit,
+ * so use a buffer of at least ::RS_STATS_JSON_SIZE bytes.
+ *
+ * \param stats Statistics from an encoding or decoding operation.
+ *
+ * \param job The job to include the ::rs_match_stats_t, ::rs_histograms_t,
+ * ::rs_mem_stats_t and ::rs_timing_t of, or NULL.
+ *
+ * \param buf Buffer to receive the JSON.
+ *
+ * \param size Size of buffer.
+ *
+ * \return \p buf.
+ *
+ * \sa \ref api_stats */
+LIBRSYNC_EXPORT char *rs_format_stats_json(rs_stats_t const *stats,
+                                           rs_job_t *job, char *buf,
+                                           size_t size);
+
+/** The progress of a job reported to a ::rs_progress_cb.
+ *
+ * The byte counts are what the job has consumed from its input buffer and
+ * produced into its output buffer, so unlike the ::rs_stats_t in_bytes and
+ * out_bytes they are counted for jobs run with rs_job_iter() too.
+ *
+ * \sa rs_job_set_progress_cb() */
+typedef struct rs_progress {
+    rs_long_t in_bytes;         /**< Bytes read from the input so far. */
+    rs_long_t out_bytes;        /**< Bytes written to the output so far. */
+    /** The current position in the basis file, or -1 if the job has none.
+     * For delta jobs this is the end of the latest match, and for patch jobs
+     * it is where the next copy command left off. */
+    rs_long_t basis_pos;
+    /** The fraction of delta bytes copied from the basis so far. */
+    double match_ratio;
+    double in_mb_per_s;         /**< Input MB/s since the last report. */
+    double out_mb_per_s;        /**< Output MB/s since the last report. */
+    uint64_t elapsed_ns;        /**< Time since the callback was set. */
+} rs_progress_t;
+
+/** Callback for reporting job progress.
+ *
+ * \param job The job making progress.
+ *
+ * \param progress The progress of the job.
+ *
+ * \param arg The arg passed to rs_job_set_progress_cb().
+ *
+ * \return ::RS_DONE to continue, or any other ::rs_result to stop the job
+ * with that result. ::RS_RUNNING and ::RS_BLOCKED stop it with
+ * ::RS_PARAM_ERROR.
+ *
+ * \sa rs_job_set_progress_cb() */
+typedef rs_result rs_progress_cb(rs_job_t *job, const rs_progress_t *progress,
+                                 void *arg);
+
+/** Report a job's progress by calling a callback as it runs.
+ *
+ * The callback is called from rs_job_iter() each time at least interval more
+ * bytes have been read and written, and once more when the job completes. The
+ * result returned by the last call is ignored since the job is already done.
+ *
+ * \param job The job to report the progress of.
+ *
+ * \param interval The number of input plus output bytes between calls, or 0
+ * to call it after every rs_job_iter().
+ *
+ * \param cb The callback to call, or NULL to stop reporting progress.
+ *
+ * \param arg The arg to pass to the callback.
+ *
+ * \sa rs_whole_set_progress_cb() */
+LIBRSYNC_EXPORT void rs_job_set_progress_cb(rs_job_t *job, rs_long_t interval,
+                                            rs_progress_cb *cb, void *arg);
+
 /** Deallocate job state. */
 LIBRSYNC_EXPORT rs_result rs_job_free(rs_job_t *);
 
+/** Memory allocator hooks.
+ *
+ * The functions are called with the allocator's opaque argument. Like
+ * malloc() they must return memory aligned for any type, and they return NULL
+ * if they fail, which is fatal. The free and realloc functions are given the
+ * size the memory was allocated with, so allocators don't need to record it.
+ *
+ * \sa rs_set_allocator() */
+typedef struct rs_allocator {
+    void *(*alloc)(void *opaque, size_t size);
+    void *(*realloc)(void *opaque, void *ptr, size_t old_size, size_t size);
+    void (*free)(void *opaque, void *ptr, size_t size);
+    void *opaque;
+} rs_allocator_t;
+
+/** Set the allocator for the jobs and signatures the calling thread creates.
+ *
+ * Each job and signature keeps using the allocator that was set when it was
+ * created for all of its memory, so the allocator must outlive them. The
+ * default NULL allocator uses malloc(). On platforms without thread local
+ * storage this sets it for all threads.
+ *
+ * \returns The previous allocator of the thread. */
+LIBRSYNC_EXPORT rs_allocator_t const *rs_set_allocator(rs_allocator_t const
+                                                       *allocator);
+
+/** The default chunk length for rs_job_set_arena(). */
+#  define RS_ARENA_CHUNK_LEN (64 << 10)
+
+/** Allocate a job's buffers from an arena freed all at once by rs_job_free().
+ *
+ * The arena gets chunks from the job's allocator and hands out the job's
+ * scoop, file and other buffers from them without freeing anything until the
+ * job is freed. For many short jobs this replaces most of their allocator
+ * calls with one or two, at the cost of not reusing memory freed while the
+ * job runs, like the scoop when it grows. The ::rs_mem_stats_t of the job
+ * counts the chunks. Signatures are not allocated from the arena because
+ * they can outlive the job.
+ *
+ * This must be called before the job allocates any buffers, so before
+ * rs_job_iter() and any rs_delta_set_sig() or rs_patch_set_sig().
+ *
+ * \param job The job to use an arena for.
+ *
+ * \param chunk_len The length of arena chunks, or 0 for
+ * ::RS_ARENA_CHUNK_LEN. Bigger buffers get chunks of their own.
+ *
+ * \return RS_DONE, or RS_PARAM_ERROR if the job has already started,
+ * allocated buffers or has an arena. */
+LIBRSYNC_EXPORT rs_result rs_job_set_arena(rs_job_t *job, size_t chunk_len);
+
 /** Get or check signature arguments for a given file size.
  *
  * This can be used to get the recommended arguments for generating a
@@ -466,12 +989,70 @@ LIBRSYNC_EXPORT rs_result rs_sig_args(rs_long_t old_fsize,
 LIBRSYNC_EXPORT rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
                                        rs_magic_number sig_magic);
 
+/** Flags for rs_sig_begin_flags().
+ *
+ * These can be combined with bitwise-or. */
+typedef enum {
+    /** Add the length and BLAKE2 digest of the whole file to the signature.
+     *
+     * The signature is written with the ::RS_DIGEST_SIG_MAGIC prefix, so
+     * deltas can check if the new file is unchanged using a single hash of
+     * the whole file instead of looking up every block. */
+    RS_SIG_DIGEST = 1 << 0,
+} rs_sig_flags;
+
+/** Start generating a signature with options.
+ *
+ * This is the same as rs_sig_begin() with extra ::rs_sig_flags. */
+LIBRSYNC_EXPORT rs_job_t *rs_sig_begin_flags(size_t block_len,
+                                             size_t strong_len,
+                                             rs_magic_number sig_magic,
+                                             int flags);
+
 /** Prepare to compute a streaming delta.
  *
  * \todo Add a version of this that takes a ::rs_magic_number controlling the
  * delta format. */
 LIBRSYNC_EXPORT rs_job_t *rs_delta_begin(rs_signature_t *);
 
+/** Flags for rs_delta_begin_flags().
+ *
+ * These can be combined with bitwise-or. */
+typedef enum {
+    /** Only generate deltas that can be patched in place.
+     *
+     * Every COPY command will copy from a basis position at or after its
+     * position in the new file, so that it only reads basis data that has not
+     * yet been overwritten when the output is written over the basis. Blocks
+     * that have moved backwards are sent as literal data instead. See
+     * ::RS_PATCH_INPLACE. */
+    RS_DELTA_INPLACE = 1 << 0,
+
+    /** Add a BLAKE2 digest of the new file to the delta.
+     *
+     * The digest is calculated while the new file is read and written in a
+     * ::RS_BLAKE2_DELTA_MAGIC delta. Patching it calculates the digest of the
+     * output as it is written and fails with RS_CORRUPT if it doesn't match,
+     * so the new file doesn't need to be read again to verify it. New
+     * signatures generated while computing or patching these deltas also
+     * get the digest, like with ::RS_SIG_DIGEST. */
+    RS_DELTA_CHECKSUM = 1 << 1,
+
+    /** Skip a new file that is unchanged in rs_delta_file_sig().
+     *
+     * If the signature has a digest of the whole basis and the new file is a
+     * regular file of the same length, the new file is hashed first and
+     * skipped with rs_delta_skip_unchanged() if it is unchanged. This reads a
+     * changed file of the same length twice, so only use it when new files
+     * are usually unchanged. Streaming delta jobs ignore this flag. */
+    RS_DELTA_SKIP_UNCHANGED = 1 << 2,
+} rs_delta_flags;
+
+/** Prepare to compute a streaming delta with options.
+ *
+ * This is the same as rs_delta_begin() with extra ::rs_delta_flags. */
+LIBRSYNC_EXPORT rs_job_t *rs_delta_begin_flags(rs_signature_t *, int flags);
+
 /** Read a signature from a file into an ::rs_signature structure in memory.
  *
  * Once there, it can be used to generate a delta to a newer version of the
@@ -482,10 +1063,24 @@ LIBRSYNC_EXPORT rs_job_t *rs_delta_begin(rs_signature_t *);
 LIBRSYNC_EXPORT rs_job_t *rs_loadsig_begin(rs_signature_t **);
 
 /** Call this after loading a signature to index it.
+ *
+ * After this the signature is only read by delta jobs, so it can be shared by
+ * any number of delta jobs running concurrently in different threads. It must
+ * not be freed until they are all done.
  *
  * Use rs_free_sumset() to release it after use. */
 LIBRSYNC_EXPORT rs_result rs_build_hash_table(rs_signature_t *sums);
 
+/** Write a signature in memory out to a signature file.
+ *
+ * The job has no input and writes the signature as output in the same format
+ * rs_sig_begin() generates. Content defined chunking and multi-resolution
+ * signatures are not supported and fail with RS_UNIMPLEMENTED.
+ *
+ * \param sig The signature to write, which must remain valid until the job is
+ * done. */
+LIBRSYNC_EXPORT rs_job_t *rs_savesig_begin(rs_signature_t *sig);
+
 /** Callback used to retrieve parts of the basis file.
  *
  * \param opaque The opaque object to execute the callback with. Often the file
@@ -512,14 +1107,124 @@ typedef rs_result rs_copy_cb(void *opaque, rs_long_t pos, size_t *len,
  *
  * \param copy_arg Opaque environment pointer passed through to the callback.
  *
- * \todo As output is produced, accumulate the MD4 checksum of the output. Then
- * if we find a CHECKSUM command we can check it's contents against the output.
- *
- * \todo Implement COPY commands.
+ * Deltas with ::RS_BLAKE2_DELTA_MAGIC have the BLAKE2 digest of the new file,
+ * and the job fails with RS_CORRUPT if the output doesn't match it.
  *
  * \sa rs_patch_file() \sa \ref api_streaming */
 LIBRSYNC_EXPORT rs_job_t *rs_patch_begin(rs_copy_cb * copy_cb, void *copy_arg);
 
+/** Generate the new file's signature while applying a delta.
+ *
+ * The patch job calculates the sums of each block of the new file as it is
+ * output, building its signature in memory without reading the new file
+ * again. This must be called before the first rs_job_iter() of the patch job,
+ * and the signature is complete when the job is done. Use rs_savesig_begin()
+ * to write it out, or rs_build_hash_table() to use it for a delta. The
+ * arguments are the same as rs_sig_begin(), but content defined chunking and
+ * multi-resolution signatures are not supported.
+ *
+ * \param job A job from rs_patch_begin().
+ *
+ * \param sig Set to the new signature, which the caller must free with
+ * rs_free_sumset() after the job is freed.
+ *
+ * \param sig_magic Signature file format to generate (0 for "recommended").
+ *
+ * \param block_len Checksum block size to use (0 for "recommended").
+ *
+ * \param strong_len Strongsum length in bytes to use (0 for "maximum", -1 for
+ * "minimum").
+ *
+ * \return RS_DONE on success, RS_PARAM_ERROR if the job is not a patch job
+ * that has not started, or another error for invalid signature arguments. */
+LIBRSYNC_EXPORT rs_result rs_patch_set_sig(rs_job_t *job, rs_signature_t **sig,
+                                           rs_magic_number sig_magic,
+                                           size_t block_len,
+                                           size_t strong_len);
+
+/** Give a delta job access to the basis file to extend matches.
+ *
+ * When the basis is available locally, delta can compare the data before and
+ * after each matching block against the basis, extending matches past block
+ * boundaries so only the bytes that really changed are sent as literal data.
+ * This must be called before the first rs_job_iter() of the delta job.
+ *
+ * \param job A job from rs_delta_begin() or rs_delta_begin_flags().
+ *
+ * \param copy_cb Callback used to read the basis file.
+ *
+ * \param copy_arg Opaque environment pointer passed through to the callback.
+ *
+ * \return RS_PARAM_ERROR if the job is not a delta job that has not started,
+ * otherwise RS_DONE. */
+LIBRSYNC_EXPORT rs_result rs_delta_set_basis(rs_job_t *job,
+                                             rs_copy_cb * copy_cb,
+                                             void *copy_arg);
+
+/** Make a delta job skip a new file that is unchanged.
+ *
+ * If the signature has the length and BLAKE2 digest of the whole basis (see
+ * ::RS_SIG_DIGEST) and they match the new file's, the delta job writes a
+ * single COPY of the whole basis without reading its input or looking up any
+ * blocks. Checking this needs the new file's digest before the delta starts,
+ * so it is only useful when the new file can be read twice or its digest is
+ * already known. This must be called before the first rs_job_iter() of the
+ * delta job, and can't be used with rs_delta_set_sig().
+ *
+ * \param job A job from rs_delta_begin() or rs_delta_begin_flags().
+ *
+ * \param new_len The length of the new file.
+ *
+ * \param new_digest The unkeyed 32 byte BLAKE2b digest of the new file.
+ *
+ * \return RS_DONE if the new file is unchanged and will be skipped,
+ * RS_RUNNING if it needs to be read as input as usual, or RS_PARAM_ERROR if
+ * the job is not a delta job that has not started. */
+LIBRSYNC_EXPORT rs_result rs_delta_skip_unchanged(rs_job_t *job,
+                                                  rs_long_t new_len,
+                                                  const void *new_digest);
+
+/** Generate the new file's signature while computing a delta.
+ *
+ * The delta job calculates the sums of each block of the new file as it is
+ * read, building its signature in memory so it can be kept for the next
+ * delta without reading the new file again. This is the same as
+ * rs_patch_set_sig() for delta jobs.
+ *
+ * \param job A job from rs_delta_begin() or rs_delta_begin_flags().
+ *
+ * \return RS_DONE on success, RS_PARAM_ERROR if the job is not a delta job
+ * that has not started, or another error for invalid signature arguments. */
+LIBRSYNC_EXPORT rs_result rs_delta_set_sig(rs_job_t *job, rs_signature_t **sig,
+                                           rs_magic_number sig_magic,
+                                           size_t block_len,
+                                           size_t strong_len);
+
+/** Apply a \a delta to a \a basis file's signature to generate the \a new
+ * file's signature.
+ *
+ * The job reads the delta as input and writes the new signature as output,
+ * using the same signature format as the old signature. This gives the same
+ * signature as rs_sig_begin() would for the new file, but blocks of the new
+ * file that are copied whole from block boundaries in the basis keep their
+ * sums from the old signature without any IO or hashing. Only the data for
+ * the other blocks is read from the delta and basis and hashed.
+ *
+ * Content defined chunking and multi-resolution signatures are not supported
+ * and fail with RS_UNIMPLEMENTED.
+ *
+ * \param sig The loaded signature of the basis. It doesn't need
+ * rs_build_hash_table().
+ *
+ * \param copy_cb Callback used to retrieve content from the basis file.
+ *
+ * \param copy_arg Opaque environment pointer passed through to the callback.
+ *
+ * \sa rs_patchsig_file() */
+LIBRSYNC_EXPORT rs_job_t *rs_patchsig_begin(rs_signature_t *sig,
+                                            rs_copy_cb * copy_cb,
+                                            void *copy_arg);
+
 #  ifndef RSYNC_NO_STDIO_INTERFACE
 #    include <stdio.h>
 
@@ -563,6 +1268,22 @@ LIBRSYNC_EXPORT rs_result rs_file_copy_cb(void *arg, rs_long_t pos, size_t *len,
  * only need to change these in testing. */
 LIBRSYNC_EXPORT extern int rs_inbuflen, rs_outbuflen;
 
+/** Report the progress of the whole-file functions.
+ *
+ * This sets the progress callback that rs_sig_file(), rs_delta_file(),
+ * rs_patch_file() and the other whole-file functions called from the calling
+ * thread set on their jobs with rs_job_set_progress_cb(). Like
+ * rs_set_allocator() it is set per thread, except on platforms without thread
+ * local storage where it is set for all threads.
+ *
+ * \param interval The number of input plus output bytes between calls.
+ *
+ * \param cb The callback to call, or NULL to stop reporting progress.
+ *
+ * \param arg The arg to pass to the callback. */
+LIBRSYNC_EXPORT void rs_whole_set_progress_cb(rs_long_t interval,
+                                              rs_progress_cb *cb, void *arg);
+
 /** Generate the signature of a basis file, and write it out to another.
  *
  * It's recommended you use rs_sig_args() to get the recommended arguments for
@@ -590,6 +1311,17 @@ LIBRSYNC_EXPORT rs_result rs_sig_file(FILE *old_file, FILE *sig_file,
                                       rs_magic_number sig_magic,
                                       rs_stats_t *stats);
 
+/** Generate the signature of a basis file with options.
+ *
+ * This is the same as rs_sig_file() with extra ::rs_sig_flags.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_sig_file_flags(FILE *old_file, FILE *sig_file,
+                                            size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            int flags, rs_stats_t *stats);
+
 /** Load signatures from a signature file into memory.
  *
  * \param sig_file Readable stdio file from which the signature will be read.
@@ -609,11 +1341,148 @@ LIBRSYNC_EXPORT rs_result rs_loadsig_file(FILE *sig_file,
 LIBRSYNC_EXPORT rs_result rs_delta_file(rs_signature_t *, FILE *new_file,
                                         FILE *delta_file, rs_stats_t *);
 
+/** Generate a delta between a signature and a new file with options.
+ *
+ * This is the same as rs_delta_file() with extra ::rs_delta_flags.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_file_flags(rs_signature_t *,
+                                              FILE *new_file, FILE *delta_file,
+                                              int flags, rs_stats_t *);
+
+/** Generate a delta between a signature and a new file and write the new
+ * file's signature.
+ *
+ * This is the same as rs_delta_file_flags() but also writes the new file's
+ * signature as it is read using rs_delta_set_sig(), instead of reading the
+ * new file again with rs_sig_file(). The recommended signature arguments are
+ * based on the new file size like rs_sig_file().
+ *
+ * With ::RS_DELTA_SKIP_UNCHANGED an unchanged new file is skipped without
+ * looking up any blocks. The new signature is then a copy of the old one if
+ * it uses the same signature arguments.
+ *
+ * \param new_sig_file Writable stdio file to which the new signature will be
+ * written, or NULL to not generate it.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_file_sig(rs_signature_t *, FILE *new_file,
+                                            FILE *delta_file, int flags,
+                                            FILE *new_sig_file,
+                                            size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_stats_t *);
+
+/** Generate a delta between a local basis file and a new file.
+ *
+ * This is the same as generating a signature for the basis and then a delta
+ * using it, but it builds the signature index directly from the basis in
+ * memory without strong sums or serializing it. Matches are verified by
+ * comparing directly against the basis, and are extended past block
+ * boundaries the same as with rs_delta_set_basis().
+ *
+ * \param basis_file Readable stdio basis file, which must be a regular file.
+ *
+ * \param new_file Readable stdio file to generate the delta for.
+ *
+ * \param delta_file Writable stdio file to which the delta will be written.
+ *
+ * \param block_len Block size to use (0 for "recommended").
+ *
+ * \param flags Bitwise-or of ::rs_delta_flags.
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_delta_local_file(FILE *basis_file,
+                                              FILE *new_file,
+                                              FILE *delta_file,
+                                              size_t block_len, int flags,
+                                              rs_stats_t *stats);
+
 /** Apply a patch, relative to a basis, into a new file.
  *
  * \sa \ref api_whole */
 LIBRSYNC_EXPORT rs_result rs_patch_file(FILE *basis_file, FILE *delta_file,
                                         FILE *new_file, rs_stats_t *);
+
+/** Flags for rs_patch_file_flags().
+ *
+ * These can be combined with bitwise-or. */
+typedef enum {
+    /** Leave holes in the new file for all-zero blocks.
+     *
+     * Instead of writing out blocks of zeros, seek over them so that
+     * filesystems supporting sparse files don't allocate them. This only
+     * works if the new file is a seekable regular file, and is ignored
+     * otherwise. Skipped blocks keep whatever the file already had there, so
+     * a regular new file must be new or truncated, and patching fails with
+     * RS_PARAM_ERROR if it is not empty. */
+    RS_PATCH_SPARSE = 1 << 0,
+
+    /** Patch the basis file in place.
+     *
+     * The new file is written over the basis file, which must be opened for
+     * reading and writing, and new_file must be NULL or the basis file. Data
+     * copied from the same offset in the basis is left in place without any
+     * IO. The delta must have been generated with ::RS_DELTA_INPLACE, and
+     * patching fails with RS_CORRUPT if it copies from basis data that could
+     * already have been overwritten. This leaves the basis partially patched
+     * on failure. ::RS_PATCH_SPARSE is ignored for in-place patches. */
+    RS_PATCH_INPLACE = 1 << 1,
+} rs_patch_flags;
+
+/** Apply a patch, relative to a basis, into a new file with options.
+ *
+ * This is the same as rs_patch_file() with extra ::rs_patch_flags.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_file_flags(FILE *basis_file,
+                                              FILE *delta_file, FILE *new_file,
+                                              int flags, rs_stats_t *);
+
+/** Apply a patch, relative to a basis, into a new file and write the new
+ * file's signature.
+ *
+ * This is the same as rs_patch_file_flags() but also writes the new file's
+ * signature as it is patched using rs_patch_set_sig(), instead of reading the
+ * new file again with rs_sig_file(). The recommended signature arguments are
+ * based on the basis size.
+ *
+ * \param new_sig_file Writable stdio file to which the new signature will be
+ * written, or NULL to not generate it.
+ *
+ * \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patch_file_sig(FILE *basis_file, FILE *delta_file,
+                                            FILE *new_file, int flags,
+                                            FILE *new_sig_file,
+                                            size_t block_len,
+                                            size_t strong_len,
+                                            rs_magic_number sig_magic,
+                                            rs_stats_t *);
+
+/** Apply a patch to a basis file's signature to generate the new file's
+ * signature.
+ *
+ * \param basis_file Readable stdio basis file the signature was generated
+ * from.
+ *
+ * \param sig The loaded signature of the basis.
+ *
+ * \param delta_file Readable stdio delta file.
+ *
+ * \param new_sig_file Writable stdio file to which the new signature will be
+ * written.
+ *
+ * \param stats Optional pointer to receive statistics.
+ *
+ * \sa rs_patchsig_begin() \sa \ref api_whole */
+LIBRSYNC_EXPORT rs_result rs_patchsig_file(FILE *basis_file,
+                                           rs_signature_t *sig,
+                                           FILE *delta_file,
+                                           FILE *new_sig_file,
+                                           rs_stats_t *stats);
 #  endif                        /* !RSYNC_NO_STDIO_INTERFACE */
 
 #  ifdef __cplusplus
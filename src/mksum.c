@@ -25,7 +25,13 @@
  *
  * Generating checksums is pretty easy, since we can always just process
  * whatever data is available. When a whole block has arrived, or we've reached
- * the end of the file, we write the checksum out. */
+ * the end of the file, we write the checksum out.
+ *
+ * For CDC signatures we need enough data to find the next chunk boundary, and
+ * we write out the chunk length and its checksum. For multi-resolution
+ * signatures each block's checksum is followed by its fine blocks'
+ * checksums. Signatures with a whole file digest end with the file length and
+ * its BLAKE2 digest, which is calculated as the data is read. */
 
 #include "config.h"             /* IWYU pragma: keep */
 #include <stdlib.h>
@@ -33,45 +39,110 @@
 #include "job.h"
 #include "sumset.h"
 #include "scoop.h"
+#include "timing.h"
 #include "netint.h"
 #include "trace.h"
 #include "util.h"
+#include "cdc.h"
 
 /* Possible state functions for signature generation. */
 static rs_result rs_sig_s_header(rs_job_t *);
 static rs_result rs_sig_s_generate(rs_job_t *);
+static rs_result rs_sig_s_generate_cdc(rs_job_t *);
+static rs_result rs_sig_s_generate_mr(rs_job_t *);
+static rs_result rs_sig_s_generate_fine(rs_job_t *);
+static rs_result rs_sig_s_digest(rs_job_t *);
+static rs_result rs_savesig_s_block(rs_job_t *);
 
-/** State of trying to send the signature header. \private */
-static rs_result rs_sig_s_header(rs_job_t *job)
+/** Write the signature header out. \private */
+static void rs_sig_do_header(rs_job_t *job, rs_signature_t *sig)
 {
-    rs_signature_t *sig = job->signature;
-    rs_result result;
-
-    if ((result =
-         rs_signature_init(sig, job->sig_magic, job->sig_block_len,
-                           job->sig_strong_len, 0)) != RS_DONE)
-        return result;
+    if (job->flags & RS_SIG_DIGEST)
+        rs_squirt_n4(job, RS_DIGEST_SIG_MAGIC);
     rs_squirt_n4(job, sig->magic);
     rs_squirt_n4(job, sig->block_len);
     rs_squirt_n4(job, sig->strong_sum_len);
     rs_trace("sent header (magic %#x, block len = %d, strong sum len = %d)",
              sig->magic, sig->block_len, sig->strong_sum_len);
     job->stats.block_len = sig->block_len;
+}
 
-    job->statefn = rs_sig_s_generate;
+/** Finish the signature after the last block, writing the whole file length
+ * before its digest if it has one. \private */
+static rs_result rs_sig_do_end(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+
+    if (!(job->flags & RS_SIG_DIGEST))
+        return RS_DONE;
+    /* All the input has been hashed by the time we see its end. */
+    if (job->digest_new) {
+        sig->file_len = job->new_len;
+        blake2b_final(&job->new_digest, sig->file_digest,
+                      sizeof sig->file_digest);
+        job->digest_new = 0;
+    }
+    rs_squirt_netint(job, sig->file_len, 8);
+    job->statefn = rs_sig_s_digest;
     return RS_RUNNING;
 }
 
-/** Generate the checksums for a block and write it out. Called when we
- * already know we have enough data in memory at \p block. \private */
-static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
+/** State of writing the whole file digest at the end of the signature.
+ * \private */
+static rs_result rs_sig_s_digest(rs_job_t *job)
 {
     rs_signature_t *sig = job->signature;
+
+    rs_tube_write(job, sig->file_digest, sizeof sig->file_digest);
+    if (rs_trace_enabled()) {
+        char digest_hex[RS_MAX_STRONG_SUM_LENGTH * 2 + 1];
+        rs_hexify(digest_hex, sig->file_digest, sizeof sig->file_digest);
+        rs_trace("sent file digest: len=" FMT_LONG ", digest=%s",
+                 sig->file_len, digest_hex);
+    }
+    return RS_DONE;
+}
+
+/** State of trying to send the signature header. \private */
+static rs_result rs_sig_s_header(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_allocator_t const *prev;
+    rs_result result;
+
+    /* Use the job's allocator like the signature struct did. */
+    prev = rs_set_allocator(job->heap.allocator);
+    result = rs_signature_init(sig, job->sig_magic, job->sig_block_len,
+                               job->sig_strong_len, 0);
+    rs_set_allocator(prev);
+    if (result != RS_DONE)
+        return result;
+    rs_sig_do_header(job, sig);
+
+    if (rs_signature_is_cdc(sig))
+        job->statefn = rs_sig_s_generate_cdc;
+    else if (sig->fine)
+        job->statefn = rs_sig_s_generate_mr;
+    else
+        job->statefn = rs_sig_s_generate;
+    return RS_RUNNING;
+}
+
+/** Generate the checksums for a block using a signature and write it out.
+ * \private */
+static void rs_sig_do_sums(rs_job_t *job, rs_signature_t *sig,
+                           const void *block, size_t len)
+{
     rs_weak_sum_t weak_sum;
     rs_strong_sum_t strong_sum;
+    rs_timer_t timer;
 
+    rs_timer_start(&timer, &job->timing);
     weak_sum = rs_signature_calc_weak_sum(sig, block, len);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_ROLLSUM);
+    rs_timer_start(&timer, &job->timing);
     rs_signature_calc_strong_sum(sig, block, len, &strong_sum);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_STRONGSUM);
     rs_squirt_n4(job, weak_sum);
     rs_tube_write(job, strong_sum, sig->strong_sum_len);
     if (rs_trace_enabled()) {
@@ -81,6 +152,35 @@ static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
                  strong_sum_hex);
     }
     job->stats.sig_blocks++;
+}
+
+/** Generate the checksums for a block and write it out. Called when we
+ * already know we have enough data in memory at \p block. \private */
+static rs_result rs_sig_do_block(rs_job_t *job, const void *block, size_t len)
+{
+    rs_sig_do_sums(job, job->signature, block, len);
+    return RS_RUNNING;
+}
+
+/** Generate the checksum for a chunk and write it out. \private */
+static rs_result rs_sig_do_chunk(rs_job_t *job, const void *chunk, size_t len)
+{
+    rs_signature_t *sig = job->signature;
+    rs_strong_sum_t strong_sum;
+    rs_timer_t timer;
+
+    rs_timer_start(&timer, &job->timing);
+    rs_signature_calc_strong_sum(sig, chunk, len, &strong_sum);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_STRONGSUM);
+    rs_squirt_n4(job, (int)len);
+    rs_tube_write(job, strong_sum, sig->strong_sum_len);
+    if (rs_trace_enabled()) {
+        char strong_sum_hex[RS_MAX_STRONG_SUM_LENGTH * 2 + 1];
+        rs_hexify(strong_sum_hex, strong_sum, sig->strong_sum_len);
+        rs_trace("sent chunk: len=" FMT_SIZE ", strong=%s", len,
+                 strong_sum_hex);
+    }
+    job->stats.sig_blocks++;
     return RS_RUNNING;
 }
 
@@ -98,7 +198,7 @@ static rs_result rs_sig_s_generate(rs_job_t *job)
     if (result == RS_INPUT_ENDED)
         result = rs_scoop_read_rest(job, &len, &block);
     if (result == RS_INPUT_ENDED) {
-        return RS_DONE;
+        return rs_sig_do_end(job);
     } else if (result != RS_DONE) {
         rs_trace("generate stopped: %s", rs_strerror(result));
         return result;
@@ -107,16 +207,151 @@ static rs_result rs_sig_s_generate(rs_job_t *job)
     return rs_sig_do_block(job, block, len);
 }
 
+/** State of reading a block for a multi-resolution signature and trying to
+ * generate its sum.
+ *
+ * The block is left in the scoop for rs_sig_s_generate_fine() to generate
+ * the fine block sums one at a time so they fit in the tube. \private */
+static rs_result rs_sig_s_generate_mr(rs_job_t *job)
+{
+    rs_result result;
+    size_t len;
+    void *block;
+
+    /* must get a whole block, otherwise try again */
+    len = job->signature->block_len;
+    result = rs_scoop_readahead(job, len, &block);
+    /* If we are near EOF, get whatever is left. */
+    if (result == RS_INPUT_ENDED && (len = rs_scoop_avail(job)))
+        result = rs_scoop_readahead(job, len, &block);
+    if (result == RS_INPUT_ENDED) {
+        return rs_sig_do_end(job);
+    } else if (result != RS_DONE) {
+        rs_trace("generate stopped: %s", rs_strerror(result));
+        return result;
+    }
+    rs_trace("got " FMT_SIZE " byte block", len);
+    rs_sig_do_sums(job, job->signature, block, len);
+    job->sig_fine_len = len;
+    job->statefn = rs_sig_s_generate_fine;
+    return RS_RUNNING;
+}
+
+/** State of generating the sum of the next fine block in the block for a
+ * multi-resolution signature. \private */
+static rs_result rs_sig_s_generate_fine(rs_job_t *job)
+{
+    rs_result result;
+    size_t len;
+    void *block;
+
+    len = job->signature->fine->block_len;
+    if (len > job->sig_fine_len)
+        len = job->sig_fine_len;
+    if ((result = rs_scoop_read(job, len, &block)) != RS_DONE)
+        return result;
+    rs_sig_do_sums(job, job->signature->fine, block, len);
+    job->sig_fine_len -= len;
+    if (!job->sig_fine_len)
+        job->statefn = rs_sig_s_generate_mr;
+    return RS_RUNNING;
+}
+
+/** State of finding a chunk and trying to generate its sum. \private */
+static rs_result rs_sig_s_generate_cdc(rs_job_t *job)
+{
+    const size_t avg_len = job->signature->block_len;
+    rs_result result;
+    size_t len;
+    void *chunk;
+    rs_timer_t timer;
+
+    /* must get a max length chunk to find the boundary, unless near EOF */
+    len = RS_CDC_MAX_LEN(avg_len);
+    result = rs_scoop_readahead(job, len, &chunk);
+    if (result == RS_INPUT_ENDED) {
+        len = rs_scoop_avail(job);
+        if (!len)
+            return rs_sig_do_end(job);
+        result = rs_scoop_readahead(job, len, &chunk);
+    }
+    if (result != RS_DONE) {
+        rs_trace("generate stopped: %s", rs_strerror(result));
+        return result;
+    }
+    rs_timer_start(&timer, &job->timing);
+    len = rs_cdc_chunk(chunk, len, avg_len);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_ROLLSUM);
+    rs_trace("got " FMT_SIZE " byte chunk", len);
+    rs_scoop_advance(job, len);
+    return rs_sig_do_chunk(job, chunk, len);
+}
+
+/** State of writing the header of a signature in memory. \private */
+static rs_result rs_savesig_s_header(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+
+    if (rs_signature_is_cdc(sig) || sig->fine || sig->basis_cb) {
+        rs_error("can't save signatures with magic %#x", sig->magic);
+        return RS_UNIMPLEMENTED;
+    }
+    rs_sig_do_header(job, sig);
+    job->statefn = rs_savesig_s_block;
+    return RS_RUNNING;
+}
+
+/** State of writing the next block's sums of a signature in memory. The
+ * stats.sig_blocks count is the index of the next block. \private */
+static rs_result rs_savesig_s_block(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    void const *strong_sum;
+    rs_weak_sum_t weak_sum;
+
+    if (job->stats.sig_blocks == sig->count)
+        return rs_sig_do_end(job);
+    weak_sum =
+        rs_signature_get_block(sig, (int)job->stats.sig_blocks, &strong_sum);
+    rs_squirt_n4(job, weak_sum);
+    rs_tube_write(job, strong_sum, sig->strong_sum_len);
+    job->stats.sig_blocks++;
+    return RS_RUNNING;
+}
+
 rs_job_t *rs_sig_begin(size_t block_len, size_t strong_len,
                        rs_magic_number sig_magic)
+{
+    return rs_sig_begin_flags(block_len, strong_len, sig_magic, 0);
+}
+
+rs_job_t *rs_sig_begin_flags(size_t block_len, size_t strong_len,
+                             rs_magic_number sig_magic, int flags)
 {
     rs_job_t *job;
 
     job = rs_job_new("signature", rs_sig_s_header);
-    job->signature = rs_alloc_struct(rs_signature_t);
+    job->signature = rs_alloc_struct(NULL, rs_signature_t);
     job->job_owns_sig = 1;
     job->sig_magic = sig_magic;
     job->sig_block_len = (int)block_len;
     job->sig_strong_len = (int)strong_len;
+    job->flags = flags;
+    if (flags & RS_SIG_DIGEST) {
+        job->new_is_input = 1;
+        rs_job_set_digest(job);
+    }
+    return job;
+}
+
+rs_job_t *rs_savesig_begin(rs_signature_t *sig)
+{
+    rs_job_t *job;
+
+    rs_signature_check(sig);
+    job = rs_job_new("savesig", rs_savesig_s_header);
+    job->signature = sig;
+    if (sig->file_len >= 0)
+        job->flags = RS_SIG_DIGEST;
     return job;
 }
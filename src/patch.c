@@ -24,7 +24,16 @@
                                */
 
 /** \file patch.c
- * Apply a delta to an old file to generate a new file. */
+ * Apply a delta to an old file to generate a new file.
+ *
+ * This can also apply a delta to an old file's signature to generate the new
+ * file's signature. Blocks of the new file that are copied whole from block
+ * boundaries in the old file keep their old sums, and only the other blocks
+ * are read from the literal data and basis and hashed.
+ *
+ * Patch jobs can also generate the new file's signature as it is output, see
+ * rs_patch_set_sig(), and check the BLAKE2 digest of the new file in
+ * ::RS_BLAKE2_DELTA_MAGIC deltas. */
 
 #include "config.h"             /* IWYU pragma: keep */
 #include <assert.h>
@@ -34,10 +43,14 @@
 #include "librsync.h"
 #include "job.h"
 #include "netint.h"
+#include "probes.h"
 #include "scoop.h"
 #include "command.h"
 #include "prototab.h"
+#include "sumset.h"
+#include "timing.h"
 #include "trace.h"
+#include "util.h"
 
 static rs_result rs_patch_s_cmdbyte(rs_job_t *);
 static rs_result rs_patch_s_params(rs_job_t *);
@@ -45,6 +58,11 @@ static rs_result rs_patch_s_run(rs_job_t *);
 static rs_result rs_patch_s_literal(rs_job_t *);
 static rs_result rs_patch_s_copy(rs_job_t *);
 static rs_result rs_patch_s_copying(rs_job_t *);
+static rs_result rs_patch_s_checksum(rs_job_t *);
+static rs_result rs_patch_s_end(rs_job_t *);
+static rs_result rs_patch_s_sigliteral(rs_job_t *);
+static rs_result rs_patch_s_sigcopying(rs_job_t *);
+static rs_result rs_patch_s_sigend(rs_job_t *);
 
 /** State of trying to read the first byte of a command. Once we've taken that
  * in, we can know how much data to read to get the arguments. */
@@ -99,11 +117,22 @@ static rs_result rs_patch_s_run(rs_job_t *job)
         job->statefn = rs_patch_s_literal;
         return RS_RUNNING;
     case RS_KIND_END:
-        return RS_DONE;
-        /* so we exit here; trying to continue causes an error */
+        if (job->delta_magic == RS_BLAKE2_DELTA_MAGIC) {
+            rs_error("missing CHECKSUM command before END");
+            return RS_CORRUPT;
+        }
+        return rs_patch_s_end(job);
     case RS_KIND_COPY:
         job->statefn = rs_patch_s_copy;
         return RS_RUNNING;
+    case RS_KIND_CHECKSUM:
+        if (job->delta_magic != RS_BLAKE2_DELTA_MAGIC) {
+            rs_error("unexpected CHECKSUM command in delta with magic %#x",
+                     job->delta_magic);
+            return RS_CORRUPT;
+        }
+        job->statefn = rs_patch_s_checksum;
+        return RS_RUNNING;
     default:
         rs_error("bogus command %#04x", job->op);
         return RS_CORRUPT;
@@ -124,6 +153,12 @@ static rs_result rs_patch_s_literal(rs_job_t *job)
     stats->lit_cmds++;
     stats->lit_bytes += len;
     stats->lit_cmdbytes += 1 + job->cmd->len_1;
+    rs_histogram_add(&job->hists.lit_lens, len);
+    rs_probe2(patch_literal, job, len);
+    if (job->signature) {
+        job->statefn = rs_patch_s_sigliteral;
+        return RS_RUNNING;
+    }
     rs_tube_copy(job, (size_t)len);
     job->statefn = rs_patch_s_cmdbyte;
     return RS_RUNNING;
@@ -147,9 +182,11 @@ static rs_result rs_patch_s_copy(rs_job_t *job)
     stats->copy_cmds++;
     stats->copy_bytes += len;
     stats->copy_cmdbytes += 1 + job->cmd->len_1 + job->cmd->len_2;
+    rs_histogram_add(&job->hists.copy_lens, len);
+    rs_probe3(patch_copy, job, pos, len);
     job->basis_pos = pos;
     job->basis_len = len;
-    job->statefn = rs_patch_s_copying;
+    job->statefn = job->signature ? rs_patch_s_sigcopying : rs_patch_s_copying;
     return RS_RUNNING;
 }
 
@@ -200,6 +237,179 @@ static rs_result rs_patch_s_copying(rs_job_t *job)
     return RS_RUNNING;
 }
 
+/** Called when reading the BLAKE2 digest of the new file and the END command
+ * that must follow it.
+ *
+ * The digest of all the output so far is checked against it, unless this is
+ * patching a signature which has no new file data. */
+static rs_result rs_patch_s_checksum(rs_job_t *job)
+{
+    rs_byte_t digest[RS_MAX_STRONG_SUM_LENGTH];
+    const size_t len = (size_t)job->param1;
+    rs_byte_t *p;
+    rs_result result;
+
+    assert(len == sizeof digest);
+    if ((result = rs_scoop_read(job, len + 1, (void **)&p)) != RS_DONE)
+        return result;
+    if (p[len] != RS_OP_END) {
+        rs_error("got command %#04x after CHECKSUM instead of END", p[len]);
+        return RS_CORRUPT;
+    }
+    if (job->digest_new) {
+        blake2b_final(&job->new_digest, digest, len);
+        if (memcmp(digest, p, len)) {
+            rs_error("BLAKE2 digest of the new file doesn't match the delta");
+            return RS_CORRUPT;
+        }
+        rs_trace("BLAKE2 digest of the new file matches the delta");
+        /* The new signature can keep the verified digest. */
+        if (job->new_sig) {
+            job->new_sig->file_len = job->new_len;
+            memcpy(job->new_sig->file_digest, digest, len);
+        }
+    }
+    return rs_patch_s_end(job);
+}
+
+/** Called at the END command to finish the patch. */
+static rs_result rs_patch_s_end(rs_job_t *job)
+{
+    if (job->signature) {
+        job->statefn = rs_patch_s_sigend;
+        return RS_RUNNING;
+    }
+    return RS_DONE;
+    /* so we exit here; trying to continue causes an error */
+}
+
+/** Write a block's sums to the new signature. */
+static void rs_patch_sigput(rs_job_t *job, rs_weak_sum_t weak_sum,
+                            void const *strong_sum)
+{
+    rs_squirt_n4(job, weak_sum);
+    rs_tube_write(job, strong_sum, job->signature->strong_sum_len);
+    job->stats.sig_blocks++;
+}
+
+/** Calculate and write the sums of the block in sig_buf to the new
+ * signature. */
+static void rs_patch_sigput_buf(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_weak_sum_t weak_sum;
+    rs_strong_sum_t strong_sum;
+    rs_timer_t timer;
+
+    rs_timer_start(&timer, &job->timing);
+    weak_sum = rs_signature_calc_weak_sum(sig, job->sig_buf, job->sig_buf_len);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_ROLLSUM);
+    rs_timer_start(&timer, &job->timing);
+    rs_signature_calc_strong_sum(sig, job->sig_buf, job->sig_buf_len,
+                                 &strong_sum);
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_STRONGSUM);
+    rs_patch_sigput(job, weak_sum, strong_sum);
+    job->sig_buf_len = 0;
+}
+
+/** Called when adding literal data to sig_buf for the new signature. */
+static rs_result rs_patch_s_sigliteral(rs_job_t *job)
+{
+    const size_t block_len = job->signature->block_len;
+    size_t len = block_len - job->sig_buf_len;
+    rs_result result;
+    void *p;
+
+    if ((rs_long_t)len > job->param1)
+        len = (size_t)job->param1;
+    if ((result = rs_scoop_read(job, len, &p)) != RS_DONE)
+        return result;
+    memcpy(job->sig_buf + job->sig_buf_len, p, len);
+    job->sig_buf_len += len;
+    job->param1 -= (rs_long_t)len;
+    if (job->sig_buf_len == block_len)
+        rs_patch_sigput_buf(job);
+    if (!job->param1)
+        job->statefn = rs_patch_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+/** Called when executing a COPY command for the new signature.
+ *
+ * Whole blocks copied from block boundaries reuse the sums from the old
+ * signature. A COPY of a whole block from the last old block also means that
+ * block was whole. Everything else is copied from the basis into sig_buf. */
+static rs_result rs_patch_s_sigcopying(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    const size_t block_len = sig->block_len;
+    void const *strong_sum;
+    rs_weak_sum_t weak_sum;
+    rs_result result;
+    size_t len;
+    void *p;
+
+    if (!job->sig_buf_len && job->basis_len >= (rs_long_t)block_len
+        && job->basis_pos % block_len == 0
+        && job->basis_pos / block_len < sig->count) {
+        weak_sum =
+            rs_signature_get_block(sig, (int)(job->basis_pos / block_len),
+                                   &strong_sum);
+        rs_trace("reuse sums of block at " FMT_LONG, job->basis_pos);
+        rs_patch_sigput(job, weak_sum, strong_sum);
+        len = block_len;
+    } else {
+        len = block_len - job->sig_buf_len;
+        if ((rs_long_t)len > job->basis_len)
+            len = (size_t)job->basis_len;
+        p = job->sig_buf + job->sig_buf_len;
+        result = (job->copy_cb) (job->copy_arg, job->basis_pos, &len, &p);
+        if (result != RS_DONE) {
+            rs_trace("copy callback returned %s", rs_strerror(result));
+            return result;
+        }
+        if (p != job->sig_buf + job->sig_buf_len)
+            memcpy(job->sig_buf + job->sig_buf_len, p, len);
+        job->sig_buf_len += len;
+        if (job->sig_buf_len == block_len)
+            rs_patch_sigput_buf(job);
+    }
+    job->basis_pos += (rs_long_t)len;
+    job->basis_len -= (rs_long_t)len;
+    if (!job->basis_len)
+        job->statefn = rs_patch_s_cmdbyte;
+    return RS_RUNNING;
+}
+
+/** Called at the end of the delta to write the last partial block of the new
+ * signature. */
+static rs_result rs_patch_s_sigend(rs_job_t *job)
+{
+    if (job->sig_buf_len)
+        rs_patch_sigput_buf(job);
+    return RS_DONE;
+}
+
+/** Called to write the header of the new signature. */
+static rs_result rs_patch_sigheader(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+
+    if (rs_signature_is_cdc(sig) || sig->fine || sig->basis_cb) {
+        rs_error("can't patch signatures with magic %#x", sig->magic);
+        return RS_UNIMPLEMENTED;
+    }
+    rs_squirt_n4(job, sig->magic);
+    rs_squirt_n4(job, sig->block_len);
+    rs_squirt_n4(job, sig->strong_sum_len);
+    job->stats.block_len = sig->block_len;
+    job->sig_buf_size = (size_t)sig->block_len;
+    job->sig_buf =
+        rs_alloc(&job->heap, job->sig_buf_size, "signature block buffer");
+    job->statefn = rs_patch_s_cmdbyte;
+    return RS_RUNNING;
+}
+
 /** Called while we're trying to read the header of the patch. */
 static rs_result rs_patch_s_header(rs_job_t *job)
 {
@@ -208,12 +418,18 @@ static rs_result rs_patch_s_header(rs_job_t *job)
 
     if ((result = rs_suck_n4(job, &v)) != RS_DONE)
         return result;
-    if (v != RS_DELTA_MAGIC) {
+    if (v != RS_DELTA_MAGIC && v != RS_BLAKE2_DELTA_MAGIC) {
         rs_error("got magic number %#x rather than expected value %#x", v,
                  RS_DELTA_MAGIC);
         return RS_BAD_MAGIC;
     } else
         rs_trace("got patch magic %#x", v);
+    job->delta_magic = v;
+    /* Patching signatures doesn't have the new file data to check. */
+    if (v == RS_BLAKE2_DELTA_MAGIC && !job->signature)
+        rs_job_set_digest(job);
+    if (job->signature)
+        return rs_patch_sigheader(job);
     job->statefn = rs_patch_s_cmdbyte;
     return RS_RUNNING;
 }
@@ -224,6 +440,33 @@ rs_job_t *rs_patch_begin(rs_copy_cb * copy_cb, void *copy_arg)
 
     job->copy_cb = copy_cb;
     job->copy_arg = copy_arg;
-    rs_mdfour_begin(&job->output_md4);
+    return job;
+}
+
+rs_result rs_patch_set_sig(rs_job_t *job, rs_signature_t **sig,
+                           rs_magic_number sig_magic, size_t block_len,
+                           size_t strong_len)
+{
+    rs_result result;
+
+    rs_job_check(job);
+    if (job->statefn != rs_patch_s_header || job->signature || job->new_sig)
+        return RS_PARAM_ERROR;
+    if ((result =
+         rs_job_set_sig(job, sig, sig_magic, block_len,
+                        strong_len)) == RS_DONE)
+        job->stats.block_len = (*sig)->block_len;
+    return result;
+}
+
+rs_job_t *rs_patchsig_begin(rs_signature_t *sig, rs_copy_cb * copy_cb,
+                            void *copy_arg)
+{
+    rs_job_t *job = rs_job_new("patchsig", rs_patch_s_header);
+
+    rs_signature_check(sig);
+    job->signature = sig;
+    job->copy_cb = copy_cb;
+    job->copy_arg = copy_arg;
     return job;
 }
@@ -0,0 +1,97 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file probes.h
+ * USDT static probes and trace events.
+ *
+ * These are probes in the "librsync" provider for tools like bpftrace and
+ * perf. Each compiles to a nop instruction and a note in the binary, so they
+ * cost next to nothing unless a tracer attaches to them, and they are always
+ * available in release builds unlike rs_trace(). Each probe also records an
+ * ::rs_event_t with the same arguments if the thread has an event ring (see
+ * events.h).
+ *
+ * Unless librsync is built with DO_RS_PROBES, which needs <sys/sdt.h> from
+ * SystemTap, the USDT probes compile to nothing.
+ *
+ * \sa \ref api_trace */
+#ifndef PROBES_H
+#  define PROBES_H
+
+#  include "events.h"
+
+#  ifdef DO_RS_PROBES
+#    include <sys/sdt.h>
+#    define rs_sdt(name) DTRACE_PROBE(librsync, name)
+#    define rs_sdt1(name, a1) DTRACE_PROBE1(librsync, name, a1)
+#    define rs_sdt2(name, a1, a2) DTRACE_PROBE2(librsync, name, a1, a2)
+#    define rs_sdt3(name, a1, a2, a3) \
+        DTRACE_PROBE3(librsync, name, a1, a2, a3)
+#    define rs_sdt4(name, a1, a2, a3, a4) \
+        DTRACE_PROBE4(librsync, name, a1, a2, a3, a4)
+#    define rs_sdt5(name, a1, a2, a3, a4, a5) \
+        DTRACE_PROBE5(librsync, name, a1, a2, a3, a4, a5)
+#  else
+#    define rs_sdt(name) do {} while (0)
+#    define rs_sdt1(name, a1) do {} while (0)
+#    define rs_sdt2(name, a1, a2) do {} while (0)
+#    define rs_sdt3(name, a1, a2, a3) do {} while (0)
+#    define rs_sdt4(name, a1, a2, a3, a4) do {} while (0)
+#    define rs_sdt5(name, a1, a2, a3, a4, a5) do {} while (0)
+#  endif
+
+/* The ::rs_event_type of each probe name. */
+#  define rs_event_job_start RS_EVENT_JOB_START
+#  define rs_event_job_end RS_EVENT_JOB_END
+#  define rs_event_fill RS_EVENT_FILL
+#  define rs_event_drain RS_EVENT_DRAIN
+#  define rs_event_scoop_resize RS_EVENT_SCOOP_RESIZE
+#  define rs_event_match RS_EVENT_MATCH
+#  define rs_event_strong_sum RS_EVENT_STRONG_SUM
+#  define rs_event_literal RS_EVENT_LITERAL
+#  define rs_event_copy RS_EVENT_COPY
+#  define rs_event_patch_literal RS_EVENT_PATCH_LITERAL
+#  define rs_event_patch_copy RS_EVENT_PATCH_COPY
+
+#  define rs_probe(name) do {\
+    rs_sdt(name);\
+    rs_event(rs_event_##name, 0, 0, 0, 0, 0, 0);\
+} while (0)
+#  define rs_probe1(name, a1) do {\
+    rs_sdt1(name, a1);\
+    rs_event(rs_event_##name, 1, a1, 0, 0, 0, 0);\
+} while (0)
+#  define rs_probe2(name, a1, a2) do {\
+    rs_sdt2(name, a1, a2);\
+    rs_event(rs_event_##name, 2, a1, a2, 0, 0, 0);\
+} while (0)
+#  define rs_probe3(name, a1, a2, a3) do {\
+    rs_sdt3(name, a1, a2, a3);\
+    rs_event(rs_event_##name, 3, a1, a2, a3, 0, 0);\
+} while (0)
+#  define rs_probe4(name, a1, a2, a3, a4) do {\
+    rs_sdt4(name, a1, a2, a3, a4);\
+    rs_event(rs_event_##name, 4, a1, a2, a3, a4, 0);\
+} while (0)
+#  define rs_probe5(name, a1, a2, a3, a4, a5) do {\
+    rs_sdt5(name, a1, a2, a3, a4, a5);\
+    rs_event(rs_event_##name, 5, a1, a2, a3, a4, a5);\
+} while (0)
+
+#endif                          /* !PROBES_H */
@@ -133,7 +133,7 @@ enum {
     RS_OP_COPY_N8_N2 = 0x52,
     RS_OP_COPY_N8_N4 = 0x53,
     RS_OP_COPY_N8_N8 = 0x54,
-    RS_OP_RESERVED_85 = 0x55,
+    RS_OP_CHECKSUM = 0x55,
     RS_OP_RESERVED_86 = 0x56,
     RS_OP_RESERVED_87 = 0x57,
     RS_OP_RESERVED_88 = 0x58,
@@ -60,6 +60,10 @@ static int show_stats = 0;
 static int bzip2_level = 0;
 static int gzip_level = 0;
 static int file_force = 0;
+static int patch_sparse = 0;
+static int inplace = 0;
+static int delta_checksum = 0;
+static int skip_unchanged = 0;
 
 enum {
     OPT_GZIP = 1069, OPT_BZIP2
@@ -97,20 +101,33 @@ static void bad_option(poptContext opcon, int error)
 static void help(void)
 {
     printf("Usage: rdiff [OPTIONS] signature [BASIS [SIGNATURE]]\n"
-           "             [OPTIONS] delta SIGNATURE [NEWFILE [DELTA]]\n"
-           "             [OPTIONS] patch BASIS [DELTA [NEWFILE]]\n" "\n"
+           "             [OPTIONS] delta SIGNATURE [NEWFILE [DELTA [NEWSIG]]]\n"
+           "             [OPTIONS] local-delta BASIS [NEWFILE [DELTA]]\n"
+           "             [OPTIONS] patch BASIS [DELTA [NEWFILE [NEWSIG]]]\n"
+           "             [OPTIONS] --inplace patch BASIS [DELTA [NEWSIG]]\n"
+           "             [OPTIONS] patch-signature BASIS SIG [DELTA [NEWSIG]]\n"
+           "\n"
            "Options:\n"
            "  -v, --verbose             Trace internal processing\n"
            "  -V, --version             Show program version\n"
            "  -?, --help                Show this help message\n"
            "  -s, --statistics          Show performance statistics\n"
            "  -f, --force               Force overwriting existing files\n"
+           "      --inplace             Make deltas that can patch BASIS in place, or\n"
+           "                            patch BASIS in place instead of writing NEWFILE\n"
            "Signature generation options:\n"
            "  -H, --hash=ALG            Hash algorithm: blake2 (default), md4\n"
-           "  -R, --rollsum=ALG         Rollsum algorithm: rabinkarp (default), rollsum\n"
+           "  -R, --rollsum=ALG         Rollsum algorithm: rabinkarp (default), rollsum,\n"
+           "                            cdc for content defined chunks, or multires for\n"
+           "                            rabinkarp with fine blocks\n"
            "Delta-encoding options:\n"
            "  -b, --block-size=BYTES    Signature block size, 0 (default) for recommended\n"
            "  -S, --sum-size=BYTES      Signature strength, 0 (default) for max, -1 for min\n"
+           "      --checksum            Add a BLAKE2 digest of BASIS to signatures, or of\n"
+           "                            NEWFILE to deltas for patch to check\n"
+           "      --skip-unchanged      Hash NEWFILE first to skip it if unchanged\n"
+           "Patch options:\n"
+           "      --sparse              Leave holes for zero blocks in NEWFILE\n"
            "IO options:\n" "  -I, --input-size=BYTES    Input buffer size\n"
            "  -O, --output-size=BYTES   Output buffer size\n"
            "  -z, --gzip[=LEVEL]        gzip-compress deltas\n"
@@ -190,19 +207,11 @@ static void rdiff_options(poptContext opcon)
     }
 }
 
-/** Generate signature from remaining command line arguments. */
-static rs_result rdiff_sig(poptContext opcon)
+/** Get the signature magic from the hash and rollsum options. */
+static rs_magic_number rdiff_sig_magic(void)
 {
-    FILE *basis_file, *sig_file;
-    rs_stats_t stats;
-    rs_result result;
     rs_magic_number sig_magic;
 
-    basis_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
-    sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
-
-    rdiff_no_more_args(opcon);
-
     if (!rs_hash_name || !strcmp(rs_hash_name, "blake2")) {
         sig_magic = RS_BLAKE2_SIG_MAGIC;
     } else if (!strcmp(rs_hash_name, "md4")) {
@@ -214,14 +223,38 @@ static rs_result rdiff_sig(poptContext opcon)
     if (!rs_rollsum_name || !strcmp(rs_rollsum_name, "rabinkarp")) {
         /* The RabinKarp magics are 0x10 greater than the rollsum magics. */
         sig_magic += 0x10;
+    } else if (!strcmp(rs_rollsum_name, "cdc")) {
+        /* The CDC magics are 0x20 greater than the rollsum magics. */
+        sig_magic += 0x20;
+    } else if (!strcmp(rs_rollsum_name, "multires")) {
+        /* The multi-resolution magics are 0x30 greater than the rollsum
+           magics. */
+        sig_magic += 0x30;
     } else if (strcmp(rs_rollsum_name, "rollsum")) {
         rdiff_usage("Unknown rollsum algorithm '%s'.", rs_rollsum_name);
         exit(RS_SYNTAX_ERROR);
     }
+    return sig_magic;
+}
 
+/** Generate signature from remaining command line arguments. */
+static rs_result rdiff_sig(poptContext opcon)
+{
+    FILE *basis_file, *sig_file;
+    rs_stats_t stats;
+    rs_result result;
+    rs_magic_number sig_magic;
+
+    basis_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    sig_magic = rdiff_sig_magic();
     result =
-        rs_sig_file(basis_file, sig_file, block_len, strong_len, sig_magic,
-                    &stats);
+        rs_sig_file_flags(basis_file, sig_file, block_len, strong_len,
+                          sig_magic, delta_checksum ? RS_SIG_DIGEST : 0,
+                          &stats);
 
     rs_file_close(sig_file);
     rs_file_close(basis_file);
@@ -236,21 +269,23 @@ static rs_result rdiff_sig(poptContext opcon)
 
 static rs_result rdiff_delta(poptContext opcon)
 {
-    FILE *sig_file, *new_file, *delta_file;
-    char const *sig_name;
+    FILE *sig_file, *new_file, *delta_file, *new_sig_file = NULL;
+    char const *sig_name, *new_sig_name;
     rs_result result;
     rs_signature_t *sumset;
     rs_stats_t stats;
 
     if (!(sig_name = poptGetArg(opcon))) {
-        rdiff_usage("Usage for delta: "
-                    "rdiff [OPTIONS] delta SIGNATURE [NEWFILE [DELTA]]");
+        rdiff_usage("Usage for delta: rdiff [OPTIONS] delta SIGNATURE "
+                    "[NEWFILE [DELTA [NEWSIG]]]");
         exit(RS_SYNTAX_ERROR);
     }
 
     sig_file = rs_file_open(sig_name, "rb", file_force);
     new_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
     delta_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+    if ((new_sig_name = poptGetArg(opcon)))
+        new_sig_file = rs_file_open(new_sig_name, "wb", file_force);
 
     rdiff_no_more_args(opcon);
 
@@ -264,8 +299,16 @@ static rs_result rdiff_delta(poptContext opcon)
     if ((result = rs_build_hash_table(sumset)) != RS_DONE)
         return result;
 
-    result = rs_delta_file(sumset, new_file, delta_file, &stats);
-
+    result =
+        rs_delta_file_sig(sumset, new_file, delta_file,
+                          (inplace ? RS_DELTA_INPLACE : 0) |
+                          (delta_checksum ? RS_DELTA_CHECKSUM : 0) |
+                          (skip_unchanged ? RS_DELTA_SKIP_UNCHANGED : 0),
+                          new_sig_file, block_len, strong_len,
+                          new_sig_file ? rdiff_sig_magic() : 0, &stats);
+
+    if (new_sig_file)
+        rs_file_close(new_sig_file);
     rs_file_close(delta_file);
     rs_file_close(new_file);
     rs_file_close(sig_file);
@@ -280,35 +323,132 @@ static rs_result rdiff_delta(poptContext opcon)
     return result;
 }
 
-static rs_result rdiff_patch(poptContext opcon)
+static rs_result rdiff_local_delta(poptContext opcon)
 {
-    /* patch BASIS [DELTA [NEWFILE]] */
-    FILE *basis_file, *delta_file, *new_file;
+    /* local-delta BASIS [NEWFILE [DELTA]] */
+    FILE *basis_file, *new_file, *delta_file;
     char const *basis_name;
     rs_stats_t stats;
     rs_result result;
 
+    if (!(basis_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for local-delta: "
+                    "rdiff [OPTIONS] local-delta BASIS [NEWFILE [DELTA]]");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    basis_file = rs_file_open(basis_name, "rb", file_force);
+    new_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+    delta_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    result =
+        rs_delta_local_file(basis_file, new_file, delta_file, block_len,
+                            (inplace ? RS_DELTA_INPLACE : 0) |
+                            (delta_checksum ? RS_DELTA_CHECKSUM : 0), &stats);
+
+    rs_file_close(delta_file);
+    rs_file_close(new_file);
+    rs_file_close(basis_file);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+    return result;
+}
+
+static rs_result rdiff_patch(poptContext opcon)
+{
+    /* patch BASIS [DELTA [NEWFILE [NEWSIG]]] or --inplace patch BASIS [DELTA
+       [NEWSIG]] */
+    FILE *basis_file, *delta_file, *new_file, *new_sig_file = NULL;
+    char const *basis_name, *new_sig_name;
+    rs_stats_t stats;
+    rs_result result;
+
     if (!(basis_name = poptGetArg(opcon))) {
         rdiff_usage("Usage for patch: "
-                    "rdiff [OPTIONS] patch BASIS [DELTA [NEW]]");
+                    "rdiff [OPTIONS] patch BASIS [DELTA [NEW [NEWSIG]]]");
+        exit(RS_SYNTAX_ERROR);
+    }
+
+    if (inplace) {
+        basis_file = rs_file_open(basis_name, "r+b", file_force);
+        delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+        new_file = NULL;
+    } else {
+        basis_file = rs_file_open(basis_name, "rb", file_force);
+        delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
+        new_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+    }
+    if ((new_sig_name = poptGetArg(opcon)))
+        new_sig_file = rs_file_open(new_sig_name, "wb", file_force);
+
+    rdiff_no_more_args(opcon);
+
+    result =
+        rs_patch_file_sig(basis_file, delta_file, new_file,
+                          (patch_sparse ? RS_PATCH_SPARSE : 0) |
+                          (inplace ? RS_PATCH_INPLACE : 0), new_sig_file,
+                          block_len, strong_len,
+                          new_sig_file ? rdiff_sig_magic() : 0, &stats);
+
+    if (new_sig_file)
+        rs_file_close(new_sig_file);
+    if (new_file)
+        rs_file_close(new_file);
+    rs_file_close(delta_file);
+    rs_file_close(basis_file);
+
+    if (show_stats)
+        rs_log_stats(&stats);
+
+    return result;
+}
+
+static rs_result rdiff_patch_sig(poptContext opcon)
+{
+    /* patch-signature BASIS SIGNATURE [DELTA [NEWSIGNATURE]] */
+    FILE *basis_file, *sig_file, *delta_file, *new_sig_file;
+    char const *basis_name, *sig_name;
+    rs_signature_t *sumset;
+    rs_stats_t stats;
+    rs_result result;
+
+    if (!(basis_name = poptGetArg(opcon)) || !(sig_name = poptGetArg(opcon))) {
+        rdiff_usage("Usage for patch-signature: rdiff [OPTIONS] "
+                    "patch-signature BASIS SIGNATURE [DELTA [NEWSIGNATURE]]");
         exit(RS_SYNTAX_ERROR);
     }
 
     basis_file = rs_file_open(basis_name, "rb", file_force);
+    sig_file = rs_file_open(sig_name, "rb", file_force);
     delta_file = rs_file_open(poptGetArg(opcon), "rb", file_force);
-    new_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
+    new_sig_file = rs_file_open(poptGetArg(opcon), "wb", file_force);
 
     rdiff_no_more_args(opcon);
 
-    result = rs_patch_file(basis_file, delta_file, new_file, &stats);
+    result = rs_loadsig_file(sig_file, &sumset, &stats);
+    if (result != RS_DONE)
+        return result;
+
+    if (show_stats)
+        rs_log_stats(&stats);
 
-    rs_file_close(new_file);
+    result =
+        rs_patchsig_file(basis_file, sumset, delta_file, new_sig_file, &stats);
+
+    rs_file_close(new_sig_file);
     rs_file_close(delta_file);
+    rs_file_close(sig_file);
     rs_file_close(basis_file);
 
     if (show_stats)
         rs_log_stats(&stats);
 
+    rs_free_sumset(sumset);
+
     return result;
 }
 
@@ -324,9 +464,14 @@ static rs_result rdiff_action(poptContext opcon)
         return rdiff_delta(opcon);
     else if (isprefix(action, "patch"))
         return rdiff_patch(opcon);
+    else if (isprefix(action, "local-delta"))
+        return rdiff_local_delta(opcon);
+    else if (isprefix(action, "patch-signature"))
+        return rdiff_patch_sig(opcon);
 
     rdiff_usage
-        ("You must specify an action: `signature', `delta', or `patch'.");
+        ("You must specify an action: `signature', `delta', `local-delta', "
+         "`patch', or `patch-signature'.");
     exit(RS_SYNTAX_ERROR);
 }
 
@@ -349,6 +494,10 @@ int main(const int argc, const char *argv[])
         {"gzip", 'z', POPT_ARG_NONE, 0, OPT_GZIP},
         {"bzip2", 'i', POPT_ARG_NONE, 0, OPT_BZIP2},
         {"force", 'f', POPT_ARG_NONE, &file_force},
+        {"sparse", 0, POPT_ARG_NONE, &patch_sparse},
+        {"inplace", 0, POPT_ARG_NONE, &inplace},
+        {"checksum", 0, POPT_ARG_NONE, &delta_checksum},
+        {"skip-unchanged", 0, POPT_ARG_NONE, &skip_unchanged},
         {0}
     };
 
@@ -24,6 +24,7 @@
  * Load signatures from a file. */
 
 #include "config.h"             /* IWYU pragma: keep */
+#include <string.h>
 #include "librsync.h"
 #include "job.h"
 #include "sumset.h"
@@ -31,6 +32,7 @@
 #include "netint.h"
 #include "trace.h"
 #include "util.h"
+#include "cdc.h"
 
 static rs_result rs_loadsig_s_weak(rs_job_t *job);
 static rs_result rs_loadsig_s_strong(rs_job_t *job);
@@ -46,21 +48,73 @@ static rs_result rs_loadsig_add_sum(rs_job_t *job, rs_strong_sum_t *strong)
         rs_trace("got block: weak=" FMT_WEAKSUM ", strong=%s", job->weak_sig,
                  hexbuf);
     }
-    rs_signature_add_block(job->signature, job->weak_sig, strong);
+    /* For CDC signatures the weak sum is the chunk length. For
+       multi-resolution signatures each block is followed by its fine blocks,
+       and only the last block can have less than RS_MR_FINE_RATIO. */
+    if (sig->fine && sig->fine->count < sig->count * RS_MR_FINE_RATIO)
+        rs_signature_add_block(sig->fine, job->weak_sig, strong);
+    else if (rs_signature_is_cdc(sig))
+        rs_signature_add_chunk(sig, (size_t)job->weak_sig, strong);
+    else
+        rs_signature_add_block(sig, job->weak_sig, strong);
     job->stats.sig_blocks++;
     return RS_RUNNING;
 }
 
+/** State of reading the whole file length and digest at the end of a
+ * signature. */
+static rs_result rs_loadsig_s_digest(rs_job_t *job)
+{
+    rs_signature_t *sig = job->signature;
+    rs_long_t len;
+    void *digest;
+
+    if (rs_scoop_avail(job) != 8 + sizeof sig->file_digest) {
+        rs_error("signature file digest is missing");
+        return RS_CORRUPT;
+    }
+    rs_suck_netint(job, &len, 8);
+    rs_scoop_read(job, sizeof sig->file_digest, &digest);
+    if (len < 0) {
+        rs_error("signature file length " FMT_LONG " is bogus", len);
+        return RS_CORRUPT;
+    }
+    rs_trace("got file digest for length " FMT_LONG, len);
+    sig->file_len = len;
+    memcpy(sig->file_digest, digest, sizeof sig->file_digest);
+    return RS_DONE;
+}
+
 static rs_result rs_loadsig_s_weak(rs_job_t *job)
 {
     int l;
     rs_result result;
-
+    void *buf;
+
+    /* If the signature ends with a digest, there must be more than that left
+       for another block. */
+    if (job->flags & RS_SIG_DIGEST) {
+        result =
+            rs_scoop_readahead(job,
+                               4 + job->signature->strong_sum_len + 8 +
+                               sizeof job->signature->file_digest, &buf);
+        if (result == RS_INPUT_ENDED) {
+            job->statefn = rs_loadsig_s_digest;
+            return RS_RUNNING;
+        } else if (result != RS_DONE) {
+            return result;
+        }
+    }
     if ((result = rs_suck_n4(job, &l)) != RS_DONE) {
         if (result == RS_INPUT_ENDED)   /* ending here is OK */
             return RS_DONE;
         return result;
     }
+    if (rs_signature_is_cdc(job->signature)
+        && (l < 1 || l > RS_CDC_MAX_LEN(job->signature->block_len))) {
+        rs_error("chunk length of %d is bogus", l);
+        return RS_CORRUPT;
+    }
     job->weak_sig = l;
     job->statefn = rs_loadsig_s_strong;
     return RS_RUNNING;
@@ -82,6 +136,7 @@ static rs_result rs_loadsig_s_strong(rs_job_t *job)
 static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
 {
     int l;
+    rs_allocator_t const *prev;
     rs_result result;
 
     if ((result = rs_suck_n4(job, &l)) != RS_DONE)
@@ -92,10 +147,14 @@ static rs_result rs_loadsig_s_stronglen(rs_job_t *job)
     }
     rs_trace("got strong sum length %d", l);
     job->sig_strong_len = l;
-    /* Initialize the signature. */
-    if ((result =
-         rs_signature_init(job->signature, job->sig_magic, job->sig_block_len,
-                           job->sig_strong_len, job->sig_fsize)) != RS_DONE)
+    /* Initialize the signature with the job's allocator like the signature
+       struct was. */
+    prev = rs_set_allocator(job->heap.allocator);
+    result = rs_signature_init(job->signature, job->sig_magic,
+                               job->sig_block_len, job->sig_strong_len,
+                               job->sig_fsize);
+    rs_set_allocator(prev);
+    if (result != RS_DONE)
         return result;
     job->statefn = rs_loadsig_s_weak;
     return RS_RUNNING;
@@ -126,6 +185,12 @@ static rs_result rs_loadsig_s_magic(rs_job_t *job)
 
     if ((result = rs_suck_n4(job, &l)) != RS_DONE)
         return result;
+    /* The digest prefix is followed by the real magic. */
+    if (l == RS_DIGEST_SIG_MAGIC && !(job->flags & RS_SIG_DIGEST)) {
+        rs_trace("got signature digest prefix");
+        job->flags |= RS_SIG_DIGEST;
+        return RS_RUNNING;
+    }
     rs_trace("got signature magic %#x", l);
     job->sig_magic = l;
     job->statefn = rs_loadsig_s_blocklen;
@@ -137,6 +202,6 @@ rs_job_t *rs_loadsig_begin(rs_signature_t **signature)
     rs_job_t *job;
 
     job = rs_job_new("loadsig", rs_loadsig_s_magic);
-    *signature = job->signature = rs_alloc_struct(rs_signature_t);
+    *signature = job->signature = rs_alloc_struct(NULL, rs_signature_t);
     return job;
 }
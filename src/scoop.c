@@ -58,7 +58,9 @@
 #include <string.h>
 #include "librsync.h"
 #include "job.h"
+#include "probes.h"
 #include "scoop.h"
+#include "timing.h"
 #include "trace.h"
 #include "util.h"
 
@@ -67,22 +69,24 @@ static inline void rs_scoop_input(rs_job_t *job, size_t len)
 {
     rs_buffers_t *stream = job->stream;
     size_t tocopy;
+    rs_timer_t timer;
 
     assert(len > job->scoop_avail);
 
+    rs_timer_start(&timer, &job->timing);
     if (job->scoop_alloc < len) {
         /* Need to allocate a larger scoop. */
         rs_byte_t *newbuf;
         size_t newsize;
         for (newsize = 64; newsize < len; newsize <<= 1) ;
-        newbuf = rs_alloc(newsize, "scoop buffer");
+        newbuf = rs_alloc(&job->heap, newsize, "scoop buffer");
         if (job->scoop_avail)
             memcpy(newbuf, job->scoop_next, job->scoop_avail);
-        if (job->scoop_buf)
-            free(job->scoop_buf);
+        rs_free(&job->heap, job->scoop_buf, job->scoop_alloc);
         job->scoop_buf = job->scoop_next = newbuf;
         rs_trace("resized scoop buffer to " FMT_SIZE " bytes from " FMT_SIZE "",
                  newsize, job->scoop_alloc);
+        rs_probe3(scoop_resize, job, job->scoop_alloc, newsize);
         job->scoop_alloc = newsize;
     } else if (job->scoop_buf + job->scoop_alloc < job->scoop_next + len) {
         /* Move existing data to the front of the scoop. */
@@ -104,6 +108,7 @@ static inline void rs_scoop_input(rs_job_t *job, size_t len)
     job->scoop_avail += tocopy;
     stream->next_in += tocopy;
     stream->avail_in -= tocopy;
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_FILL);
 }
 
 /** Advance the input cursor forward \p len bytes.
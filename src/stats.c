@@ -24,10 +24,15 @@
  * number of times we blocked waiting for input or output, number of blocks. */
 
 #include "config.h"             /* IWYU pragma: keep */
+#include <stdarg.h>
 #include <stdio.h>
 #include "librsync.h"
 #include "trace.h"
 
+static char const *const rs_timing_phase_names[RS_TIMING_PHASES] = {
+    "fill", "rollsum", "hashtable", "strongsum", "emit", "drain"
+};
+
 int rs_log_stats(rs_stats_t const *stats)
 {
     char buf[1000];
@@ -89,3 +94,157 @@ char *rs_format_stats(rs_stats_t const *stats, char *buf, size_t size)
              mb_in, mb_in / sec, mb_out, mb_out / sec, sec);
     return buf;
 }
+
+int rs_supports_timing(void)
+{
+#ifdef DO_RS_TIMING
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+char const *rs_timing_phase_name(rs_timing_phase phase)
+{
+    if ((unsigned)phase >= RS_TIMING_PHASES)
+        return "unknown";
+    return rs_timing_phase_names[phase];
+}
+
+int rs_log_timing(rs_timing_t const *timing)
+{
+    char buf[1000];
+
+    rs_format_timing(timing, buf, sizeof buf - 1);
+    rs_log(RS_LOG_INFO | RS_LOG_NONAME, "%s", buf);
+    return 0;
+}
+
+char *rs_format_timing(rs_timing_t const *timing, char *buf, size_t size)
+{
+    size_t len;
+    int p;
+
+    len = (size_t)snprintf(buf, size, "timing: ");
+    for (p = 0; p < RS_TIMING_PHASES && len < size; p++) {
+        if (!timing->calls[p])
+            continue;
+        len +=
+            (size_t)snprintf(buf + len, size - len,
+                             "%s[%.3f ms, %llu calls] ",
+                             rs_timing_phase_names[p], timing->ns[p] / 1e6,
+                             (unsigned long long)timing->calls[p]);
+    }
+    if (len < size)
+        snprintf(buf + len, size - len, "total[%.3f ms of %.3f ms elapsed]",
+                 timing->total_ns / 1e6, timing->elapsed_ns / 1e6);
+    return buf;
+}
+
+/** Append formatted text to buf at *len, keeping *len within size. */
+static void rs_json_printf(char *buf, size_t size, size_t *len,
+                           char const *fmt, ...)
+{
+    va_list va;
+    int n;
+
+    if (*len >= size)
+        return;
+    va_start(va, fmt);
+    n = vsnprintf(buf + *len, size - *len, fmt, va);
+    va_end(va);
+    if (n > 0)
+        *len += (size_t)n;
+    if (*len >= size)
+        *len = size;
+}
+
+/** Append a histogram as a JSON array without its trailing empty buckets. */
+static void rs_json_histogram(char *buf, size_t size, size_t *len,
+                              char const *name, rs_histogram_t const *hist)
+{
+    int n, i;
+
+    for (n = RS_HISTOGRAM_BUCKETS; n > 0 && !hist->count[n - 1]; n--) ;
+    rs_json_printf(buf, size, len, "\"%s\": [", name);
+    for (i = 0; i < n; i++)
+        rs_json_printf(buf, size, len, i ? ", " FMT_LONG : FMT_LONG,
+                       hist->count[i]);
+    rs_json_printf(buf, size, len, "]");
+}
+
+char *rs_format_stats_json(rs_stats_t const *stats, rs_job_t *job, char *buf,
+                           size_t size)
+{
+    rs_match_stats_t const *match = job ? rs_job_match_stats(job) : NULL;
+    rs_histograms_t const *hists = job ? rs_job_histograms(job) : NULL;
+    rs_mem_stats_t const *mem = job ? rs_job_mem_stats(job) : NULL;
+    rs_timing_t const *timing =
+        job && rs_supports_timing() ? rs_job_timing(job) : NULL;
+    size_t len = 0;
+    int p;
+
+    if (!size)
+        return buf;
+    buf[0] = '\0';
+    rs_json_printf(buf, size, &len, "{\"op\": \"%s\", ",
+                   stats->op ? stats->op : "noop");
+    rs_json_printf(buf, size, &len,
+                   "\"lit_cmds\": %d, \"lit_bytes\": " FMT_LONG
+                   ", \"lit_cmdbytes\": " FMT_LONG ", ", stats->lit_cmds,
+                   stats->lit_bytes, stats->lit_cmdbytes);
+    rs_json_printf(buf, size, &len,
+                   "\"copy_cmds\": " FMT_LONG ", \"copy_bytes\": " FMT_LONG
+                   ", \"copy_cmdbytes\": " FMT_LONG ", ", stats->copy_cmds,
+                   stats->copy_bytes, stats->copy_cmdbytes);
+    rs_json_printf(buf, size, &len,
+                   "\"sig_cmds\": " FMT_LONG ", \"sig_bytes\": " FMT_LONG
+                   ", \"sig_blocks\": " FMT_LONG ", \"block_len\": " FMT_SIZE
+                   ", ", stats->sig_cmds, stats->sig_bytes, stats->sig_blocks,
+                   stats->block_len);
+    rs_json_printf(buf, size, &len,
+                   "\"in_bytes\": " FMT_LONG ", \"out_bytes\": " FMT_LONG
+                   ", \"start\": %lld, \"end\": %lld, ", stats->in_bytes,
+                   stats->out_bytes, (long long)stats->start,
+                   (long long)stats->end);
+    rs_json_printf(buf, size, &len, "\"false_matches\": %d",
+                   stats->false_matches);
+    if (mem)
+        rs_json_printf(buf, size, &len,
+                       ", \"mem_bytes\": " FMT_LONG ", \"mem_peak\": "
+                       FMT_LONG, mem->bytes, mem->peak);
+    if (match)
+        rs_json_printf(buf, size, &len,
+                       ", \"match_searches\": " FMT_LONG ", \"match_hits\": "
+                       FMT_LONG ", \"match_probes\": " FMT_LONG
+                       ", \"weak_matches\": " FMT_LONG ", \"strong_sums\": "
+                       FMT_LONG, match->match_searches, match->match_hits,
+                       match->match_probes, match->weak_matches,
+                       match->strong_sums);
+    if (hists) {
+        rs_json_printf(buf, size, &len, ", \"histograms\": {");
+        rs_json_histogram(buf, size, &len, "copy_lens", &hists->copy_lens);
+        rs_json_printf(buf, size, &len, ", ");
+        rs_json_histogram(buf, size, &len, "lit_lens", &hists->lit_lens);
+        rs_json_printf(buf, size, &len, ", ");
+        rs_json_histogram(buf, size, &len, "probe_lens", &hists->probe_lens);
+        rs_json_printf(buf, size, &len, ", ");
+        rs_json_histogram(buf, size, &len, "match_gaps", &hists->match_gaps);
+        rs_json_printf(buf, size, &len, "}");
+    }
+    if (timing) {
+        rs_json_printf(buf, size, &len, ", \"timing\": {");
+        for (p = 0; p < RS_TIMING_PHASES; p++)
+            rs_json_printf(buf, size, &len,
+                           "\"%s\": {\"ns\": %llu, \"calls\": %llu}, ",
+                           rs_timing_phase_names[p],
+                           (unsigned long long)timing->ns[p],
+                           (unsigned long long)timing->calls[p]);
+        rs_json_printf(buf, size, &len,
+                       "\"total_ns\": %llu, \"elapsed_ns\": %llu}",
+                       (unsigned long long)timing->total_ns,
+                       (unsigned long long)timing->elapsed_ns);
+    }
+    rs_json_printf(buf, size, &len, "}");
+    return buf;
+}
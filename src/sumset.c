@@ -25,6 +25,7 @@
 #include <string.h>
 #include "librsync.h"
 #include "sumset.h"
+#include "timing.h"
 #include "trace.h"
 #include "util.h"
 
@@ -41,14 +42,34 @@ static inline unsigned rs_block_sig_hash(const rs_block_sig_t *sig)
     return (unsigned)sig->weak_sum;
 }
 
+/* Get the weak_sum used as the hashtable key for a CDC chunk.
+ *
+ * CDC chunks have no weak sum, so this uses the first bytes of the strong sum
+ * xor'ed with the chunk length. Matching strong sums with matching keys then
+ * also have matching lengths. */
+static inline rs_weak_sum_t rs_chunk_weak_sum(int strong_len,
+                                              rs_strong_sum_t *strong_sum,
+                                              size_t len)
+{
+    rs_weak_sum_t key = 0;
+
+    memcpy(&key, strong_sum,
+           strong_len < (int)sizeof(key) ? (size_t)strong_len : sizeof(key));
+    return key ^ (rs_weak_sum_t)len;
+}
+
 typedef struct rs_block_match {
     rs_block_sig_t block_sig;
-    rs_signature_t *signature;
+    const rs_signature_t *signature;
     const void *buf;
     size_t len;
+    rs_match_stats_t *stats;    /**< Where to count match stats, or NULL. */
+    rs_histogram_t *probe_lens; /**< Where to count probes, or NULL. */
+    rs_timing_t *timing;        /**< Where to time strong sums, or NULL. */
 } rs_block_match_t;
 
-static void rs_block_match_init(rs_block_match_t *match, rs_signature_t *sig,
+static void rs_block_match_init(rs_block_match_t *match,
+                                const rs_signature_t *sig,
                                 rs_weak_sum_t weak_sum,
                                 rs_strong_sum_t *strong_sum, const void *buf,
                                 size_t len)
@@ -58,24 +79,53 @@ static void rs_block_match_init(rs_block_match_t *match, rs_signature_t *sig,
     match->signature = sig;
     match->buf = buf;
     match->len = len;
+    match->stats = NULL;
+    match->probe_lens = NULL;
+    match->timing = NULL;
 }
 
-static inline int rs_block_match_cmp(rs_block_match_t *match,
-                                     const rs_block_sig_t *block_sig)
+static int rs_signature_basis_cmp(const rs_signature_t *sig,
+                                  const rs_block_sig_t *block_sig,
+                                  const void *buf, size_t len);
+
+static inline int rs_block_match_cmp_sums(rs_block_match_t *match,
+                                          const rs_block_sig_t *block_sig)
 {
+    /* If we have the basis, compare directly against it. */
+    if (match->signature->basis_cb)
+        return rs_signature_basis_cmp(match->signature, block_sig, match->buf,
+                                      match->len);
     /* If buf is not NULL, the strong sum is yet to be calculated. */
     if (match->buf) {
-#ifndef HASHTABLE_NSTATS
-        match->signature->calc_strong_count++;
-#endif
+        rs_timer_t timer;
+
+        if (match->stats)
+            match->stats->strong_sums++;
+        rs_timer_start(&timer, match->timing);
         rs_signature_calc_strong_sum(match->signature, match->buf, match->len,
                                      &(match->block_sig.strong_sum));
+        rs_timer_stop(&timer, match->timing, RS_TIMING_STRONGSUM);
         match->buf = NULL;
     }
     return memcmp(&match->block_sig.strong_sum, &block_sig->strong_sum,
                   (size_t)match->signature->strong_sum_len);
 }
 
+/** Compare a match against a block with the same weak sum, counting weak
+ * matches and false matches in the stats. */
+static inline int rs_block_match_cmp(rs_block_match_t *match,
+                                     const rs_block_sig_t *block_sig)
+{
+    int cmp = rs_block_match_cmp_sums(match, block_sig);
+
+    if (match->stats) {
+        match->stats->weak_matches++;
+        if (cmp)
+            match->stats->false_matches++;
+    }
+    return cmp;
+}
+
 /* Disable mix32() in the hashtable because RabinKarp doesn't need it. We
    manually apply mix32() to rollsums before using them in the hashtable. */
 #define HASHTABLE_NMIX32
@@ -110,6 +160,52 @@ static inline int rs_block_sig_idx(const rs_signature_t *sig,
                   (char *)sig->block_sigs) / rs_block_sig_size(sig));
 }
 
+/* Read len bytes at pos from the basis into buf. */
+static rs_result rs_signature_read_basis(const rs_signature_t *sig,
+                                         rs_long_t pos, void *buf, size_t len)
+{
+    rs_result result;
+    size_t n;
+    void *p;
+
+    while (len) {
+        n = len;
+        p = buf;
+        if ((result = sig->basis_cb(sig->basis_arg, pos, &n, &p)) != RS_DONE)
+            return result;
+        if (!n)
+            return RS_INPUT_ENDED;
+        if (p != buf)
+            memcpy(buf, p, n);
+        pos += (rs_long_t)n;
+        buf = (char *)buf + n;
+        len -= n;
+    }
+    return RS_DONE;
+}
+
+/* Compare data against a block in the basis, returning 0 if they match.
+
+   This reads the basis into the signature's basis_buf, so signatures with a
+   basis can't be used by multiple threads at once. */
+static int rs_signature_basis_cmp(const rs_signature_t *sig,
+                                  const rs_block_sig_t *block_sig,
+                                  const void *buf, size_t len)
+{
+    rs_long_t pos =
+        (rs_long_t)rs_block_sig_idx(sig, (rs_block_sig_t *)block_sig) *
+        sig->block_len;
+    rs_long_t block_len = sig->basis_size - pos;
+
+    if (block_len > sig->block_len)
+        block_len = sig->block_len;
+    if ((rs_long_t)len != block_len)
+        return 1;
+    if (rs_signature_read_basis(sig, pos, sig->basis_buf, len) != RS_DONE)
+        return 1;
+    return memcmp(sig->basis_buf, buf, len);
+}
+
 rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
                       size_t *block_len, size_t *strong_len)
 {
@@ -124,10 +220,14 @@ rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
     switch (*magic) {
     case RS_BLAKE2_SIG_MAGIC:
     case RS_RK_BLAKE2_SIG_MAGIC:
+    case RS_CDC_BLAKE2_SIG_MAGIC:
+    case RS_MR_BLAKE2_SIG_MAGIC:
         max_strong_len = RS_BLAKE2_SUM_LENGTH;
         break;
     case RS_MD4_SIG_MAGIC:
     case RS_RK_MD4_SIG_MAGIC:
+    case RS_CDC_MD4_SIG_MAGIC:
+    case RS_MR_MD4_SIG_MAGIC:
         max_strong_len = RS_MD4_SUM_LENGTH;
         break;
     default:
@@ -146,6 +246,12 @@ rs_result rs_sig_args(rs_long_t old_fsize, rs_magic_number * magic,
     }
     if (*block_len == 0)
         *block_len = rec_block_len;
+    /* Multi-resolution signatures need whole fine blocks in each block. */
+    if ((*magic & 0xf0) == 0x60 && *block_len % RS_MR_FINE_RATIO) {
+        rs_error("invalid block_len=" FMT_SIZE " for magic=%#x is not a "
+                 "multiple of %d", *block_len, (int)*magic, RS_MR_FINE_RATIO);
+        return RS_PARAM_ERROR;
+    }
     /* The recommended strong_len assumes the worst case new_fsize = old_fsize
        + 16MB with no matches. This results in comparing a block at every byte
        offset against all the blocks in the signature, or new_fsize*block_num
@@ -194,20 +300,106 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
     sig->block_len = (int)block_len;
     sig->strong_sum_len = (int)strong_len;
     sig->count = 0;
+    sig->mem.bytes = sig->mem.peak = 0;
+    rs_heap_init(&sig->heap, &sig->mem);
     /* Calculate the number of blocks if we have the signature file size. */
     /* Magic+header is 12 bytes, each block thereafter is 4 bytes
        weak_sum+strong_sum_len bytes */
     sig->size = (int)(sig_fsize < 12 ? 0 : (sig_fsize - 12) / (4 + strong_len));
+    /* Multi-resolution signatures have the fine blocks in a nested RabinKarp
+       signature, and only 1 in every RS_MR_FINE_RATIO+1 blocks are ours. */
+    if ((magic & 0xf0) == 0x60) {
+        sig->size /= RS_MR_FINE_RATIO + 1;
+        sig->fine = rs_alloc_struct(NULL, rs_signature_t);
+        rs_signature_init(sig->fine, magic - 0x20,
+                          block_len / RS_MR_FINE_RATIO, strong_len, sig_fsize);
+    } else {
+        sig->fine = NULL;
+    }
     if (sig->size)
         sig->block_sigs =
-            rs_alloc(sig->size * rs_block_sig_size(sig),
+            rs_alloc(&sig->heap, sig->size * rs_block_sig_size(sig),
                      "signature->block_sigs");
     else
         sig->block_sigs = NULL;
+    /* CDC signatures also need the chunk offsets. */
+    if (rs_signature_is_cdc(sig)) {
+        sig->chunk_offs =
+            rs_alloc(&sig->heap, (sig->size + 1) * sizeof(rs_long_t),
+                     "signature->chunk_offs");
+        sig->chunk_offs[0] = 0;
+    } else {
+        sig->chunk_offs = NULL;
+    }
     sig->hashtable = NULL;
-#ifndef HASHTABLE_NSTATS
-    sig->calc_strong_count = 0;
-#endif
+    sig->basis_cb = NULL;
+    sig->basis_arg = NULL;
+    sig->basis_size = 0;
+    sig->basis_buf = NULL;
+    sig->file_len = -1;
+    rs_signature_check(sig);
+    return RS_DONE;
+}
+
+rs_result rs_signature_init_basis(rs_signature_t *sig, size_t block_len,
+                                  rs_long_t basis_size, rs_copy_cb *basis_cb,
+                                  void *basis_arg)
+{
+    rs_magic_number magic = RS_RK_BLAKE2_SIG_MAGIC;
+    size_t strong_len = 0, buf_len, read_len, len, off;
+    rs_block_match_t m;
+    rs_block_sig_t *b;
+    rs_long_t pos;
+    rs_result result;
+    char *buf;
+
+    /* Get the recommended block_len for the basis size. */
+    if ((result =
+         rs_sig_args(basis_size, &magic, &block_len, &strong_len)) != RS_DONE)
+        return result;
+    if ((result =
+         rs_signature_init(sig, magic, block_len, strong_len, -1)) != RS_DONE)
+        return result;
+    sig->strong_sum_len = 0;
+    sig->basis_cb = basis_cb;
+    sig->basis_arg = basis_arg;
+    sig->basis_size = basis_size;
+    sig->basis_buf = rs_alloc(&sig->heap, block_len, "signature->basis_buf");
+    /* Preallocate all the block_sigs so they don't move after they are added
+       to the hashtable. */
+    sig->size = (int)((basis_size + (rs_long_t)block_len - 1) / block_len);
+    if (sig->size)
+        sig->block_sigs =
+            rs_alloc(&sig->heap, sig->size * rs_block_sig_size(sig),
+                     "signature->block_sigs");
+    sig->hashtable = hashtable_new(sig->size, &sig->heap);
+    /* Read the basis in 64K or one block sized chunks. */
+    buf_len = read_len =
+        block_len * (block_len < 65536 ? 65536 / block_len : 1);
+    buf = rs_alloc(&sig->heap, buf_len, "basis read buffer");
+    for (pos = 0; pos < basis_size; pos += (rs_long_t)read_len) {
+        if (basis_size - pos < (rs_long_t)read_len)
+            read_len = (size_t)(basis_size - pos);
+        if ((result =
+             rs_signature_read_basis(sig, pos, buf, read_len)) != RS_DONE)
+            break;
+        for (off = 0; off < read_len; off += len) {
+            len = read_len - off < block_len ? read_len - off : block_len;
+            b = rs_signature_add_block(sig,
+                                       rs_signature_calc_weak_sum(sig,
+                                                                  buf + off,
+                                                                  len), NULL);
+            rs_block_match_init(&m, sig, b->weak_sum, NULL, buf + off, len);
+            if (!hashtable_find(sig->hashtable, &m))
+                hashtable_add(sig->hashtable, b);
+        }
+    }
+    rs_free(&sig->heap, buf, buf_len);
+    if (result != RS_DONE) {
+        rs_signature_done(sig);
+        return result;
+    }
+    hashtable_stats_init(sig->hashtable);
     rs_signature_check(sig);
     return RS_DONE;
 }
@@ -215,7 +407,13 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
 void rs_signature_done(rs_signature_t *sig)
 {
     hashtable_free(sig->hashtable);
-    free(sig->block_sigs);
+    rs_free(&sig->heap, sig->block_sigs, sig->size * rs_block_sig_size(sig));
+    rs_free(&sig->heap, sig->basis_buf, (size_t)sig->block_len);
+    if (sig->chunk_offs)
+        rs_free(&sig->heap, sig->chunk_offs,
+                (sig->size + 1) * sizeof(rs_long_t));
+    if (sig->fine)
+        rs_free_sumset(sig->fine);
     rs_bzero(sig, sizeof(*sig));
 }
 
@@ -229,46 +427,223 @@ rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig,
         weak_sum = mix32(weak_sum);
     /* If block_sigs is full, allocate more space. */
     if (sig->count == sig->size) {
+        const size_t old_size = (size_t)sig->size;
+
         sig->size = sig->size ? sig->size * 2 : 16;
         sig->block_sigs =
-            rs_realloc(sig->block_sigs, sig->size * rs_block_sig_size(sig),
+            rs_realloc(&sig->heap, sig->block_sigs,
+                       old_size * rs_block_sig_size(sig),
+                       sig->size * rs_block_sig_size(sig),
                        "signature->block_sigs");
+        if (sig->chunk_offs)
+            sig->chunk_offs =
+                rs_realloc(&sig->heap, sig->chunk_offs,
+                           (old_size + 1) * sizeof(rs_long_t),
+                           (sig->size + 1) * sizeof(rs_long_t),
+                           "signature->chunk_offs");
     }
     rs_block_sig_t *b = rs_block_sig_ptr(sig, sig->count++);
     rs_block_sig_init(b, weak_sum, strong_sum, sig->strong_sum_len);
     return b;
 }
 
-rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
-                                  void const *buf, size_t len)
+rs_block_sig_t *rs_signature_add_chunk(rs_signature_t *sig, size_t len,
+                                       rs_strong_sum_t *strong_sum)
+{
+    rs_block_sig_t *b;
+
+    assert(rs_signature_is_cdc(sig));
+    b = rs_signature_add_block(sig,
+                               rs_chunk_weak_sum(sig->strong_sum_len,
+                                                 strong_sum, len), strong_sum);
+    sig->chunk_offs[sig->count] =
+        sig->chunk_offs[sig->count - 1] + (rs_long_t)len;
+    return b;
+}
+
+rs_weak_sum_t rs_signature_get_block(rs_signature_t const *sig, int idx,
+                                     void const **strong_sum)
+{
+    rs_block_sig_t *b;
+
+    assert(0 <= idx && idx < sig->count);
+    b = rs_block_sig_ptr(sig, idx);
+    *strong_sum = b->strong_sum;
+    if (rs_signature_weaksum_kind(sig) == RS_ROLLSUM)
+        return unmix32(b->weak_sum);
+    return b->weak_sum;
+}
+
+/* Check if the block at an offset also matches a found block_sig. */
+static inline int rs_signature_same_block(const rs_signature_t *sig,
+                                          rs_long_t pos,
+                                          const rs_block_sig_t *block_sig,
+                                          rs_block_match_t *match)
+{
+    rs_block_sig_t *b;
+
+    if (pos < 0 || pos % sig->block_len
+        || pos / sig->block_len >= sig->count)
+        return 0;
+    b = rs_block_sig_ptr(sig, (int)(pos / sig->block_len));
+    return b == block_sig || (b->weak_sum == block_sig->weak_sum
+                              && !rs_block_match_cmp(match, b));
+}
+
+/** Find the first block in the hashtable matching \p m, adding the search to
+ * its stats.
+ *
+ * This doesn't modify the signature, so multiple threads can search the same
+ * signature at once. */
+static inline rs_block_sig_t *rs_signature_find_block(const rs_signature_t
+                                                      *sig,
+                                                      rs_block_match_t *m)
+{
+    hashtable_stats_t s = { 0, 0, 0, 0 };
+    rs_block_sig_t *b;
+
+    b = hashtable_find_r(sig->hashtable, m, &s);
+    if (m->stats) {
+        m->stats->match_searches++;
+        if (b)
+            m->stats->match_hits++;
+        m->stats->match_probes += s.hashcmp_count;
+    }
+    if (m->probe_lens)
+        rs_histogram_add(m->probe_lens, s.hashcmp_count);
+    return b;
+}
+
+rs_long_t rs_signature_find_match(const rs_signature_t *sig,
+                                  rs_weak_sum_t weak_sum, void const *buf,
+                                  size_t len)
+{
+    return rs_signature_find_match_near(sig, weak_sum, buf, len, -1, -1,
+                                        NULL, NULL, NULL);
+}
+
+rs_long_t rs_signature_find_match_near(const rs_signature_t *sig,
+                                       rs_weak_sum_t weak_sum, void const *buf,
+                                       size_t len, rs_long_t pos1,
+                                       rs_long_t pos2,
+                                       rs_match_stats_t *stats,
+                                       rs_histogram_t *probe_lens,
+                                       rs_timing_t *timing)
 {
     rs_block_match_t m;
     rs_block_sig_t *b;
 
     rs_signature_check(sig);
     rs_block_match_init(&m, sig, weak_sum, NULL, buf, len);
-    if ((b = hashtable_find(sig->hashtable, &m))) {
+    m.stats = stats;
+    m.probe_lens = probe_lens;
+    m.timing = timing;
+    b = rs_signature_find_block(sig, &m);
+    if (b) {
+        /* The hashtable only has the first of any duplicate blocks, so check
+           if the preferred offsets also match. With strong sums the match
+           has its strong sum calculated now so this only compares sums. */
+        if (rs_signature_same_block(sig, pos1, b, &m))
+            return pos1;
+        if (rs_signature_same_block(sig, pos2, b, &m))
+            return pos2;
         return (rs_long_t)rs_block_sig_idx(sig, b) * sig->block_len;
     }
     return -1;
 }
 
+rs_long_t rs_signature_find_chunk(const rs_signature_t *sig,
+                                  void const *buf, size_t len,
+                                  rs_match_stats_t *stats,
+                                  rs_histogram_t *probe_lens,
+                                  rs_timing_t *timing)
+{
+    rs_strong_sum_t strong_sum;
+    rs_block_match_t m;
+    rs_block_sig_t *b;
+    rs_timer_t timer;
+
+    rs_signature_check(sig);
+    assert(rs_signature_is_cdc(sig));
+    /* Chunks are only looked up at boundaries so the strong sum is always
+       calculated up front. */
+    if (stats)
+        stats->strong_sums++;
+    rs_timer_start(&timer, timing);
+    rs_signature_calc_strong_sum(sig, buf, len, &strong_sum);
+    rs_timer_stop(&timer, timing, RS_TIMING_STRONGSUM);
+    rs_block_match_init(&m, sig,
+                        rs_chunk_weak_sum(sig->strong_sum_len, &strong_sum,
+                                          len), &strong_sum, NULL, 0);
+    m.stats = stats;
+    m.probe_lens = probe_lens;
+    if ((b = rs_signature_find_block(sig, &m)))
+        return sig->chunk_offs[rs_block_sig_idx(sig, b)];
+    return -1;
+}
+
+void rs_signature_mem_stats(rs_signature_t const *sig, rs_mem_stats_t *stats)
+{
+    rs_signature_check(sig);
+    *stats = sig->mem;
+    if (sig->fine) {
+        /* The fine signature's peak may not be at the same time, so the sum
+           of the peaks is an upper bound. */
+        stats->bytes += sig->fine->mem.bytes;
+        stats->peak += sig->fine->mem.peak;
+    }
+}
+
 void rs_signature_log_stats(rs_signature_t const *sig)
 {
-#ifndef HASHTABLE_NSTATS
-    hashtable_t *t = sig->hashtable;
+    rs_hashtable_stats_t s;
+    rs_mem_stats_t m;
 
+    /* Searches don't modify the signature, so their stats are counted in the
+       rs_stats_t of each delta job instead. */
+    if (rs_signature_hashtable_stats(sig, &s) == RS_DONE)
+        rs_log(RS_LOG_INFO | RS_LOG_NONAME,
+               "hashtable statistics: signature[%d blocks, %d unique "
+               "blocks, %d buckets (%.3f%% full)] probes[%.2f per hit, %.2f "
+               "per miss] dups[%d weak sums shared by %d blocks, max %d] "
+               "bloom[%.3f%% false positives]", s.blocks, s.unique_blocks,
+               s.buckets, 100.0 * s.load_factor, s.hit_probes_mean,
+               s.miss_probes_mean, s.dup_weak_sums, s.dup_weak_blocks,
+               s.dup_weak_max, 100.0 * s.bloom_fp_rate);
+    rs_signature_mem_stats(sig, &m);
     rs_log(RS_LOG_INFO | RS_LOG_NONAME,
-           "match statistics: signature[%ld searches, %ld (%.3f%%) matches, "
-           "%ld (%.3fx) weak sum compares, %ld (%.3f%%) strong sum compares, "
-           "%ld (%.3f%%) strong sum calcs]", t->find_count, t->match_count,
-           100.0 * (double)t->match_count / (double)t->find_count,
-           t->hashcmp_count, (double)t->hashcmp_count / (double)t->find_count,
-           t->entrycmp_count,
-           100.0 * (double)t->entrycmp_count / (double)t->find_count,
-           sig->calc_strong_count,
-           100.0 * (double)sig->calc_strong_count / (double)t->find_count);
-#endif
+           "signature memory: mem[" FMT_LONG " bytes, " FMT_LONG " peak]",
+           m.bytes, m.peak);
+}
+
+rs_result rs_signature_hashtable_stats(rs_signature_t const *sig,
+                                       rs_hashtable_stats_t *stats)
+{
+    hashtable_layout_t layout;
+    int i;
+
+    rs_signature_check(sig);
+    if (!sig->hashtable)
+        return RS_PARAM_ERROR;
+    assert(RS_HASHTABLE_PROBES == HASHTABLE_PROBES);
+    hashtable_layout(sig->hashtable, &layout);
+    stats->blocks = sig->count;
+    stats->unique_blocks = layout.count;
+    stats->buckets = layout.size;
+    stats->load_factor = (double)layout.count / (double)layout.size;
+    stats->dup_weak_blocks = layout.dup_count;
+    stats->dup_weak_sums = layout.dup_clusters;
+    stats->dup_weak_max = layout.dup_max;
+    for (i = 0; i < RS_HASHTABLE_PROBES; i++) {
+        stats->hit_probes[i] = layout.hit_probes[i];
+        stats->miss_probes[i] = layout.miss_probes[i];
+    }
+    stats->hit_probes_mean = layout.count ?
+        (double)layout.hit_probes_sum / (double)layout.count : 0.0;
+    stats->miss_probes_mean =
+        (double)layout.miss_probes_sum / (double)layout.size;
+    stats->bloom_fp_rate = (double)layout.bloom_bits / (double)layout.size;
+    return RS_DONE;
 }
 
 rs_result rs_build_hash_table(rs_signature_t *sig)
@@ -278,9 +653,9 @@ rs_result rs_build_hash_table(rs_signature_t *sig)
     int i;
 
     rs_signature_check(sig);
-    sig->hashtable = hashtable_new(sig->count);
-    if (!sig->hashtable)
+    if (sig->fine && (rs_build_hash_table(sig->fine) != RS_DONE))
         return RS_MEM_ERROR;
+    sig->hashtable = hashtable_new(sig->count, &sig->heap);
     for (i = 0; i < sig->count; i++) {
         b = rs_block_sig_ptr(sig, i);
         rs_block_match_init(&m, sig, b->weak_sum, &b->strong_sum, NULL, 0);
@@ -293,8 +668,11 @@ rs_result rs_build_hash_table(rs_signature_t *sig)
 
 void rs_free_sumset(rs_signature_t *psums)
 {
+    rs_heap_t heap = psums->heap;
+
     rs_signature_done(psums);
-    free(psums);
+    heap.mem = NULL;
+    rs_free(&heap, psums, sizeof *psums);
 }
 
 void rs_sumset_dump(rs_signature_t const *sums)
@@ -30,6 +30,12 @@
 #  include "hashtable.h"
 #  include "checksum.h"
 #  include "librsync.h"
+#  include "probes.h"
+#  include "util.h"
+
+/** The ratio of block_len to the fine block_len for multi-resolution
+ * signatures. */
+#  define RS_MR_FINE_RATIO 8
 
 /** Signature of a single block. */
 typedef struct rs_block_sig {
@@ -40,7 +46,11 @@ typedef struct rs_block_sig {
 /** Signature of a whole file.
  *
  * This includes the all the block sums generated for a file and datastructures
- * for fast matching against them. */
+ * for fast matching against them. After rs_build_hash_table() it is not
+ * modified by searches, which take the stats and timing to update as
+ * arguments, so it can be shared by delta jobs in multiple threads. The
+ * exception is signatures from rs_signature_init_basis(), which read the basis
+ * into basis_buf to verify matches. */
 struct rs_signature {
     int magic;                  /**< The signature magic value. */
     int block_len;              /**< The block length. */
@@ -49,10 +59,19 @@ struct rs_signature {
     int size;                   /**< Total number of blocks allocated. */
     void *block_sigs;           /**< The packed block_sigs for all blocks. */
     hashtable_t *hashtable;     /**< The hashtable for finding matches. */
-    /* The is extra stats not included in the hashtable stats. */
-#  ifndef HASHTABLE_NSTATS
-    long calc_strong_count;     /**< The count of strongsum calcs done. */
-#  endif
+    /* The basis for verifying matches by direct compare instead of strong
+       sums, used by local deltas without a strong sum. */
+    rs_copy_cb *basis_cb;       /**< Callback for reading the basis or NULL. */
+    void *basis_arg;            /**< The basis_cb argument. */
+    rs_long_t basis_size;       /**< The size of the basis. */
+    void *basis_buf;            /**< Buffer for reading basis blocks. */
+    rs_long_t *chunk_offs;      /**< CDC chunk offsets with count+1 entries. */
+    rs_mem_stats_t mem;         /**< Memory allocated for the signature. */
+    rs_heap_t heap;             /**< Where the signature allocates from. */
+    rs_signature_t *fine;       /**< The multi-resolution fine signature. */
+    rs_long_t file_len;         /**< The whole file length or -1. */
+    /** The whole file BLAKE2 digest if file_len is set. */
+    rs_byte_t file_digest[RS_MAX_STRONG_SUM_LENGTH];
 };
 
 /** Initialize an rs_signature instance.
@@ -73,6 +92,29 @@ rs_result rs_signature_init(rs_signature_t *sig, rs_magic_number magic,
                             size_t block_len, size_t strong_len,
                             rs_long_t sig_fsize);
 
+/** Initialize an rs_signature instance from a local basis.
+ *
+ * This reads the basis to calculate its weak sums and builds the hashtable.
+ * It has no strong sums, and matches are verified by comparing directly
+ * against the basis using basis_cb, so the basis must remain readable while
+ * the signature is used.
+ *
+ * \param *sig the signature to initialize.
+ *
+ * \param block_len - the block length to use (0 for "recommended").
+ *
+ * \param basis_size - the size of the basis.
+ *
+ * \param basis_cb - the callback for reading the basis.
+ *
+ * \param basis_arg - the argument for basis_cb.
+ *
+ * \return RS_DONE on success, otherwise an error with the signature already
+ * destroyed. */
+rs_result rs_signature_init_basis(rs_signature_t *sig, size_t block_len,
+                                  rs_long_t basis_size, rs_copy_cb *basis_cb,
+                                  void *basis_arg);
+
 /** Destroy an rs_signature instance. */
 void rs_signature_done(rs_signature_t *sig);
 
@@ -81,9 +123,52 @@ rs_block_sig_t *rs_signature_add_block(rs_signature_t *sig,
                                        rs_weak_sum_t weak_sum,
                                        rs_strong_sum_t *strong_sum);
 
+/** Add a content defined chunk to a CDC rs_signature instance. */
+rs_block_sig_t *rs_signature_add_chunk(rs_signature_t *sig, size_t len,
+                                       rs_strong_sum_t *strong_sum);
+
+/** Find a matching chunk offset in a CDC signature.
+ *
+ * This calculates the strong sum of the chunk and looks it up, returning the
+ * offset of the matching chunk or -1 if there is no match. The match
+ * statistics are added to \p stats, the hashtable probes to \p probe_lens,
+ * and the strong sum is timed in \p timing if they are not NULL. */
+rs_long_t rs_signature_find_chunk(const rs_signature_t *sig,
+                                  void const *buf, size_t len,
+                                  rs_match_stats_t *stats,
+                                  rs_histogram_t *probe_lens,
+                                  rs_timing_t *timing);
+
+/** Get the sums of a block as they were added to a signature.
+ *
+ * This undoes the mix32() applied to rollsum weak sums by
+ * rs_signature_add_block(), returning the weak sum and setting strong_sum to
+ * point at the strong sum. */
+rs_weak_sum_t rs_signature_get_block(rs_signature_t const *sig, int idx,
+                                     void const **strong_sum);
+
 /** Find a matching block offset in a signature. */
-rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
-                                  void const *buf, size_t len);
+rs_long_t rs_signature_find_match(const rs_signature_t *sig,
+                                  rs_weak_sum_t weak_sum, void const *buf,
+                                  size_t len);
+
+/** Find a matching block offset in a signature preferring some offsets.
+ *
+ * If the block matches and there are duplicate matching blocks, this returns
+ * pos1 or pos2 in that order of preference if they are one of the duplicates.
+ * Otherwise it returns the first matching block like
+ * rs_signature_find_match(). Use -1 for pos1 or pos2 to not prefer any
+ * offset. This only costs extra compares of the already calculated sums.
+ * The match statistics are added to \p stats, the hashtable probes to \p
+ * probe_lens, and strong sums calculated to check weak sum matches are timed
+ * in \p timing if they are not NULL. */
+rs_long_t rs_signature_find_match_near(const rs_signature_t *sig,
+                                       rs_weak_sum_t weak_sum, void const *buf,
+                                       size_t len, rs_long_t pos1,
+                                       rs_long_t pos2,
+                                       rs_match_stats_t *stats,
+                                       rs_histogram_t *probe_lens,
+                                       rs_timing_t *timing);
 
 /** Assert that rs_sig_args() args for rs_signature_init() are valid.
  *
@@ -91,7 +176,8 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
  * points at where rs_sig_args_check() was called from. */
 #  define rs_sig_args_check(magic, block_len, strong_len) do {\
     assert(((magic) & ~0xff) == (RS_MD4_SIG_MAGIC & ~0xff));\
-    assert(((magic) & 0xf0) == 0x30 || ((magic) & 0xf0) == 0x40);\
+    assert(((magic) & 0xf0) == 0x30 || ((magic) & 0xf0) == 0x40 ||\
+	   ((magic) & 0xf0) == 0x50 || ((magic) & 0xf0) == 0x60);\
     assert((((magic) & 0x0f) == 0x06 &&\
 	    (int)(strong_len) <= RS_MD4_SUM_LENGTH) ||\
 	   (((magic) & 0x0f) == 0x07 &&\
@@ -105,11 +191,20 @@ rs_long_t rs_signature_find_match(rs_signature_t *sig, rs_weak_sum_t weak_sum,
  * We don't use a static inline function here so that assert failure output
  * points at where rs_signature_check() was called from. */
 #  define rs_signature_check(sig) do {\
-    rs_sig_args_check((sig)->magic, (sig)->block_len, (sig)->strong_sum_len);\
+    assert(!(sig)->basis_cb || (sig)->strong_sum_len == 0);\
+    rs_sig_args_check((sig)->magic, (sig)->block_len,\
+                      (sig)->basis_cb ? 1 : (sig)->strong_sum_len);\
     assert(0 <= (sig)->count && (sig)->count <= (sig)->size);\
     assert(!(sig)->hashtable || (sig)->hashtable->count <= (sig)->count);\
+    assert(!(sig)->fine || (sig)->fine->count <= (sig)->count * RS_MR_FINE_RATIO);\
 } while (0)
 
+/** Check if a signature uses content defined chunks. */
+static inline int rs_signature_is_cdc(rs_signature_t const *sig)
+{
+    return (sig->magic & 0xf0) == 0x50;
+}
+
 /** Get the weaksum kind for a signature. */
 static inline weaksum_kind_t rs_signature_weaksum_kind(rs_signature_t const
                                                        *sig)
@@ -137,6 +232,7 @@ static inline void rs_signature_calc_strong_sum(rs_signature_t const *sig,
                                                 void const *buf, size_t len,
                                                 rs_strong_sum_t *sum)
 {
+    rs_probe2(strong_sum, sig, len);
     rs_calc_strong_sum(rs_signature_strongsum_kind(sig), buf, len, sum);
 }
 
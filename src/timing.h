@@ -0,0 +1,81 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * librsync -- library for network deltas
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file timing.h
+ * Timing the phases of jobs.
+ *
+ * A phase is timed by starting an ::rs_timer_t before it and stopping it
+ * after it. Timers can be nested, and the time of any phases stopped while a
+ * timer is running is subtracted from its phase, so each phase only gets the
+ * time spent directly in it.
+ *
+ * Unless librsync is built with DO_RS_TIMING these all compile to nothing.
+ *
+ * \sa ::rs_timing_t */
+#ifndef TIMING_H
+#  define TIMING_H
+
+#  include <stdint.h>
+#  include "librsync.h"
+
+/** A running timer for a phase. */
+typedef struct rs_timer {
+    uint64_t start;             /**< The time the timer was started. */
+    uint64_t nested;            /**< The total_ns when it was started. */
+} rs_timer_t;
+
+/** Get the monotonic time in ns.
+ *
+ * This is in util.c so it is available wherever timers are used. */
+uint64_t rs_timing_now(void);
+
+/** Start a timer for \p timing, which can be NULL to not time anything. */
+static inline void rs_timer_start(rs_timer_t *timer, rs_timing_t *timing)
+{
+#  ifdef DO_RS_TIMING
+    timer->nested = timing ? timing->total_ns : 0;
+    timer->start = timing ? rs_timing_now() : 0;
+#  else
+    (void)timer;
+    (void)timing;
+#  endif
+}
+
+/** Stop a timer, adding the time since it started to \p phase. */
+static inline void rs_timer_stop(rs_timer_t *timer, rs_timing_t *timing,
+                                 rs_timing_phase phase)
+{
+#  ifdef DO_RS_TIMING
+    uint64_t ns;
+
+    if (timing) {
+        ns = rs_timing_now() - timer->start - (timing->total_ns -
+                                               timer->nested);
+        timing->ns[phase] += ns;
+        timing->calls[phase]++;
+        timing->total_ns += ns;
+    }
+#  else
+    (void)timer;
+    (void)timing;
+    (void)phase;
+#  endif
+}
+
+#endif                          /* !TIMING_H */
@@ -58,6 +58,7 @@
 #include "librsync.h"
 #include "job.h"
 #include "scoop.h"
+#include "timing.h"
 #include "trace.h"
 
 static void rs_tube_catchup_write(rs_job_t *job)
@@ -119,23 +120,31 @@ static void rs_tube_catchup_copy(rs_job_t *job)
  * command, RS_BLOCKED if there is still stuff waiting to go out. */
 rs_result rs_tube_catchup(rs_job_t *job)
 {
+    rs_result result = RS_DONE;
+    rs_timer_t timer;
+
+    if (rs_tube_is_idle(job))
+        return RS_DONE;
+    rs_timer_start(&timer, &job->timing);
     if (job->write_len) {
         rs_tube_catchup_write(job);
         if (job->write_len)
-            return RS_BLOCKED;
+            result = RS_BLOCKED;
     }
 
-    if (job->copy_len) {
+    if (result == RS_DONE && job->copy_len) {
         rs_tube_catchup_copy(job);
         if (job->copy_len) {
             if (rs_scoop_eof(job)) {
                 rs_error("reached end of file while copying data");
-                return RS_INPUT_ENDED;
+                result = RS_INPUT_ENDED;
+            } else {
+                result = RS_BLOCKED;
             }
-            return RS_BLOCKED;
         }
     }
-    return RS_DONE;
+    rs_timer_stop(&timer, &job->timing, RS_TIMING_DRAIN);
+    return result;
 }
 
 /* Check whether there is data in the tube waiting to go out.
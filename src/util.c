@@ -26,8 +26,14 @@
 #include "config.h"             /* IWYU pragma: keep */
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#  include <windows.h>
+#endif
 #include "librsync.h"
+#include "arena.h"
 #include "util.h"
+#include "timing.h"
 #include "trace.h"
 
 void rs_bzero(void *buf, size_t size)
@@ -35,38 +41,120 @@ void rs_bzero(void *buf, size_t size)
     memset(buf, 0, size);
 }
 
-void *rs_alloc_struct0(size_t size, char const *name)
+static void *rs_malloc_alloc(void *opaque, size_t size)
 {
-    void *p;
+    (void)opaque;
+    return malloc(size);
+}
 
-    if (!(p = malloc(size))) {
-        rs_fatal("couldn't allocate instance of %s", name);
+static void *rs_malloc_realloc(void *opaque, void *ptr, size_t old_size,
+                               size_t size)
+{
+    (void)opaque;
+    (void)old_size;
+    return realloc(ptr, size);
+}
+
+static void rs_malloc_free(void *opaque, void *ptr, size_t size)
+{
+    (void)opaque;
+    (void)size;
+    free(ptr);
+}
+
+/** The default allocator using malloc(). */
+static rs_allocator_t const rs_malloc_allocator = {
+    rs_malloc_alloc, rs_malloc_realloc, rs_malloc_free, NULL
+};
+
+/** The allocator set for the thread, or NULL for rs_malloc_allocator. */
+static RS_THREAD_LOCAL rs_allocator_t const *rs_thread_allocator = NULL;
+
+rs_allocator_t const *rs_set_allocator(rs_allocator_t const *allocator)
+{
+    rs_allocator_t const *prev = rs_thread_allocator;
+
+    rs_thread_allocator = allocator;
+    return prev;
+}
+
+rs_allocator_t const *rs_get_allocator(void)
+{
+    return rs_thread_allocator ? rs_thread_allocator : &rs_malloc_allocator;
+}
+
+void rs_heap_init(rs_heap_t *heap, rs_mem_stats_t *mem)
+{
+    heap->allocator = rs_get_allocator();
+    heap->arena = NULL;
+    heap->mem = mem;
+}
+
+void rs_heap_done(rs_heap_t *heap)
+{
+    if (heap->arena) {
+        rs_arena_free(heap->arena);
+        heap->arena = NULL;
     }
+}
+
+void *rs_alloc_struct0(rs_heap_t *heap, size_t size, char const *name)
+{
+    void *p = rs_alloc(heap, size, name);
+
     rs_bzero(p, size);
     return p;
 }
 
-void *rs_alloc(size_t size, char const *name)
+void *rs_alloc(rs_heap_t *heap, size_t size, char const *name)
 {
+    rs_allocator_t const *a = heap ? heap->allocator : rs_get_allocator();
     void *p;
 
-    if (!(p = malloc(size))) {
+    /* Arenas count their chunks instead of each allocation. */
+    if (heap && heap->arena)
+        return rs_arena_alloc(heap->arena, size);
+    if (!(p = a->alloc(a->opaque, size))) {
         rs_fatal("couldn't allocate instance of %s", name);
     }
-
+    if (heap)
+        rs_mem_add(heap->mem, (rs_long_t)size);
     return p;
 }
 
-void *rs_realloc(void *ptr, size_t size, char const *name)
+void *rs_realloc(rs_heap_t *heap, void *ptr, size_t old_size, size_t size,
+                 char const *name)
 {
+    rs_allocator_t const *a = heap ? heap->allocator : rs_get_allocator();
     void *p;
 
-    if (!(p = realloc(ptr, size))) {
+    if (heap && heap->arena)
+        return rs_arena_realloc(heap->arena, ptr, old_size, size);
+    if (!ptr)
+        old_size = 0;
+    if (!(p = a->realloc(a->opaque, ptr, old_size, size))) {
         rs_fatal("couldn't reallocate instance of %s", name);
     }
+    if (heap)
+        rs_mem_add(heap->mem, (rs_long_t)size - (rs_long_t)old_size);
     return p;
 }
 
+void rs_free(rs_heap_t *heap, void *ptr, size_t size)
+{
+    rs_allocator_t const *a = heap ? heap->allocator : rs_get_allocator();
+
+    if (!ptr)
+        return;
+    if (heap && heap->arena) {
+        rs_arena_release(heap->arena, ptr);
+        return;
+    }
+    a->free(a->opaque, ptr, size);
+    if (heap)
+        rs_mem_add(heap->mem, -(rs_long_t)size);
+}
+
 int rs_long_ln2(rs_long_t v)
 {
     int n;
@@ -92,3 +180,23 @@ int rs_long_sqrt(rs_long_t v)
     }
     return (int)n;
 }
+
+uint64_t rs_timing_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME)
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#elif defined(_WIN32)
+    LARGE_INTEGER count, freq;
+
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(count.QuadPart / freq.QuadPart * 1000000000 +
+                      count.QuadPart % freq.QuadPart * 1000000000 /
+                      freq.QuadPart);
+#else
+    return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
@@ -28,18 +28,76 @@
 #  include <stddef.h>
 #  include "librsync.h"
 
-void *rs_alloc(size_t size, char const *name);
-void *rs_realloc(void *ptr, size_t size, char const *name);
-void *rs_alloc_struct0(size_t size, char const *name);
+/* Thread local storage for per-thread settings like rs_set_allocator(), or
+   process-wide storage if it isn't supported. */
+#  if defined(__GNUC__)
+#    define RS_THREAD_LOCAL __thread
+#  elif defined(_MSC_VER)
+#    define RS_THREAD_LOCAL __declspec(thread)
+#  elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#    define RS_THREAD_LOCAL _Thread_local
+#  else
+#    define RS_THREAD_LOCAL
+#  endif
+
+typedef struct rs_arena rs_arena_t;
+
+/** Where a job or signature allocates its memory from. */
+typedef struct rs_heap {
+    rs_allocator_t const *allocator;    /**< The allocator it was created
+                                         * with. */
+    rs_arena_t *arena;          /**< The job's arena, or NULL. */
+    rs_mem_stats_t *mem;        /**< Where to count its memory, or NULL. */
+} rs_heap_t;
+
+/** Initialize a heap with the calling thread's allocator. */
+void rs_heap_init(rs_heap_t *heap, rs_mem_stats_t *mem);
+
+/** Free a heap's arena if it has one. */
+void rs_heap_done(rs_heap_t *heap);
+
+/** Get the calling thread's allocator set by rs_set_allocator(). */
+rs_allocator_t const *rs_get_allocator(void);
+
+/* Memory allocation. Allocations come from the heap of the job or signature
+   they are for and are counted in its ::rs_mem_stats_t, or come from the
+   calling thread's allocator and are not counted if heap is NULL. Frees and
+   reallocs need the size that was allocated. */
+void *rs_alloc(rs_heap_t *heap, size_t size, char const *name);
+void *rs_realloc(rs_heap_t *heap, void *ptr, size_t old_size, size_t size,
+                 char const *name);
+void *rs_alloc_struct0(rs_heap_t *heap, size_t size, char const *name);
+void rs_free(rs_heap_t *heap, void *ptr, size_t size);
 
 void rs_bzero(void *buf, size_t size);
 
 int rs_long_ln2(rs_long_t v);
 int rs_long_sqrt(rs_long_t v);
 
+/** Add a value to a histogram. */
+static inline void rs_histogram_add(rs_histogram_t *hist, rs_long_t v)
+{
+    int i;
+
+    /* Count the bits in v, capped at the last bucket. */
+    for (i = 0; v > 0 && i < RS_HISTOGRAM_BUCKETS - 1; i++)
+        v >>= 1;
+    hist->count[i]++;
+}
+
+/** Add to the bytes allocated for a job or signature, updating its peak. */
+static inline void rs_mem_add(rs_mem_stats_t *mem, rs_long_t size)
+{
+    if (mem) {
+        mem->bytes += size;
+        if (mem->bytes > mem->peak)
+            mem->peak = mem->bytes;
+    }
+}
+
 /** Allocate and zero-fill an instance of TYPE. */
-#  define rs_alloc_struct(type)				\
-        ((type *) rs_alloc_struct0(sizeof(type), #type))
+#  define rs_alloc_struct(heap, type) \
+        ((type *) rs_alloc_struct0(heap, sizeof(type), #type))
 
 #  ifdef __GNUC__
 #    define UNUSED(x) x __attribute__((unused))
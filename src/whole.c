@@ -29,19 +29,39 @@
 
 #include "config.h"             /* IWYU pragma: keep */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "librsync.h"
 #include "whole.h"
 #include "sumset.h"
 #include "job.h"
 #include "buf.h"
+#include "trace.h"
+#include "util.h"
 #include "librsync_export.h"
 
+/** The buffer size for hashing whole files. */
+#define RS_DIGEST_BUF_LEN (64 * 1024)
+
 /** Whole file IO buffer sizes. */
 LIBRSYNC_EXPORT int rs_inbuflen = 0, rs_outbuflen = 0;
 
+/** Whole file progress callback set by rs_whole_set_progress_cb() for the
+ * thread. */
+static RS_THREAD_LOCAL rs_progress_cb *rs_whole_progress_cb = NULL;
+static RS_THREAD_LOCAL void *rs_whole_progress_arg = NULL;
+static RS_THREAD_LOCAL rs_long_t rs_whole_progress_interval = 0;
+
+void rs_whole_set_progress_cb(rs_long_t interval, rs_progress_cb *cb,
+                              void *arg)
+{
+    rs_whole_progress_interval = interval;
+    rs_whole_progress_cb = cb;
+    rs_whole_progress_arg = arg;
+}
+
 rs_result rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file,
-                       int inbuflen, int outbuflen)
+                       int inbuflen, int outbuflen, int flags)
 {
     rs_buffers_t buf;
     rs_result result;
@@ -50,13 +70,27 @@ rs_result rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file,
     /* Override buffer sizes if rs_inbuflen or rs_outbuflen are set. */
     inbuflen = rs_inbuflen ? rs_inbuflen : inbuflen;
     outbuflen = rs_outbuflen ? rs_outbuflen : outbuflen;
+    if (rs_whole_progress_cb)
+        rs_job_set_progress_cb(job, rs_whole_progress_interval,
+                               rs_whole_progress_cb, rs_whole_progress_arg);
     if (in_file)
-        in_fb = rs_filebuf_new(in_file, inbuflen);
-    if (out_file)
-        out_fb = rs_filebuf_new(out_file, outbuflen);
+        in_fb = rs_filebuf_new(in_file, inbuflen, &job->heap);
+    if (out_file) {
+        out_fb = rs_filebuf_new(out_file, outbuflen, &job->heap);
+        if (flags & RS_WHOLE_INPLACE) {
+            /* The copy_cb reads the basis through the output filebuf. */
+            rs_filebuf_set_inplace(out_fb, job);
+            job->copy_arg = out_fb;
+        } else if ((flags & RS_WHOLE_SPARSE) && rs_file_size(out_file) >= 0) {
+            /* Sparse output needs to seek, so only use it for regular files. */
+            rs_filebuf_set_sparse(out_fb);
+        }
+    }
     result =
         rs_job_drive(job, &buf, in_fb ? rs_infilebuf_fill : NULL, in_fb,
                      out_fb ? rs_outfilebuf_drain : NULL, out_fb);
+    if (result == RS_DONE && out_fb)
+        result = rs_outfilebuf_flush(out_fb);
     if (in_fb)
         rs_filebuf_free(in_fb);
     if (out_fb)
@@ -67,6 +101,14 @@ rs_result rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file,
 rs_result rs_sig_file(FILE *old_file, FILE *sig_file, size_t block_len,
                       size_t strong_len, rs_magic_number sig_magic,
                       rs_stats_t *stats)
+{
+    return rs_sig_file_flags(old_file, sig_file, block_len, strong_len,
+                             sig_magic, 0, stats);
+}
+
+rs_result rs_sig_file_flags(FILE *old_file, FILE *sig_file, size_t block_len,
+                            size_t strong_len, rs_magic_number sig_magic,
+                            int flags, rs_stats_t *stats)
 {
     rs_job_t *job;
     rs_result r;
@@ -76,10 +118,10 @@ rs_result rs_sig_file(FILE *old_file, FILE *sig_file, size_t block_len,
          rs_sig_args(old_fsize, &sig_magic, &block_len,
                      &strong_len)) != RS_DONE)
         return r;
-    job = rs_sig_begin(block_len, strong_len, sig_magic);
+    job = rs_sig_begin_flags(block_len, strong_len, sig_magic, flags);
     /* Size inbuf for 4 blocks, outbuf for header + 4 blocksums. */
     r = rs_whole_run(job, old_file, sig_file, 4 * (int)block_len,
-                     12 + 4 * (4 + (int)strong_len));
+                     12 + 4 * (4 + (int)strong_len), 0);
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
     rs_job_free(job);
@@ -97,7 +139,7 @@ rs_result rs_loadsig_file(FILE *sig_file, rs_signature_t **sumset,
     /* Set filesize used to estimate signature size. */
     job->sig_fsize = rs_file_size(sig_file);
     /* Size inbuf for 1024x 16 byte blocksums. */
-    r = rs_whole_run(job, sig_file, NULL, 1024 * 16, 0);
+    r = rs_whole_run(job, sig_file, NULL, 1024 * 16, 0, 0);
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
     rs_job_free(job);
@@ -108,29 +150,209 @@ rs_result rs_loadsig_file(FILE *sig_file, rs_signature_t **sumset,
 rs_result rs_delta_file(rs_signature_t *sig, FILE *new_file, FILE *delta_file,
                         rs_stats_t *stats)
 {
+    return rs_delta_file_flags(sig, new_file, delta_file, 0, stats);
+}
+
+rs_result rs_delta_file_flags(rs_signature_t *sig, FILE *new_file,
+                              FILE *delta_file, int flags, rs_stats_t *stats)
+{
+    return rs_delta_file_sig(sig, new_file, delta_file, flags, NULL, 0, 0, 0,
+                             stats);
+}
+
+/** Write a signature generated by a delta or patch job to a file. */
+static rs_result rs_savesig_file(rs_signature_t *sig, FILE *sig_file)
+{
+    rs_job_t *job;
+    rs_result r;
+
+    job = rs_savesig_begin(sig);
+    /* Size outbuf for header + 4 blocksums. */
+    r = rs_whole_run(job, NULL, sig_file, 0, 12 + 4 * (4 + sig->strong_sum_len),
+                     0);
+    rs_job_free(job);
+    return r;
+}
+
+/** Check if a new file is unchanged from the basis of a signature with a
+ * digest, and make the delta job skip it if it is.
+ *
+ * This is only done with ::RS_DELTA_SKIP_UNCHANGED, because a changed file of
+ * the same length is then read twice. Only regular files at their start are
+ * checked, and they are rewound after hashing them. */
+static int rs_delta_file_unchanged(rs_job_t *job, rs_signature_t *sig,
+                                   FILE *new_file)
+{
+    blake2b_state ctx;
+    rs_byte_t digest[RS_MAX_STRONG_SUM_LENGTH];
+    rs_byte_t *buf;
+    size_t len;
+    rs_long_t new_len = 0;
+
+    if (!(job->flags & RS_DELTA_SKIP_UNCHANGED) || sig->file_len < 0
+        || rs_file_size(new_file) != sig->file_len
+        || ftell(new_file) != 0)
+        return 0;
+    buf = rs_alloc(&job->heap, RS_DIGEST_BUF_LEN, "digest buffer");
+    blake2b_init(&ctx, sizeof digest);
+    while ((len = fread(buf, 1, RS_DIGEST_BUF_LEN, new_file)) > 0) {
+        blake2b_update(&ctx, buf, len);
+        new_len += len;
+    }
+    rs_free(&job->heap, buf, RS_DIGEST_BUF_LEN);
+    blake2b_final(&ctx, digest, sizeof digest);
+    rewind(new_file);
+    return new_len == sig->file_len
+        && rs_delta_skip_unchanged(job, new_len, digest) == RS_DONE;
+}
+
+rs_result rs_delta_file_sig(rs_signature_t *sig, FILE *new_file,
+                            FILE *delta_file, int flags, FILE *new_sig_file,
+                            size_t block_len, size_t strong_len,
+                            rs_magic_number sig_magic, rs_stats_t *stats)
+{
+    rs_signature_t *new_sig = NULL;
+    rs_job_t *job;
+    rs_result r;
+
+    job = rs_delta_begin_flags(sig, flags);
+    if (new_sig_file
+        && (r = rs_sig_args(rs_file_size(new_file), &sig_magic, &block_len,
+                            &strong_len)) != RS_DONE) {
+        rs_job_free(job);
+        return r;
+    }
+    /* An unchanged new file keeps the old signature if it has the same
+       arguments, otherwise the new file must be read to sign it. */
+    if ((!new_sig_file
+         || (sig->magic == (int)sig_magic && sig->block_len == (int)block_len
+             && sig->strong_sum_len == (int)strong_len))
+        && rs_delta_file_unchanged(job, sig, new_file)) {
+        new_file = NULL;
+        if (new_sig_file)
+            new_sig = sig;
+    } else if (new_sig_file
+               && (r = rs_delta_set_sig(job, &new_sig, sig_magic, block_len,
+                                        strong_len)) != RS_DONE) {
+        rs_job_free(job);
+        return r;
+    }
+    /* Size inbuf for 4*(CMD + 1 block), outbuf for 4*CMD. */
+    r = rs_whole_run(job, new_file, delta_file,
+                     4 * (MAX_DELTA_CMD + sig->block_len), 4 * MAX_DELTA_CMD, 0);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    if (new_sig) {
+        if (r == RS_DONE)
+            r = rs_savesig_file(new_sig, new_sig_file);
+        if (new_sig != sig)
+            rs_free_sumset(new_sig);
+    }
+    return r;
+}
+
+rs_result rs_delta_local_file(FILE *basis_file, FILE *new_file,
+                              FILE *delta_file, size_t block_len, int flags,
+                              rs_stats_t *stats)
+{
+    rs_signature_t sig;
     rs_job_t *job;
     rs_result r;
+    rs_long_t basis_fsize = rs_file_size(basis_file);
 
-    job = rs_delta_begin(sig);
+    if (basis_fsize < 0) {
+        rs_error("local delta basis must be a regular file");
+        return RS_PARAM_ERROR;
+    }
+    if ((r =
+         rs_signature_init_basis(&sig, block_len, basis_fsize,
+                                 rs_file_copy_cb, basis_file)) != RS_DONE)
+        return r;
+    job = rs_delta_begin_flags(&sig, flags);
+    rs_delta_set_basis(job, rs_file_copy_cb, basis_file);
     /* Size inbuf for 4*(CMD + 1 block), outbuf for 4*CMD. */
     r = rs_whole_run(job, new_file, delta_file,
-                     4 * (MAX_DELTA_CMD + sig->block_len), 4 * MAX_DELTA_CMD);
+                     4 * (MAX_DELTA_CMD + sig.block_len), 4 * MAX_DELTA_CMD, 0);
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
     rs_job_free(job);
+    rs_signature_done(&sig);
     return r;
 }
 
 rs_result rs_patch_file(FILE *basis_file, FILE *delta_file, FILE *new_file,
                         rs_stats_t *stats)
 {
+    return rs_patch_file_flags(basis_file, delta_file, new_file, 0, stats);
+}
+
+rs_result rs_patch_file_flags(FILE *basis_file, FILE *delta_file,
+                              FILE *new_file, int flags, rs_stats_t *stats)
+{
+    return rs_patch_file_sig(basis_file, delta_file, new_file, flags, NULL, 0,
+                             0, 0, stats);
+}
+
+rs_result rs_patch_file_sig(FILE *basis_file, FILE *delta_file,
+                            FILE *new_file, int flags, FILE *new_sig_file,
+                            size_t block_len, size_t strong_len,
+                            rs_magic_number sig_magic, rs_stats_t *stats)
+{
+    rs_signature_t *sig = NULL;
     rs_job_t *job;
     rs_result r;
 
-    job = rs_patch_begin(rs_file_copy_cb, basis_file);
+    if (flags & RS_PATCH_INPLACE) {
+        if (new_file && new_file != basis_file) {
+            rs_error("in-place patch must write to the basis file");
+            return RS_PARAM_ERROR;
+        }
+        job = rs_patch_begin(rs_inplace_copy_cb, NULL);
+        new_file = basis_file;
+        flags = RS_WHOLE_INPLACE;
+    } else {
+        /* Skipped zero blocks would keep any data already in the file. */
+        if ((flags & RS_PATCH_SPARSE) && rs_file_size(new_file) > 0) {
+            rs_error("sparse patch output file must be empty");
+            return RS_PARAM_ERROR;
+        }
+        job = rs_patch_begin(rs_file_copy_cb, basis_file);
+        flags = (flags & RS_PATCH_SPARSE) ? RS_WHOLE_SPARSE : 0;
+    }
+    if (new_sig_file
+        && ((r = rs_sig_args(rs_file_size(basis_file), &sig_magic, &block_len,
+                             &strong_len)) != RS_DONE
+            || (r = rs_patch_set_sig(job, &sig, sig_magic, block_len,
+                                     strong_len)) != RS_DONE)) {
+        rs_job_free(job);
+        return r;
+    }
     /* Default size inbuf 1*CMD and outbuf 4*CMD. */
     r = rs_whole_run(job, delta_file, new_file, MAX_DELTA_CMD,
-                     4 * MAX_DELTA_CMD);
+                     4 * MAX_DELTA_CMD, flags);
+    if (stats)
+        memcpy(stats, &job->stats, sizeof *stats);
+    rs_job_free(job);
+    if (sig) {
+        if (r == RS_DONE)
+            r = rs_savesig_file(sig, new_sig_file);
+        rs_free_sumset(sig);
+    }
+    return r;
+}
+
+rs_result rs_patchsig_file(FILE *basis_file, rs_signature_t *sig,
+                           FILE *delta_file, FILE *new_sig_file,
+                           rs_stats_t *stats)
+{
+    rs_job_t *job;
+    rs_result r;
+
+    job = rs_patchsig_begin(sig, rs_file_copy_cb, basis_file);
+    /* Size inbuf for 1*CMD, outbuf for header + 4 blocksums. */
+    r = rs_whole_run(job, delta_file, new_sig_file, MAX_DELTA_CMD,
+                     12 + 4 * (4 + sig->strong_sum_len), 0);
     if (stats)
         memcpy(stats, &job->stats, sizeof *stats);
     rs_job_free(job);
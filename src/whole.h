@@ -27,6 +27,12 @@
 #  include <stdio.h>
 #  include "librsync.h"
 
+/** Flags for rs_whole_run(). */
+typedef enum {
+    RS_WHOLE_SPARSE = 1 << 0,   /**< Seek over zero blocks in out_file. */
+    RS_WHOLE_INPLACE = 1 << 1,  /**< Write output over the job's basis. */
+} rs_whole_flags;
+
 /** Run a job continuously, with input to/from the two specified files.
  *
  * The job should already be set up, and must be freed by the caller after
@@ -43,8 +49,12 @@
  *
  * \param outbuflen - recommended output buffer size to use.
  *
+ * \param flags - bitwise-or of ::rs_whole_flags. For RS_WHOLE_INPLACE the job
+ * must be a patch job using rs_inplace_copy_cb(), and out_file must be the
+ * basis file opened for reading and writing.
+ *
  * \return RS_DONE if the job completed, or otherwise an error result. */
 rs_result rs_whole_run(rs_job_t *job, FILE *in_file, FILE *out_file,
-                       int inbuflen, int outbuflen);
+                       int inbuflen, int outbuflen, int flags);
 
 #endif                          /* !WHOLE_H */
@@ -0,0 +1,225 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * alloc_test -- tests for allocator hooks and job arenas.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file alloc_test.c
+ * Test allocator hooks and job arenas.
+ *
+ * This runs whole-file signature, loadsig, delta and patch operations with a
+ * counting allocator, checking everything they allocate is freed with the
+ * right size. It then runs streaming delta jobs with and without an arena,
+ * checking their memory stats count what they allocate, the arena makes
+ * fewer allocator calls, and the signature's memory doesn't change. */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define DATA_LEN (256 << 10)
+#define SLICE_LEN 1000
+
+/** The allocations made with the counting allocator. */
+typedef struct counts {
+    int calls;                  /**< The number of alloc and realloc calls. */
+    int live;                   /**< The number of live allocations. */
+    size_t bytes;               /**< The bytes in live allocations. */
+} counts_t;
+
+/** The header in front of each allocation to check the sizes. */
+typedef union header {
+    size_t size;
+    long double align;
+} header_t;
+
+static void *count_alloc(void *opaque, size_t size)
+{
+    counts_t *c = (counts_t *)opaque;
+    header_t *h = malloc(sizeof(header_t) + size);
+
+    assert(h);
+    h->size = size;
+    c->calls++;
+    c->live++;
+    c->bytes += size;
+    return h + 1;
+}
+
+static void count_free(void *opaque, void *ptr, size_t size)
+{
+    counts_t *c = (counts_t *)opaque;
+    header_t *h = (header_t *)ptr - 1;
+
+    assert(h->size == size);
+    c->live--;
+    c->bytes -= size;
+    free(h);
+}
+
+static void *count_realloc(void *opaque, void *ptr, size_t old_size,
+                           size_t size)
+{
+    void *p = count_alloc(opaque, size);
+
+    if (ptr) {
+        memcpy(p, ptr, old_size < size ? old_size : size);
+        count_free(opaque, ptr, old_size);
+    }
+    return p;
+}
+
+static char data[DATA_LEN];
+
+/** Write data to a new temporary file. */
+static FILE *data_file(const char *buf, size_t len)
+{
+    FILE *f = tmpfile();
+
+    assert(f);
+    assert(fwrite(buf, 1, len, f) == len);
+    rewind(f);
+    return f;
+}
+
+/** Start a delta job that reads the basis to extend matches. */
+static rs_job_t *new_delta(rs_signature_t *sig, FILE *basis_f)
+{
+    rs_job_t *job = rs_delta_begin(sig);
+
+    assert(rs_delta_set_basis(job, rs_file_copy_cb, basis_f) == RS_DONE);
+    return job;
+}
+
+/** Run a streaming delta job over the data, returning its memory stats. */
+static rs_mem_stats_t run_delta(rs_job_t *job)
+{
+    rs_buffers_t buf;
+    rs_mem_stats_t mem;
+    char out[4096];
+    rs_result result;
+
+    /* Feed it less than a block at a time so it needs the scoop. */
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = data;
+    do {
+        if (!buf.avail_in) {
+            buf.avail_in = data + DATA_LEN - buf.next_in;
+            if (buf.avail_in > SLICE_LEN)
+                buf.avail_in = SLICE_LEN;
+            buf.eof_in = buf.next_in + buf.avail_in == data + DATA_LEN;
+        }
+        buf.next_out = out;
+        buf.avail_out = sizeof out;
+        result = rs_job_iter(job, &buf);
+    } while (result == RS_BLOCKED);
+    assert(result == RS_DONE);
+    /* The arena can't be set after the job has started. */
+    assert(rs_job_set_arena(job, 0) == RS_PARAM_ERROR);
+    mem = *rs_job_mem_stats(job);
+    rs_job_free(job);
+    return mem;
+}
+
+int main(void)
+{
+    rs_allocator_t counter =
+        { count_alloc, count_realloc, count_free, NULL };
+    counts_t c;
+    FILE *old_f, *new_f, *sig_f, *delta_f, *out_f;
+    rs_signature_t *sig;
+    rs_mem_stats_t sig_mem, mem, heap_mem, arena_mem;
+    rs_job_t *job;
+    int calls, heap_calls, live;
+    size_t i;
+
+    for (i = 0; i < DATA_LEN; i++)
+        data[i] = (char)(i * 7919 >> 5);
+    old_f = data_file(data, DATA_LEN);
+    memset(data + DATA_LEN / 2, 'x', 4096);
+    new_f = data_file(data, DATA_LEN);
+
+    /* Test whole-file operations only use the allocator and free it all. */
+    memset(&c, 0, sizeof c);
+    counter.opaque = &c;
+    assert(rs_set_allocator(&counter) == NULL);
+    sig_f = tmpfile();
+    assert(rs_sig_file(old_f, sig_f, 1024, 8, RS_RK_BLAKE2_SIG_MAGIC, NULL) ==
+           RS_DONE);
+    assert(c.calls > 0);
+    assert(c.live == 0 && c.bytes == 0);
+    rewind(sig_f);
+    assert(rs_loadsig_file(sig_f, &sig, NULL) == RS_DONE);
+    live = c.live;
+    assert(rs_build_hash_table(sig) == RS_DONE);
+    /* The hashtable, its entries and bloom filter use the allocator too. */
+    assert(c.live == live + 3);
+    rs_signature_mem_stats(sig, &sig_mem);
+    assert(sig_mem.bytes > 0 && sig_mem.peak >= sig_mem.bytes);
+    delta_f = tmpfile();
+    assert(rs_delta_file(sig, new_f, delta_f, NULL) == RS_DONE);
+    rewind(old_f);
+    rewind(delta_f);
+    out_f = tmpfile();
+    assert(rs_patch_file(old_f, delta_f, out_f, NULL) == RS_DONE);
+    assert(ftell(out_f) == DATA_LEN);
+
+    /* Test a job keeps using the allocator it was created with. */
+    calls = c.calls;
+    live = c.live;
+    job = new_delta(sig, old_f);
+    assert(rs_set_allocator(NULL) == &counter);
+    heap_mem = run_delta(job);
+    heap_calls = c.calls - calls;
+    assert(heap_calls > 1);
+    assert(c.live == live);
+    assert(heap_mem.bytes > 0 && heap_mem.peak >= heap_mem.bytes);
+
+    /* Test an arena with room for the buffers makes fewer allocator calls. */
+    rs_set_allocator(&counter);
+    calls = c.calls;
+    job = new_delta(sig, old_f);
+    assert(rs_job_set_arena(job, 1 << 20) == RS_DONE);
+    arena_mem = run_delta(job);
+    assert(c.calls - calls == 2 && c.calls - calls < heap_calls);
+    /* The arena's chunks are counted, and hold at least the heap's peak. */
+    assert(c.live == live && arena_mem.peak >= heap_mem.peak);
+
+    /* Test delta jobs don't change the memory of the signature they use. */
+    rs_signature_mem_stats(sig, &mem);
+    assert(mem.bytes == sig_mem.bytes && mem.peak == sig_mem.peak);
+
+    /* Test the arena can't be set twice. */
+    job = rs_delta_begin(sig);
+    assert(rs_job_set_arena(job, 1) == RS_DONE);
+    assert(rs_job_set_arena(job, 0) == RS_PARAM_ERROR);
+    rs_job_free(job);
+
+    rs_free_sumset(sig);
+    assert(c.live == 0 && c.bytes == 0);
+    assert(rs_set_allocator(NULL) == &counter);
+    fclose(old_f);
+    fclose(new_f);
+    fclose(sig_f);
+    fclose(delta_f);
+    fclose(out_f);
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * basis_test -- tests for extending delta matches using the basis.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file basis_test.c
+ * Test extending delta matches using the basis.
+ *
+ * This runs streaming delta jobs with and without rs_delta_set_basis() for a
+ * new file with a few bytes changed in the middle of a block, checking the
+ * basis makes the delta only send the changed bytes as literal data, and
+ * that both deltas patch the basis into the new file. It then checks
+ * rs_delta_set_basis() fails for jobs it can't be used with. */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define DATA_LEN (256 << 10)
+#define BLOCK_LEN 1024
+#define CHANGE_POS (DATA_LEN / 2 + 100)
+#define CHANGE_LEN 10
+
+static char old_data[DATA_LEN], new_data[DATA_LEN], out_data[DATA_LEN];
+
+/** Write data to a new temporary file. */
+static FILE *data_file(const char *buf, size_t len)
+{
+    FILE *f = tmpfile();
+
+    assert(f);
+    assert(fwrite(buf, 1, len, f) == len);
+    rewind(f);
+    return f;
+}
+
+/** Run a streaming delta job over the new data, returning its literal
+ * bytes. */
+static rs_long_t run_delta(rs_job_t *job, FILE *delta_f)
+{
+    rs_buffers_t buf;
+    char out[4096];
+    rs_long_t lit_bytes;
+    rs_result result;
+
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = new_data;
+    buf.avail_in = DATA_LEN;
+    buf.eof_in = 1;
+    do {
+        buf.next_out = out;
+        buf.avail_out = sizeof out;
+        result = rs_job_iter(job, &buf);
+        assert(fwrite(out, 1, sizeof out - buf.avail_out, delta_f) ==
+               sizeof out - buf.avail_out);
+    } while (result == RS_BLOCKED);
+    assert(result == RS_DONE);
+    /* The basis can't be set after the job has started. */
+    assert(rs_delta_set_basis(job, rs_file_copy_cb, NULL) == RS_PARAM_ERROR);
+    lit_bytes = rs_job_statistics(job)->lit_bytes;
+    rs_job_free(job);
+    rewind(delta_f);
+    return lit_bytes;
+}
+
+/** Patch the basis with a delta and check it gives the new data. */
+static void check_patch(FILE *old_f, FILE *delta_f)
+{
+    FILE *out_f = tmpfile();
+
+    rewind(old_f);
+    assert(rs_patch_file(old_f, delta_f, out_f, NULL) == RS_DONE);
+    rewind(out_f);
+    assert(fread(out_data, 1, DATA_LEN, out_f) == DATA_LEN);
+    assert(memcmp(out_data, new_data, DATA_LEN) == 0);
+    fclose(out_f);
+}
+
+int main(void)
+{
+    FILE *old_f, *sig_f, *delta_f, *basis_delta_f;
+    rs_signature_t *sig;
+    rs_job_t *job;
+    rs_long_t lit_bytes;
+    size_t i;
+
+    for (i = 0; i < DATA_LEN; i++)
+        old_data[i] = (char)(i * 7919 >> 5);
+    memcpy(new_data, old_data, DATA_LEN);
+    for (i = CHANGE_POS; i < CHANGE_POS + CHANGE_LEN; i++)
+        new_data[i] = (char)~old_data[i];
+    old_f = data_file(old_data, DATA_LEN);
+    sig_f = tmpfile();
+    assert(rs_sig_file(old_f, sig_f, BLOCK_LEN, 8, RS_RK_BLAKE2_SIG_MAGIC,
+                       NULL) == RS_DONE);
+    rewind(sig_f);
+    assert(rs_loadsig_file(sig_f, &sig, NULL) == RS_DONE);
+    assert(rs_build_hash_table(sig) == RS_DONE);
+
+    /* Test without the basis the whole changed block is literal data. */
+    delta_f = tmpfile();
+    lit_bytes = run_delta(rs_delta_begin(sig), delta_f);
+    assert(lit_bytes >= BLOCK_LEN);
+    check_patch(old_f, delta_f);
+
+    /* Test with the basis only the changed bytes are literal data. */
+    basis_delta_f = tmpfile();
+    job = rs_delta_begin(sig);
+    assert(rs_delta_set_basis(job, rs_file_copy_cb, old_f) == RS_DONE);
+    lit_bytes = run_delta(job, basis_delta_f);
+    assert(lit_bytes == CHANGE_LEN);
+    check_patch(old_f, basis_delta_f);
+
+    /* Test the basis can't be set for other jobs. */
+    job = rs_patch_begin(rs_file_copy_cb, old_f);
+    assert(rs_delta_set_basis(job, rs_file_copy_cb, old_f) == RS_PARAM_ERROR);
+    rs_job_free(job);
+
+    rs_free_sumset(sig);
+    fclose(old_f);
+    fclose(sig_f);
+    fclose(delta_f);
+    fclose(basis_delta_f);
+    return 0;
+}
@@ -0,0 +1,457 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * checksum_perf -- microbenchmarks for the checksum and matching kernels.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file checksum_perf.c
+ * Microbenchmarks for the checksum and matching kernels.
+ *
+ * This times the rollsum and rabinkarp update, rotate and rollin/rollout
+ * paths, MD4 and BLAKE2 strong sums, hashtable finds that hit and miss at
+ * different load factors, and rs_signature_find_match() hits and misses, for
+ * a range of block sizes. The find_match hits include calculating the
+ * block's weak and strong sums like delta does, and the misses only time the
+ * lookup. Each benchmark is repeated until it has run for the minimum time,
+ * and the best of 3 trials is reported as ns per operation, ns per byte, and
+ * cycles per byte where a cycle counter is available.
+ *
+ * There is no runtime CPU dispatch, so the header line reports the kernel
+ * implementations and SIMD extensions the benchmark was compiled with.
+ *
+ * Usage: checksum_perf [-t SECONDS] [NAME...] where NAME selects the
+ * benchmarks whose name starts with it. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <x86intrin.h>
+#  define HAVE_RDTSC 1
+#endif
+#include "librsync.h"
+#include "rollsum.h"
+#include "rabinkarp.h"
+#include "mdfour.h"
+#include "blake2.h"
+#include "sumset.h"
+
+/** Key type for the hashtable benchmarks, like weak sums. */
+typedef struct benchkey {
+    unsigned weak;
+} benchkey_t;
+
+static inline unsigned benchkey_hash(benchkey_t const *k)
+{
+    return k->weak;
+}
+
+static inline int benchkey_cmp(benchkey_t *k, benchkey_t const *o)
+{
+    return k->weak != o->weak;
+}
+
+#define ENTRY benchkey
+#include "hashtable.h"
+
+/** The benchmark state passed to the benchmark functions. */
+typedef struct bench {
+    const unsigned char *buf;   /**< Random input data. */
+    size_t block_len;           /**< The block length to use. */
+    hashtable_t *table;         /**< Hashtable for the hashtable benchmarks. */
+    benchkey_t *keys;           /**< The keys in the table. */
+    int key_count;              /**< The number of keys in the table. */
+    rs_signature_t *sig;        /**< Signature for the find_match benchmarks. */
+    int sig_blocks;             /**< The number of blocks in sig. */
+    size_t i;                   /**< Rotating index to vary the input. */
+    uint32_t sink;              /**< Results to stop the compiler optimizing. */
+} bench_t;
+
+/** Where the sink is stored so the benchmarks can't be optimized away. */
+static volatile uint32_t bench_sink;
+
+/** The size of the random input buffer. */
+#define BENCH_BUF_LEN (1 << 20)
+
+/** The maximum number of blocks in the find_match signatures. */
+#define BENCH_SIG_BLOCKS 1024
+
+/** The number of entries in the hashtables. */
+#define BENCH_TABLE_SIZE (1 << 16)
+
+/* The compiled kernel implementations for the header line. */
+#ifdef USE_LIBB2
+#  define BENCH_BLAKE2 "libb2"
+#else
+#  define BENCH_BLAKE2 "ref"
+#endif
+#if defined(__AVX2__)
+#  define BENCH_SIMD "avx2"
+#elif defined(__SSE2__)
+#  define BENCH_SIMD "sse2"
+#elif defined(__ARM_NEON)
+#  define BENCH_SIMD "neon"
+#else
+#  define BENCH_SIMD "none"
+#endif
+#ifdef HAVE_RDTSC
+#  define BENCH_CYCLES "rdtsc"
+#else
+#  define BENCH_CYCLES "none"
+#endif
+
+static double opt_min_secs = 0.1;
+
+static uint64_t now_ns(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+static uint64_t now_cycles(void)
+{
+#ifdef HAVE_RDTSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/** Get the next block of the input to use. */
+static inline const unsigned char *next_block(bench_t *b)
+{
+    b->i = (b->i + b->block_len) & (BENCH_BUF_LEN / 2 - 1);
+    return b->buf + b->i;
+}
+
+static void bench_rollsum_update(bench_t *b)
+{
+    Rollsum r;
+
+    RollsumInit(&r);
+    RollsumUpdate(&r, next_block(b), b->block_len);
+    b->sink += RollsumDigest(&r);
+}
+
+static void bench_rabinkarp_update(bench_t *b)
+{
+    rabinkarp_t r;
+
+    rabinkarp_init(&r);
+    rabinkarp_update(&r, next_block(b), b->block_len);
+    b->sink += rabinkarp_digest(&r);
+}
+
+static void bench_rollsum_rotate(bench_t *b)
+{
+    const unsigned char *p = next_block(b);
+    Rollsum r;
+    size_t i;
+
+    RollsumInit(&r);
+    RollsumUpdate(&r, p, b->block_len);
+    for (i = 0; i < b->block_len; i++)
+        RollsumRotate(&r, p[i], p[i + b->block_len]);
+    b->sink += RollsumDigest(&r);
+}
+
+static void bench_rabinkarp_rotate(bench_t *b)
+{
+    const unsigned char *p = next_block(b);
+    rabinkarp_t r;
+    size_t i;
+
+    rabinkarp_init(&r);
+    rabinkarp_update(&r, p, b->block_len);
+    for (i = 0; i < b->block_len; i++)
+        rabinkarp_rotate(&r, p[i], p[i + b->block_len]);
+    b->sink += rabinkarp_digest(&r);
+}
+
+static void bench_rollsum_rollinout(bench_t *b)
+{
+    const unsigned char *p = next_block(b);
+    Rollsum r;
+    size_t i;
+
+    RollsumInit(&r);
+    for (i = 0; i < b->block_len; i++)
+        RollsumRollin(&r, p[i]);
+    for (i = 0; i < b->block_len; i++)
+        RollsumRollout(&r, p[i]);
+    b->sink += RollsumDigest(&r);
+}
+
+static void bench_rabinkarp_rollinout(bench_t *b)
+{
+    const unsigned char *p = next_block(b);
+    rabinkarp_t r;
+    size_t i;
+
+    rabinkarp_init(&r);
+    for (i = 0; i < b->block_len; i++)
+        rabinkarp_rollin(&r, p[i]);
+    for (i = 0; i < b->block_len; i++)
+        rabinkarp_rollout(&r, p[i]);
+    b->sink += rabinkarp_digest(&r);
+}
+
+static void bench_md4(bench_t *b)
+{
+    unsigned char sum[RS_MAX_STRONG_SUM_LENGTH];
+
+    rs_mdfour(sum, next_block(b), b->block_len);
+    b->sink += sum[0];
+}
+
+static void bench_blake2b(bench_t *b)
+{
+    blake2b_state ctx;
+    uint8_t sum[RS_MAX_STRONG_SUM_LENGTH];
+
+    blake2b_init(&ctx, sizeof sum);
+    blake2b_update(&ctx, next_block(b), b->block_len);
+    blake2b_final(&ctx, sum, sizeof sum);
+    b->sink += sum[0];
+}
+
+static void bench_hashtable_hit(bench_t *b)
+{
+    benchkey_t *k = &b->keys[b->i++ % b->key_count];
+
+    b->sink += benchkey_hashtable_find(b->table, k) != NULL;
+}
+
+static void bench_hashtable_miss(bench_t *b)
+{
+    /* The table keys are all even, so odd keys always miss. */
+    benchkey_t k;
+
+    k.weak = b->keys[b->i++ % b->key_count].weak | 1;
+    b->sink += benchkey_hashtable_find(b->table, &k) != NULL;
+}
+
+static void bench_find_match_hit(bench_t *b)
+{
+    const size_t len = b->block_len;
+    const unsigned char *p;
+
+    b->i = (b->i + 1) % b->sig_blocks;
+    p = b->buf + b->i * len;
+    b->sink += (uint32_t)
+        rs_signature_find_match(b->sig,
+                                rs_signature_calc_weak_sum(b->sig, p, len), p,
+                                len);
+}
+
+static void bench_find_match_miss(bench_t *b)
+{
+    /* Spread out weak sums that almost never match, so this only times the
+       lookup. */
+    rs_weak_sum_t weak = (rs_weak_sum_t)(++b->i * 0x9e3779b1U);
+
+    b->sink += (uint32_t)
+        rs_signature_find_match(b->sig, weak, b->buf, b->block_len);
+}
+
+/** A benchmark and whether it processes block_len bytes per operation. */
+typedef struct benchdef {
+    const char *name;
+    void (*fn)(bench_t *b);
+    int per_byte;
+} benchdef_t;
+
+static const benchdef_t block_benches[] = {
+    {"rollsum_update", bench_rollsum_update, 1},
+    {"rabinkarp_update", bench_rabinkarp_update, 1},
+    {"rollsum_rotate", bench_rollsum_rotate, 1},
+    {"rabinkarp_rotate", bench_rabinkarp_rotate, 1},
+    {"rollsum_rollinout", bench_rollsum_rollinout, 1},
+    {"rabinkarp_rollinout", bench_rabinkarp_rollinout, 1},
+    {"md4", bench_md4, 1},
+    {"blake2b", bench_blake2b, 1},
+    {"find_match_hit", bench_find_match_hit, 1},
+    {"find_match_miss", bench_find_match_miss, 0},
+};
+
+static const size_t block_lens[] = { 64, 256, 1024, 4096, 16384 };
+
+/** Check if a benchmark was selected on the command line. */
+static int selected(const char *name, int argc, char **argv, int argi)
+{
+    if (argi == argc)
+        return 1;
+    for (; argi < argc; argi++)
+        if (!strncmp(name, argv[argi], strlen(argv[argi])))
+            return 1;
+    return 0;
+}
+
+/** Time a benchmark, printing the best of 3 trials. */
+static void run_bench(const char *name, const char *param, bench_t *b,
+                      void (*fn)(bench_t *), size_t bytes)
+{
+    uint64_t reps = 1, i, ns, cycles, best_ns = 0, best_cycles = 0;
+    int trial;
+
+    /* Find how many reps take the minimum time. */
+    for (;;) {
+        ns = now_ns();
+        for (i = 0; i < reps; i++)
+            fn(b);
+        ns = now_ns() - ns;
+        if (ns >= opt_min_secs * 1e9)
+            break;
+        reps *= ns < opt_min_secs * 1e8 ? 10 : 2;
+    }
+    for (trial = 0; trial < 3; trial++) {
+        ns = now_ns();
+        cycles = now_cycles();
+        for (i = 0; i < reps; i++)
+            fn(b);
+        cycles = now_cycles() - cycles;
+        ns = now_ns() - ns;
+        if (!trial || ns < best_ns) {
+            best_ns = ns;
+            best_cycles = cycles;
+        }
+    }
+    printf("%-22s %-10s %12.2f", name, param, (double)best_ns / reps);
+    if (bytes) {
+        printf(" %10.3f", (double)best_ns / reps / bytes);
+#ifdef HAVE_RDTSC
+        printf(" %12.3f", (double)best_cycles / reps / bytes);
+#else
+        printf(" %12s", "-");
+#endif
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/** Build a signature of the first half of the input, up to
+ * BENCH_SIG_BLOCKS blocks. */
+static rs_signature_t *make_sig(bench_t *b)
+{
+    const size_t block_len = b->block_len;
+    rs_signature_t *sig = malloc(sizeof *sig);
+    rs_strong_sum_t strong;
+    const unsigned char *p;
+    int i;
+
+    b->sig_blocks = (int)(BENCH_BUF_LEN / 2 / block_len);
+    if (b->sig_blocks > BENCH_SIG_BLOCKS)
+        b->sig_blocks = BENCH_SIG_BLOCKS;
+    rs_signature_init(sig, RS_RK_BLAKE2_SIG_MAGIC, block_len,
+                      RS_MAX_STRONG_SUM_LENGTH, -1);
+    for (i = 0; i < b->sig_blocks; i++) {
+        p = b->buf + i * block_len;
+        rs_signature_calc_strong_sum(sig, p, block_len, &strong);
+        rs_signature_add_block(sig, rs_signature_calc_weak_sum(sig, p,
+                                                                block_len),
+                               &strong);
+    }
+    rs_build_hash_table(sig);
+    return sig;
+}
+
+int main(int argc, char **argv)
+{
+    static const int loads[] = { 25, 50, 70 };
+    unsigned char *buf;
+    bench_t b;
+    char param[32];
+    uint64_t r = 1;
+    size_t i, j;
+    int argi = 1, k, size2;
+
+    if (argc > 2 && !strcmp(argv[1], "-t")) {
+        opt_min_secs = atof(argv[2]);
+        argi = 3;
+    }
+    rs_trace_set_level(RS_LOG_WARNING);
+    buf = malloc(BENCH_BUF_LEN);
+    for (i = 0; i < BENCH_BUF_LEN; i++) {
+        r ^= r << 13;
+        r ^= r >> 7;
+        r ^= r << 17;
+        buf[i] = (unsigned char)r;
+    }
+    memset(&b, 0, sizeof b);
+    b.buf = buf;
+
+    printf("kernels: rollsum=c rabinkarp=c md4=c blake2=%s simd=%s "
+           "cycles=%s\n", BENCH_BLAKE2, BENCH_SIMD, BENCH_CYCLES);
+    printf("%-22s %-10s %12s %10s %12s\n", "benchmark", "param", "ns/op",
+           "ns/byte", "cycles/byte");
+
+    for (i = 0; i < sizeof block_benches / sizeof *block_benches; i++) {
+        const benchdef_t *d = &block_benches[i];
+
+        if (!selected(d->name, argc, argv, argi))
+            continue;
+        for (j = 0; j < sizeof block_lens / sizeof *block_lens; j++) {
+            b.block_len = block_lens[j];
+            b.i = 0;
+            if (!strncmp(d->name, "find_match", 10))
+                b.sig = make_sig(&b);
+            snprintf(param, sizeof param, "%lu", (unsigned long)b.block_len);
+            run_bench(d->name, param, &b, d->fn,
+                      d->per_byte ? b.block_len : 0);
+            if (b.sig) {
+                rs_signature_done(b.sig);
+                free(b.sig);
+                b.sig = NULL;
+            }
+        }
+    }
+
+    /* Hashtables with even random keys filled to each load factor. */
+    b.keys = malloc(BENCH_TABLE_SIZE * sizeof *b.keys);
+    for (k = 0; k < (int)(sizeof loads / sizeof *loads); k++) {
+        b.table = benchkey_hashtable_new(BENCH_TABLE_SIZE * 7 / 10, NULL);
+        size2 = b.table->size;
+        b.key_count = size2 * loads[k] / 100;
+        for (j = 0; j < (size_t)b.key_count; j++) {
+            r ^= r << 13;
+            r ^= r >> 7;
+            r ^= r << 17;
+            b.keys[j].weak = (unsigned)r & ~1U;
+            benchkey_hashtable_add(b.table, &b.keys[j]);
+        }
+        snprintf(param, sizeof param, "load=%.2f",
+                 (double)b.key_count / size2);
+        b.i = 0;
+        if (selected("hashtable_hit", argc, argv, argi))
+            run_bench("hashtable_hit", param, &b, bench_hashtable_hit, 0);
+        if (selected("hashtable_miss", argc, argv, argi))
+            run_bench("hashtable_miss", param, &b, bench_hashtable_miss, 0);
+        benchkey_hashtable_free(b.table);
+    }
+    free(b.keys);
+    free(buf);
+    bench_sink = b.sink;
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * events_test -- tests for recording trace events in rings.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file events_test.c
+ * Test recording trace events in rings.
+ *
+ * This runs signature and delta jobs with and without an event ring set for
+ * the thread, checking the events recorded and that full rings drop events
+ * instead of overwriting them. */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define DATA_LEN (64 << 10)
+
+static char data[DATA_LEN];
+static char sigbuf[DATA_LEN];
+static char deltabuf[DATA_LEN];
+static rs_event_t events[4096];
+
+/** Run a job over an in-memory input, returning the output length. */
+static size_t drive(rs_job_t *job, const char *in, size_t in_len, char *out,
+                    size_t out_size)
+{
+    rs_buffers_t buf;
+    rs_result result;
+
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = (char *)in;
+    buf.avail_in = in_len;
+    buf.eof_in = 1;
+    buf.next_out = out;
+    buf.avail_out = out_size;
+    do {
+        result = rs_job_iter(job, &buf);
+    } while (result == RS_BLOCKED);
+    assert(result == RS_DONE);
+    return out_size - buf.avail_out;
+}
+
+/** Generate a signature and delta for data against itself. */
+static void sig_and_delta(void)
+{
+    rs_signature_t *sig;
+    rs_job_t *job;
+    size_t sig_len;
+
+    job = rs_sig_begin(1024, 8, RS_RK_BLAKE2_SIG_MAGIC);
+    sig_len = drive(job, data, DATA_LEN, sigbuf, sizeof sigbuf);
+    rs_job_free(job);
+    job = rs_loadsig_begin(&sig);
+    drive(job, sigbuf, sig_len, NULL, 0);
+    rs_job_free(job);
+    assert(rs_build_hash_table(sig) == RS_DONE);
+    job = rs_delta_begin(sig);
+    drive(job, data, DATA_LEN, deltabuf, sizeof deltabuf);
+    rs_job_free(job);
+    rs_free_sumset(sig);
+}
+
+/** Count the events of a type. */
+static int count_events(size_t n, int type)
+{
+    size_t i;
+    int count = 0;
+
+    for (i = 0; i < n; i++)
+        count += events[i].type == type;
+    return count;
+}
+
+int main(void)
+{
+    rs_event_ring_t *ring;
+    char text[256];
+    size_t i, n;
+
+    for (i = 0; i < DATA_LEN; i++)
+        data[i] = (char)(i * 7919 >> 5);
+    assert(!strcmp(rs_event_name(RS_EVENT_JOB_START), "job_start"));
+    assert(!strcmp(rs_event_name(RS_EVENT_PATCH_COPY), "patch_copy"));
+    assert(!strcmp(rs_event_name(0), "unknown"));
+    assert(!strcmp(rs_event_name(99), "unknown"));
+    assert((ring = rs_event_ring_new(1000)) != NULL);
+    if (!rs_supports_events()) {
+        assert(rs_event_ring_set(ring) == NULL);
+        sig_and_delta();
+        assert(rs_event_ring_read(ring, events, 4096) == 0);
+        rs_event_ring_free(ring);
+        return 0;
+    }
+
+    /* Test events are only recorded while the thread has a ring. */
+    sig_and_delta();
+    assert(rs_event_ring_read(ring, events, 4096) == 0);
+    assert(rs_event_ring_set(ring) == NULL);
+    sig_and_delta();
+    assert(rs_event_ring_set(NULL) == ring);
+    sig_and_delta();
+    n = rs_event_ring_read(ring, events, 4096);
+    assert(rs_event_ring_dropped(ring) == 0);
+    assert(count_events(n, RS_EVENT_JOB_START) == 3);
+    assert(count_events(n, RS_EVENT_JOB_END) == 3);
+    assert(count_events(n, RS_EVENT_STRONG_SUM) == 2 * DATA_LEN / 1024);
+    assert(count_events(n, RS_EVENT_MATCH) == DATA_LEN / 1024);
+    assert(count_events(n, RS_EVENT_COPY) == 1);
+    assert(count_events(n, RS_EVENT_LITERAL) == 0);
+    assert(events[0].type == RS_EVENT_JOB_START);
+    assert(events[0].nargs == 2);
+    assert(!strcmp((char const *)(intptr_t)events[0].args[1], "signature"));
+    assert(events[n - 1].type == RS_EVENT_JOB_END);
+    for (i = 1; i < n; i++)
+        assert(events[i].ns >= events[i - 1].ns);
+    rs_format_event(&events[0], text, sizeof text);
+    assert(strstr(text, " job_start(0x"));
+    assert(strstr(text, ", signature)"));
+    rs_format_event(&events[n - 1], text, sizeof text);
+    assert(strstr(text, " job_end(0x"));
+    assert(strstr(text, ", delta, 0, "));
+
+    /* Test a full ring drops events, and reading makes room again. */
+    rs_event_ring_free(ring);
+    assert((ring = rs_event_ring_new(3)) != NULL);
+    rs_event_ring_set(ring);
+    sig_and_delta();
+    rs_event_ring_set(NULL);
+    assert(rs_event_ring_dropped(ring) > 0);
+    assert(rs_event_ring_read(ring, events, 4096) == 4);
+    assert(events[0].type == RS_EVENT_JOB_START);
+    assert(rs_event_ring_read(ring, events, 4096) == 0);
+    rs_event_ring_set(ring);
+    sig_and_delta();
+    rs_event_ring_set(NULL);
+    assert(rs_event_ring_read(ring, events, 2) == 2);
+    assert(rs_event_ring_read(ring, events, 4096) == 2);
+    rs_event_ring_free(ring);
+    return 0;
+}
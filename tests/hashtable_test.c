@@ -105,7 +105,7 @@ int main(int argc, char **argv)
 
     mykey_init(&k1, 1);
     mykey_init(&k2, 2);
-    assert((kt = mykey_hashtable_new(16)) != NULL);
+    assert((kt = mykey_hashtable_new(16, NULL)) != NULL);
     assert(mykey_hashtable_add(kt, &k1) == &k1);
     assert(mykey_hashtable_find(kt, &k1) == &k1);
     assert(mykey_hashtable_find(kt, &k2) == NULL);
@@ -124,7 +124,7 @@ int main(int argc, char **argv)
         myentry_init(&entry[i], i);
 
     /* Test myhashtable_new() */
-    t = myhashtable_new(256);
+    t = myhashtable_new(256, NULL);
     assert(t->size == 512);
     assert(t->count == 0);
     assert(t->etable != NULL);
@@ -163,6 +163,47 @@ int main(int argc, char **argv)
     assert(t->entrycmp_count == 0);
 #endif
 
+    /* Test myhashtable_find_r() counts stats without changing the table. */
+    hashtable_stats_t stats = { 0, 0, 0, 0 };
+    mymatch_init(&m, 1);
+    assert(myhashtable_find_r(t, &m, &stats) == &entry[1]);
+    mymatch_init(&m, 256);
+    assert(myhashtable_find_r(t, &m, &stats) == NULL);
+#ifndef HASHTABLE_NSTATS
+    assert(stats.find_count == 2);
+    assert(stats.match_count == 1);
+    assert(stats.hashcmp_count >= 1);
+    assert(stats.entrycmp_count >= 1);
+    assert(t->find_count == 0);
+#endif
+
+    /* Test hashtable_layout() */
+    hashtable_layout_t layout;
+    long hits = 0, misses = 0;
+    hashtable_layout(t, &layout);
+    assert(layout.size == 512);
+    assert(layout.count == 258);
+    /* Pairs of entries have the same key, and key 0 has e, entry[0] twice,
+       and entry[1]. */
+    assert(layout.dup_count == 258);
+    assert(layout.dup_clusters == 128);
+    assert(layout.dup_max == 4);
+    assert(layout.hit_probes[0] == 0);
+    assert(layout.miss_probes[0] == 0);
+    for (i = 0; i < HASHTABLE_PROBES; i++) {
+        hits += layout.hit_probes[i];
+        misses += layout.miss_probes[i];
+    }
+    assert(hits == 258);
+    assert(misses == 512);
+    assert(layout.hit_probes_sum >= 258);
+    assert(layout.miss_probes_sum >= 512);
+#ifndef HASHTABLE_NBLOOM
+    assert(layout.bloom_bits > 0 && layout.bloom_bits <= 128);
+#else
+    assert(layout.bloom_bits == 512);
+#endif
+
     /* Test hashtable iterators */
     myentry_t *p;
     int iter;
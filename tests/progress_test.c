@@ -0,0 +1,181 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * progress_test -- tests for job progress callbacks.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file progress_test.c
+ * Test job progress callbacks.
+ *
+ * This runs whole-file signature, delta and patch operations with a progress
+ * callback, checking it is called at the interval with increasing counts and
+ * a final report, and then checks that a callback can stop a job, including
+ * with results a job can't complete with. */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define DATA_LEN (1 << 20)
+#define INTERVAL (64 << 10)
+
+/** The progress reports of a job. */
+typedef struct reports {
+    int calls;
+    rs_progress_t last;
+} reports_t;
+
+static char data[DATA_LEN];
+
+/** ::rs_progress_cb that checks and records the reports. */
+static rs_result progress_cb(rs_job_t *job, const rs_progress_t *p, void *arg)
+{
+    reports_t *r = (reports_t *)arg;
+
+    assert(job);
+    assert(p->in_bytes >= r->last.in_bytes);
+    assert(p->out_bytes >= r->last.out_bytes);
+    assert(p->elapsed_ns >= r->last.elapsed_ns);
+    assert(p->match_ratio >= 0.0 && p->match_ratio <= 1.0);
+    assert(p->in_mb_per_s >= 0.0 && p->out_mb_per_s >= 0.0);
+    r->calls++;
+    r->last = *p;
+    return RS_DONE;
+}
+
+/** ::rs_progress_cb that stops the job. */
+static rs_result stop_cb(rs_job_t *job, const rs_progress_t *p, void *arg)
+{
+    (void)job;
+    (void)p;
+    (*(int *)arg)++;
+    return RS_IO_ERROR;
+}
+
+/** ::rs_progress_cb that returns a result a job can't complete with. */
+static rs_result blocked_cb(rs_job_t *job, const rs_progress_t *p, void *arg)
+{
+    (void)job;
+    (void)p;
+    (*(int *)arg)++;
+    return RS_BLOCKED;
+}
+
+/** Write data to a new temporary file. */
+static FILE *data_file(const char *buf, size_t len)
+{
+    FILE *f = tmpfile();
+
+    assert(f);
+    assert(fwrite(buf, 1, len, f) == len);
+    rewind(f);
+    return f;
+}
+
+int main(void)
+{
+    FILE *old_f, *new_f, *sig_f, *delta_f, *out_f;
+    rs_signature_t *sig;
+    rs_job_t *job;
+    rs_buffers_t buf;
+    reports_t r;
+    char out[4096];
+    int stops = 0;
+    size_t i;
+
+    for (i = 0; i < DATA_LEN; i++)
+        data[i] = (char)(i * 7919 >> 5);
+    old_f = data_file(data, DATA_LEN);
+    memset(data + DATA_LEN / 2, 'x', 4096);
+    new_f = data_file(data, DATA_LEN);
+
+    /* Test signature progress, which has no basis. */
+    memset(&r, 0, sizeof r);
+    rs_whole_set_progress_cb(INTERVAL, progress_cb, &r);
+    sig_f = tmpfile();
+    assert(rs_sig_file(old_f, sig_f, 1024, 8, RS_RK_BLAKE2_SIG_MAGIC, NULL) ==
+           RS_DONE);
+    assert(r.calls > DATA_LEN / INTERVAL / 2);
+    assert(r.last.in_bytes == DATA_LEN);
+    assert(r.last.out_bytes == ftell(sig_f));
+    assert(r.last.basis_pos == -1);
+    assert(r.last.match_ratio == 0.0);
+
+    /* Test delta progress, which finishes at the end of the basis. Delta and
+       patch use 256K file buffers, so they report less often. */
+    memset(&r, 0, sizeof r);
+    rewind(sig_f);
+    assert(rs_loadsig_file(sig_f, &sig, NULL) == RS_DONE);
+    assert(rs_build_hash_table(sig) == RS_DONE);
+    memset(&r, 0, sizeof r);
+    delta_f = tmpfile();
+    assert(rs_delta_file(sig, new_f, delta_f, NULL) == RS_DONE);
+    assert(r.calls > 2);
+    assert(r.last.in_bytes == DATA_LEN);
+    assert(r.last.out_bytes == ftell(delta_f));
+    assert(r.last.basis_pos == DATA_LEN);
+    assert(r.last.match_ratio > 0.99 && r.last.match_ratio < 1.0);
+
+    /* Test patch progress, which also finishes at the end of the basis. */
+    memset(&r, 0, sizeof r);
+    rewind(old_f);
+    rewind(delta_f);
+    out_f = tmpfile();
+    assert(rs_patch_file(old_f, delta_f, out_f, NULL) == RS_DONE);
+    assert(r.calls > 2);
+    assert(r.last.in_bytes == ftell(delta_f));
+    assert(r.last.out_bytes == DATA_LEN);
+    assert(r.last.basis_pos == DATA_LEN);
+    assert(r.last.match_ratio > 0.99 && r.last.match_ratio < 1.0);
+    rs_whole_set_progress_cb(0, NULL, NULL);
+
+    /* Test the callback stops a job driven with rs_job_iter(). */
+    job = rs_delta_begin(sig);
+    rs_job_set_progress_cb(job, 0, stop_cb, &stops);
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = data;
+    buf.avail_in = DATA_LEN;
+    buf.next_out = out;
+    buf.avail_out = sizeof out;
+    assert(rs_job_iter(job, &buf) == RS_IO_ERROR);
+    assert(stops == 1);
+    rs_job_free(job);
+
+    /* Test RS_BLOCKED from the callback stops the job with an error. */
+    job = rs_delta_begin(sig);
+    rs_job_set_progress_cb(job, 0, blocked_cb, &stops);
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = data;
+    buf.avail_in = DATA_LEN;
+    buf.next_out = out;
+    buf.avail_out = sizeof out;
+    assert(rs_job_iter(job, &buf) == RS_PARAM_ERROR);
+    assert(stops == 2);
+    rs_job_free(job);
+
+    rs_free_sumset(sig);
+    fclose(old_f);
+    fclose(new_f);
+    fclose(sig_f);
+    fclose(delta_f);
+    fclose(out_f);
+    return 0;
+}
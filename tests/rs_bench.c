@@ -0,0 +1,667 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * rs_bench -- end-to-end performance benchmark for librsync.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file rs_bench.c
+ * End-to-end performance benchmark.
+ *
+ * This generates an old file and a mutated new file in memory for each
+ * workload, and then runs signature, loadsig, rs_build_hash_table(), delta
+ * and patch on them through rs_job_iter() with fixed size buffers, checking
+ * the patched output matches the new file. The results are written to stdout
+ * as a JSON array with an object for each workload.
+ *
+ * For each phase it reports the median time over the runs and the MB/s for
+ * the file it processes, which is the old file for signature, the signature
+ * for loadsig and rs_build_hash_table(), and the new file for delta and
+ * patch. It also reports percentiles of the time taken by each
+ * rs_job_iter() call over all runs, and the delta job's match statistics.
+ * Memory is reported as the peak resident set size of the process, which
+ * includes the in-memory files. If librsync
+ * was built with ENABLE_TIMING it also reports the mean ms per run spent in
+ * each ::rs_timing_phase for the signature, delta and patch jobs.
+ *
+ * With -c it also compares the MB/s of each phase against a baseline file,
+ * reporting any that are slower than the baseline by more than the tolerance
+ * to stderr and exiting with a failure. The baseline file has lines of
+ * "WORKLOAD PHASE MB_PER_S", an optional "tolerance PERCENT" line, and
+ * comments starting with '#'. Phases without a baseline are not checked. */
+
+#include "config.h"             /* IWYU pragma: keep */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#  include <sys/resource.h>
+#endif
+#include "librsync.h"
+
+/** A growable in-memory file. */
+typedef struct membuf {
+    char *buf;
+    size_t len;
+    size_t size;
+} membuf_t;
+
+/** A list of rs_job_iter() call times in ns. */
+typedef struct timelist {
+    uint64_t *ns;
+    size_t count;
+    size_t size;
+} timelist_t;
+
+/** The phases that are timed for each run. */
+enum { PH_SIG, PH_LOADSIG, PH_HASH, PH_DELTA, PH_PATCH, PH_COUNT };
+
+static const char *const phase_names[PH_COUNT] =
+    { "signature", "loadsig", "build_hash_table", "delta", "patch" };
+
+/** The results for a phase over all runs. */
+typedef struct phase {
+    uint64_t *run_ns;           /**< The total time of each run. */
+    timelist_t iters;           /**< The time of each rs_job_iter() call. */
+    size_t in_len;              /**< The file length processed. */
+    rs_timing_t timing;         /**< The job timing summed over all runs. */
+} phase_t;
+
+/** Benchmark options. */
+static size_t opt_size = 16 << 20;
+static size_t opt_block_len = 0;
+static size_t opt_strong_len = 0;
+static rs_magic_number opt_magic = 0;
+static size_t opt_buf_len = 64 << 10;
+static int opt_runs = 3;
+static uint64_t opt_seed = 1;
+static double opt_tolerance = -1.0;
+
+/** A baseline MB/s for a phase of a workload. */
+typedef struct baseline {
+    char workload[32];
+    char phase[32];
+    double mb_per_s;
+} baseline_t;
+
+#define MAX_BASELINES 128
+
+static baseline_t baselines[MAX_BASELINES];
+static int baseline_count = 0;
+static double baseline_tolerance = 25.0;
+static int regressions = 0;
+
+/** The xorshift64 state for generating workloads. */
+static uint64_t rng_state;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+/** Get a random number in [0, n). */
+static size_t rng_below(size_t n)
+{
+    return n ? (size_t)(rng_next() % n) : 0;
+}
+
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size ? size : 1);
+
+    if (!p) {
+        fprintf(stderr, "rs_bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void membuf_reserve(membuf_t *mb, size_t len)
+{
+    if (mb->len + len > mb->size) {
+        mb->size = 2 * (mb->len + len);
+        mb->buf = realloc(mb->buf, mb->size);
+        if (!mb->buf) {
+            fprintf(stderr, "rs_bench: out of memory\n");
+            exit(1);
+        }
+    }
+}
+
+static void membuf_append(membuf_t *mb, const void *data, size_t len)
+{
+    membuf_reserve(mb, len);
+    memcpy(mb->buf + mb->len, data, len);
+    mb->len += len;
+}
+
+static void membuf_random(membuf_t *mb, size_t len)
+{
+    uint64_t r;
+    size_t n;
+
+    membuf_reserve(mb, len);
+    while (len) {
+        r = rng_next();
+        n = len < sizeof r ? len : sizeof r;
+        memcpy(mb->buf + mb->len, &r, n);
+        mb->len += n;
+        len -= n;
+    }
+}
+
+static void timelist_add(timelist_t *tl, uint64_t ns)
+{
+    if (tl->count == tl->size) {
+        tl->size = tl->size ? 2 * tl->size : 1024;
+        tl->ns = realloc(tl->ns, tl->size * sizeof *tl->ns);
+        if (!tl->ns) {
+            fprintf(stderr, "rs_bench: out of memory\n");
+            exit(1);
+        }
+    }
+    tl->ns[tl->count++] = ns;
+}
+
+/** Get a monotonic time in ns. */
+static uint64_t now_ns(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+    return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+}
+
+/** Get the peak resident set size in KB, or -1 if unknown. */
+static long max_rss_kb(void)
+{
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+    struct rusage ru;
+
+    if (!getrusage(RUSAGE_SELF, &ru))
+        return ru.ru_maxrss;
+#endif
+    return -1;
+}
+
+/** Run a job over an in-memory input, appending its output to out if it is
+ * not NULL. Each rs_job_iter() call gets at most opt_buf_len of input and
+ * output. */
+static rs_result bench_drive(rs_job_t *job, const char *in, size_t in_len,
+                             membuf_t *out, timelist_t *iters)
+{
+    rs_buffers_t buf;
+    rs_result result;
+    size_t fed = 0, len;
+    uint64_t start;
+
+    memset(&buf, 0, sizeof buf);
+    do {
+        /* Give the job the next input when it has used what it had. */
+        if (!buf.avail_in && !buf.eof_in) {
+            len = in_len - fed < opt_buf_len ? in_len - fed : opt_buf_len;
+            buf.next_in = (char *)in + fed;
+            buf.avail_in = len;
+            fed += len;
+            buf.eof_in = fed == in_len;
+        }
+        if (out) {
+            membuf_reserve(out, opt_buf_len);
+            buf.next_out = out->buf + out->len;
+            buf.avail_out = opt_buf_len;
+        }
+        start = now_ns();
+        result = rs_job_iter(job, &buf);
+        timelist_add(iters, now_ns() - start);
+        if (out)
+            out->len += opt_buf_len - buf.avail_out;
+    } while (result == RS_BLOCKED);
+    return result;
+}
+
+/** ::rs_copy_cb that reads from an in-memory basis. */
+static rs_result bench_copy_cb(void *arg, rs_long_t pos, size_t *len,
+                               void **buf)
+{
+    const membuf_t *old = (const membuf_t *)arg;
+
+    if (pos < 0 || (size_t)pos >= old->len)
+        return RS_INPUT_ENDED;
+    if (*len > old->len - (size_t)pos)
+        *len = old->len - (size_t)pos;
+    *buf = old->buf + pos;
+    return RS_DONE;
+}
+
+/** Generate the old and new files for a workload. */
+static int make_workload(const char *name, membuf_t *old, membuf_t *new)
+{
+    size_t i, pos, len, count = opt_size / (256 << 10) + 1;
+
+    rng_state = opt_seed * 0x9e3779b97f4a7c15ULL + 1;
+    old->len = new->len = 0;
+    if (!strcmp(name, "sparse")) {
+        /* Alternate 64K runs of random data and zeros. */
+        for (pos = 0; pos < opt_size; pos += len) {
+            len = opt_size - pos < (64 << 10) ? opt_size - pos : 64 << 10;
+            if ((pos >> 16) & 1) {
+                membuf_reserve(old, len);
+                memset(old->buf + old->len, 0, len);
+                old->len += len;
+            } else {
+                membuf_random(old, len);
+            }
+        }
+    } else {
+        membuf_random(old, opt_size);
+    }
+    if (!strcmp(name, "random")) {
+        membuf_random(new, opt_size);
+        return 0;
+    }
+    membuf_append(new, old->buf, old->len);
+    if (!strcmp(name, "nochange")) {
+        return 0;
+    } else if (!strcmp(name, "edit") || !strcmp(name, "sparse")) {
+        /* Overwrite a few bytes every 256K on average. */
+        for (i = 0; i < count; i++) {
+            len = 1 + rng_below(16);
+            pos = rng_below(new->len - len);
+            memset(new->buf + pos, (int)rng_next(), len);
+        }
+    } else if (!strcmp(name, "insert") || !strcmp(name, "delete")) {
+        /* Insert or delete up to 1K every 256K on average. */
+        for (i = 0; i < count; i++) {
+            len = 1 + rng_below(1024);
+            pos = rng_below(new->len - len);
+            if (!strcmp(name, "insert")) {
+                membuf_reserve(new, len);
+                memmove(new->buf + pos + len, new->buf + pos, new->len - pos);
+                memset(new->buf + pos, (int)rng_next(), len);
+                new->len += len;
+            } else {
+                memmove(new->buf + pos, new->buf + pos + len,
+                        new->len - pos - len);
+                new->len -= len;
+            }
+        }
+    } else if (!strcmp(name, "shift")) {
+        /* Move the second half of the file to the front with an odd sized
+           gap, so no blocks are aligned with the old file. */
+        len = old->len / 2;
+        new->len = 0;
+        membuf_append(new, old->buf + len, old->len - len);
+        membuf_random(new, 37);
+        membuf_append(new, old->buf, len);
+    } else if (!strcmp(name, "append")) {
+        membuf_random(new, opt_size / 16);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/** Get a percentile of a sorted list of times. */
+static uint64_t percentile(const uint64_t *ns, size_t count, int p)
+{
+    return count ? ns[(count - 1) * p / 100] : 0;
+}
+
+/** Read a baseline file, returning 0 on success. */
+static int read_baseline(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    char line[256], workload[32], phase[32];
+    double v;
+    int lineno = 0;
+
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof line, f)) {
+        char *s = line + strspn(line, " \t");
+
+        lineno++;
+        if (*s == '#' || *s == '\n' || *s == '\0')
+            continue;
+        if (sscanf(s, "tolerance %lf", &v) == 1) {
+            baseline_tolerance = v;
+        } else if (sscanf(s, "%31s %31s %lf", workload, phase, &v) == 3
+                   && baseline_count < MAX_BASELINES) {
+            baseline_t *b = &baselines[baseline_count++];
+
+            strcpy(b->workload, workload);
+            strcpy(b->phase, phase);
+            b->mb_per_s = v;
+        } else {
+            fprintf(stderr, "rs_bench: %s:%d: bad baseline line\n", path,
+                    lineno);
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/** Check a phase's MB/s against the baseline, counting regressions. */
+static void check_baseline(const char *workload, const char *phase,
+                           double mb_per_s)
+{
+    double tolerance =
+        opt_tolerance >= 0.0 ? opt_tolerance : baseline_tolerance;
+    double min;
+    int i;
+
+    for (i = 0; i < baseline_count; i++) {
+        if (strcmp(baselines[i].workload, workload)
+            || strcmp(baselines[i].phase, phase))
+            continue;
+        min = baselines[i].mb_per_s * (1.0 - tolerance / 100.0);
+        if (mb_per_s < min) {
+            fprintf(stderr,
+                    "rs_bench: REGRESSION: %s %s %.2f MB/s is below the "
+                    "baseline %.2f MB/s - %g%% = %.2f MB/s\n", workload,
+                    phase, mb_per_s, baselines[i].mb_per_s, tolerance, min);
+            regressions++;
+        }
+    }
+}
+
+/** Add a job's timing to a phase. */
+static void add_timing(phase_t *ph, rs_job_t *job)
+{
+    const rs_timing_t *t = rs_job_timing(job);
+    int i;
+
+    for (i = 0; i < RS_TIMING_PHASES; i++) {
+        ph->timing.ns[i] += t->ns[i];
+        ph->timing.calls[i] += t->calls[i];
+    }
+}
+
+/** Run a workload and write its JSON results. */
+static int bench_workload(const char *name, int first)
+{
+    membuf_t old = { 0 }, new = { 0 }, sigbuf = { 0 }, delta = { 0 }, out =
+        { 0 };
+    phase_t phases[PH_COUNT];
+    rs_signature_t *sig;
+    rs_magic_number magic = opt_magic;
+    size_t block_len = opt_block_len, strong_len = opt_strong_len;
+    rs_job_t *job;
+    rs_result r;
+    uint64_t start, med;
+    double mb_per_s;
+    rs_match_stats_t match;
+    int run, p;
+
+    if (make_workload(name, &old, &new)) {
+        fprintf(stderr, "rs_bench: unknown workload '%s'\n", name);
+        return 1;
+    }
+    if ((r = rs_sig_args((rs_long_t)old.len, &magic, &block_len,
+                         &strong_len)) != RS_DONE) {
+        fprintf(stderr, "rs_bench: bad signature arguments: %s\n",
+                rs_strerror(r));
+        return 1;
+    }
+    memset(phases, 0, sizeof phases);
+    memset(&match, 0, sizeof match);
+    for (p = 0; p < PH_COUNT; p++)
+        phases[p].run_ns = xmalloc(opt_runs * sizeof(uint64_t));
+    for (run = 0; run < opt_runs; run++) {
+        sigbuf.len = delta.len = out.len = 0;
+        start = now_ns();
+        job = rs_sig_begin(block_len, strong_len, magic);
+        r = bench_drive(job, old.buf, old.len, &sigbuf, &phases[PH_SIG].iters);
+        add_timing(&phases[PH_SIG], job);
+        rs_job_free(job);
+        phases[PH_SIG].run_ns[run] = now_ns() - start;
+        if (r != RS_DONE)
+            goto failed;
+        start = now_ns();
+        job = rs_loadsig_begin(&sig);
+        r = bench_drive(job, sigbuf.buf, sigbuf.len, NULL,
+                        &phases[PH_LOADSIG].iters);
+        rs_job_free(job);
+        phases[PH_LOADSIG].run_ns[run] = now_ns() - start;
+        if (r != RS_DONE)
+            goto failed;
+        start = now_ns();
+        r = rs_build_hash_table(sig);
+        phases[PH_HASH].run_ns[run] = now_ns() - start;
+        if (r != RS_DONE)
+            goto failed;
+        start = now_ns();
+        job = rs_delta_begin(sig);
+        r = bench_drive(job, new.buf, new.len, &delta,
+                        &phases[PH_DELTA].iters);
+        add_timing(&phases[PH_DELTA], job);
+        match = *rs_job_match_stats(job);
+        rs_job_free(job);
+        phases[PH_DELTA].run_ns[run] = now_ns() - start;
+        rs_free_sumset(sig);
+        if (r != RS_DONE)
+            goto failed;
+        start = now_ns();
+        job = rs_patch_begin(bench_copy_cb, &old);
+        r = bench_drive(job, delta.buf, delta.len, &out,
+                        &phases[PH_PATCH].iters);
+        add_timing(&phases[PH_PATCH], job);
+        rs_job_free(job);
+        phases[PH_PATCH].run_ns[run] = now_ns() - start;
+        if (r != RS_DONE)
+            goto failed;
+        if (out.len != new.len || memcmp(out.buf, new.buf, new.len)) {
+            fprintf(stderr, "rs_bench: %s: patch output doesn't match\n", name);
+            return 1;
+        }
+    }
+    phases[PH_SIG].in_len = old.len;
+    phases[PH_LOADSIG].in_len = phases[PH_HASH].in_len = sigbuf.len;
+    phases[PH_DELTA].in_len = new.len;
+    phases[PH_PATCH].in_len = new.len;
+
+    printf("%s  {\n", first ? "" : ",\n");
+    printf("    \"workload\": \"%s\",\n", name);
+    printf("    \"old_size\": %lu,\n", (unsigned long)old.len);
+    printf("    \"new_size\": %lu,\n", (unsigned long)new.len);
+    printf("    \"sig_magic\": \"%#x\",\n", (unsigned)magic);
+    printf("    \"block_len\": %lu,\n", (unsigned long)block_len);
+    printf("    \"strong_len\": %lu,\n", (unsigned long)strong_len);
+    printf("    \"buf_len\": %lu,\n", (unsigned long)opt_buf_len);
+    printf("    \"runs\": %d,\n", opt_runs);
+    printf("    \"sig_size\": %lu,\n", (unsigned long)sigbuf.len);
+    printf("    \"delta_size\": %lu,\n", (unsigned long)delta.len);
+    printf("    \"delta_ratio\": %.6f,\n",
+           new.len ? (double)delta.len / (double)new.len : 0.0);
+    printf("    \"match\": {\"searches\": %ld, \"hits\": %ld, "
+           "\"probes\": %ld, \"weak_matches\": %ld, \"strong_sums\": %ld, "
+           "\"false_matches\": %ld},\n", (long)match.match_searches,
+           (long)match.match_hits, (long)match.match_probes,
+           (long)match.weak_matches, (long)match.strong_sums,
+           (long)match.false_matches);
+    printf("    \"phases\": {\n");
+    for (p = 0; p < PH_COUNT; p++) {
+        phase_t *ph = &phases[p];
+        timelist_t *it = &ph->iters;
+
+        qsort(ph->run_ns, opt_runs, sizeof *ph->run_ns, cmp_u64);
+        qsort(it->ns, it->count, sizeof *it->ns, cmp_u64);
+        med = ph->run_ns[opt_runs / 2];
+        mb_per_s = med ? (double)ph->in_len / 1e6 / (med / 1e9) : 0.0;
+        printf("      \"%s\": {\"seconds\": %.6f, \"mb_per_s\": %.2f",
+               phase_names[p], med / 1e9, mb_per_s);
+        check_baseline(name, phase_names[p], mb_per_s);
+        if (it->count)
+            printf(", \"iters\": %lu, \"iter_ns\": {\"p50\": %lu, "
+                   "\"p90\": %lu, \"p99\": %lu, \"max\": %lu}",
+                   (unsigned long)(it->count / opt_runs),
+                   (unsigned long)percentile(it->ns, it->count, 50),
+                   (unsigned long)percentile(it->ns, it->count, 90),
+                   (unsigned long)percentile(it->ns, it->count, 99),
+                   (unsigned long)it->ns[it->count - 1]);
+        if (rs_supports_timing() && it->count) {
+            int i;
+
+            printf(", \"timing_ms\": {");
+            for (i = 0; i < RS_TIMING_PHASES; i++)
+                printf("%s\"%s\": %.3f", i ? ", " : "",
+                       rs_timing_phase_name((rs_timing_phase)i),
+                       ph->timing.ns[i] / 1e6 / opt_runs);
+            printf("}");
+        }
+        printf("}%s\n", p < PH_COUNT - 1 ? "," : "");
+        free(ph->run_ns);
+        free(it->ns);
+    }
+    printf("    },\n");
+    printf("    \"max_rss_kb\": %ld\n", max_rss_kb());
+    printf("  }");
+    free(old.buf);
+    free(new.buf);
+    free(sigbuf.buf);
+    free(delta.buf);
+    free(out.buf);
+    return 0;
+
+  failed:
+    fprintf(stderr, "rs_bench: %s: %s\n", name, rs_strerror(r));
+    return 1;
+}
+
+/** Parse a size with an optional K, M or G suffix. */
+static size_t parse_size(const char *s)
+{
+    char *end;
+    unsigned long v = strtoul(s, &end, 0);
+
+    if (*end == 'K' || *end == 'k')
+        v <<= 10;
+    else if (*end == 'M' || *end == 'm')
+        v <<= 20;
+    else if (*end == 'G' || *end == 'g')
+        v <<= 30;
+    return (size_t)v;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: rs_bench [OPTIONS] [WORKLOAD...]\n"
+            "\n"
+            "Workloads: nochange, edit, insert, delete, shift, append, sparse,\n"
+            "random (default all)\n"
+            "\n"
+            "Options:\n"
+            "  -s SIZE     Old file size (default 16M)\n"
+            "  -b BYTES    Signature block size, 0 (default) for recommended\n"
+            "  -S BYTES    Signature strength, 0 (default) for max, -1 for min\n"
+            "  -m MAGIC    Signature magic number, 0 (default) for recommended\n"
+            "  -B BYTES    Input and output buffer size (default 64K)\n"
+            "  -r RUNS     Number of runs of each workload (default 3)\n"
+            "  -x SEED     Random seed for generating workloads (default 1)\n"
+            "  -c FILE     Check MB/s against a baseline file\n"
+            "  -T PERCENT  Tolerance for -c, overriding the baseline file's "
+            "tolerance\n");
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const all[] = { "nochange", "edit", "insert", "delete",
+        "shift", "append", "sparse", "random"
+    };
+    int i, first = 1, failed = 0;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+        if (!argv[i][1] || argv[i][2] || i + 1 == argc) {
+            usage();
+            return 1;
+        }
+        switch (argv[i][1]) {
+        case 's':
+            opt_size = parse_size(argv[++i]);
+            break;
+        case 'b':
+            opt_block_len = parse_size(argv[++i]);
+            break;
+        case 'S':
+            opt_strong_len = (size_t)strtol(argv[++i], NULL, 0);
+            break;
+        case 'm':
+            opt_magic = (rs_magic_number)strtoul(argv[++i], NULL, 0);
+            break;
+        case 'B':
+            opt_buf_len = parse_size(argv[++i]);
+            break;
+        case 'r':
+            opt_runs = atoi(argv[++i]);
+            break;
+        case 'x':
+            opt_seed = strtoul(argv[++i], NULL, 0);
+            break;
+        case 'c':
+            if (read_baseline(argv[++i]))
+                return 1;
+            break;
+        case 'T':
+            opt_tolerance = strtod(argv[++i], NULL);
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (opt_size < 4096 || !opt_buf_len || opt_runs < 1) {
+        usage();
+        return 1;
+    }
+    rs_trace_set_level(RS_LOG_WARNING);
+    printf("[\n");
+    if (i == argc) {
+        for (i = 0; i < (int)(sizeof all / sizeof *all) && !failed; i++) {
+            failed = bench_workload(all[i], first);
+            first = 0;
+        }
+    } else {
+        for (; i < argc && !failed; i++) {
+            failed = bench_workload(argv[i], first);
+            first = 0;
+        }
+    }
+    printf("\n]\n");
+    if (regressions)
+        fprintf(stderr, "rs_bench: %d phase%s slower than the baseline\n",
+                regressions, regressions == 1 ? "" : "s");
+    return failed || regressions;
+}
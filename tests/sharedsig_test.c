@@ -0,0 +1,160 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * sharedsig_test -- tests for sharing a signature between threads.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file sharedsig_test.c
+ * Test concurrent delta jobs sharing one signature.
+ *
+ * This loads a signature of an in-memory basis once, and then runs delta
+ * jobs against it from several threads at once for different new files,
+ * checking that patching each delta gives its new file and that each job
+ * counted its own match statistics. Run it under ThreadSanitizer to check for
+ * data races. */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define BASIS_LEN (1 << 20)
+#define THREADS 8
+
+/** The state of a thread's delta. */
+typedef struct worker {
+    pthread_t thread;
+    int n;                      /**< The thread number. */
+    char *new;                  /**< The thread's new file. */
+    char *delta;                /**< The thread's delta. */
+    size_t delta_len;           /**< The length of the delta. */
+    rs_stats_t stats;           /**< The delta job's stats. */
+    rs_match_stats_t match;     /**< The delta job's match stats. */
+} worker_t;
+
+static char basis[BASIS_LEN], out[BASIS_LEN];
+static rs_signature_t *sig;
+
+/** Run a job over all its input in one call, returning the output length.
+ *
+ * The output buffer must be big enough for all of the job's output. */
+static size_t run_job(rs_job_t *job, char *in, size_t in_len, char *out_buf,
+                      size_t out_len)
+{
+    rs_buffers_t buf;
+
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = in;
+    buf.avail_in = in_len;
+    buf.eof_in = 1;
+    buf.next_out = out_buf;
+    buf.avail_out = out_len;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    return out_len - buf.avail_out;
+}
+
+/** Fill a buffer with xorshift random data. */
+static void fill_random(char *buf, size_t len, uint64_t seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        buf[i] = (char)seed;
+    }
+}
+
+/** Make a new file from the basis with some edits, and generate its delta
+ * against the shared signature. */
+static void *worker_run(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    rs_job_t *job;
+    size_t pos;
+
+    w->new = malloc(BASIS_LEN);
+    w->delta = malloc(BASIS_LEN);
+    assert(w->new && w->delta);
+    memcpy(w->new, basis, BASIS_LEN);
+    for (pos = (size_t)w->n * 997; pos < BASIS_LEN; pos += 64 << 10)
+        fill_random(w->new + pos, 100, (uint64_t)w->n * 31 + pos + 1);
+    job = rs_delta_begin(sig);
+    assert(job);
+    w->delta_len = run_job(job, w->new, BASIS_LEN, w->delta, BASIS_LEN);
+    w->stats = *rs_job_statistics(job);
+    w->match = *rs_job_match_stats(job);
+    rs_job_free(job);
+    return NULL;
+}
+
+int main(void)
+{
+    worker_t workers[THREADS];
+    FILE *basis_f, *sig_f;
+    rs_job_t *job;
+    int i;
+
+    fill_random(basis, BASIS_LEN, 1);
+    basis_f = tmpfile();
+    assert(fwrite(basis, 1, BASIS_LEN, basis_f) == BASIS_LEN);
+    rewind(basis_f);
+    sig_f = tmpfile();
+    assert(rs_sig_file(basis_f, sig_f, 1024, 8, RS_RK_BLAKE2_SIG_MAGIC, NULL)
+           == RS_DONE);
+    rewind(sig_f);
+    assert(rs_loadsig_file(sig_f, &sig, NULL) == RS_DONE);
+    assert(rs_build_hash_table(sig) == RS_DONE);
+
+    /* Run the deltas concurrently with the shared signature. */
+    memset(workers, 0, sizeof workers);
+    for (i = 0; i < THREADS; i++) {
+        workers[i].n = i;
+        assert(!pthread_create(&workers[i].thread, NULL, worker_run,
+                               &workers[i]));
+    }
+    for (i = 0; i < THREADS; i++)
+        assert(!pthread_join(workers[i].thread, NULL));
+
+    /* Check each delta patches to its new file with its own stats. */
+    for (i = 0; i < THREADS; i++) {
+        worker_t *w = &workers[i];
+
+        assert(w->match.match_searches > 0);
+        assert(w->match.match_hits > 0);
+        assert(w->match.false_matches == w->stats.false_matches);
+        assert(w->stats.lit_bytes > 0);
+        assert(w->delta_len < BASIS_LEN / 10);
+        job = rs_patch_begin(rs_file_copy_cb, basis_f);
+        assert(run_job(job, w->delta, w->delta_len, out, BASIS_LEN) ==
+               BASIS_LEN);
+        rs_job_free(job);
+        assert(!memcmp(out, w->new, BASIS_LEN));
+        free(w->new);
+        free(w->delta);
+    }
+    rs_free_sumset(sig);
+    fclose(basis_f);
+    fclose(sig_f);
+    return 0;
+}
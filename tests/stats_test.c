@@ -0,0 +1,145 @@
+/*= -*- c-basic-offset: 4; indent-tabs-mode: nil; -*-
+ *
+ * stats_test -- tests for job statistics and their JSON format.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/** \file stats_test.c
+ * Test job statistics and their JSON format.
+ *
+ * This runs a streaming delta job, checking its histograms agree with its
+ * stats and match stats, and that rs_format_stats_json() includes them. It
+ * then formats the JSON into buffers that are too small, checking the output
+ * is a NUL-terminated prefix of the full JSON that doesn't overrun the
+ * buffer. */
+
+/* Force DEBUG on so that tests can use assert(). */
+#undef NDEBUG
+#include "config.h"             /* IWYU pragma: keep */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "librsync.h"
+
+#define DATA_LEN (256 << 10)
+
+static char old_data[DATA_LEN], new_data[DATA_LEN], delta[DATA_LEN];
+static char json[RS_STATS_JSON_SIZE], small[RS_STATS_JSON_SIZE];
+
+/** Get the total count of a histogram. */
+static rs_long_t histogram_total(const rs_histogram_t *hist)
+{
+    rs_long_t total = 0;
+    int i;
+
+    for (i = 0; i < RS_HISTOGRAM_BUCKETS; i++)
+        total += hist->count[i];
+    return total;
+}
+
+/** Format the JSON into size bytes of a bigger buffer, and check it is the
+ * truncated full JSON without touching the rest of the buffer. */
+static void check_truncated(const rs_stats_t *stats, rs_job_t *job,
+                            size_t size)
+{
+    size_t full_len = strlen(json);
+    size_t len = size - 1 < full_len ? size - 1 : full_len;
+
+    memset(small, 'x', sizeof small);
+    assert(rs_format_stats_json(stats, job, small, size) == small);
+    assert(small[len] == '\0');
+    assert(strlen(small) == len);
+    assert(!memcmp(small, json, len));
+    assert(small[size] == 'x');
+}
+
+int main(void)
+{
+    FILE *old_f, *sig_f;
+    rs_signature_t *sig;
+    rs_job_t *job;
+    rs_buffers_t buf;
+    const rs_stats_t *stats;
+    const rs_match_stats_t *match;
+    const rs_histograms_t *hists;
+    size_t i, size;
+
+    for (i = 0; i < DATA_LEN; i++)
+        old_data[i] = (char)(i * 7919 >> 5);
+    memcpy(new_data, old_data, DATA_LEN);
+    for (i = 1000; i < DATA_LEN; i += 10000)
+        new_data[i] = (char)~old_data[i];
+    old_f = tmpfile();
+    assert(fwrite(old_data, 1, DATA_LEN, old_f) == DATA_LEN);
+    rewind(old_f);
+    sig_f = tmpfile();
+    assert(rs_sig_file(old_f, sig_f, 1024, 8, RS_RK_BLAKE2_SIG_MAGIC, NULL) ==
+           RS_DONE);
+    rewind(sig_f);
+    assert(rs_loadsig_file(sig_f, &sig, NULL) == RS_DONE);
+    assert(rs_build_hash_table(sig) == RS_DONE);
+
+    /* Run the whole delta in one call with room for all its output. */
+    job = rs_delta_begin(sig);
+    memset(&buf, 0, sizeof buf);
+    buf.next_in = new_data;
+    buf.avail_in = DATA_LEN;
+    buf.eof_in = 1;
+    buf.next_out = delta;
+    buf.avail_out = sizeof delta;
+    assert(rs_job_iter(job, &buf) == RS_DONE);
+    stats = rs_job_statistics(job);
+    match = rs_job_match_stats(job);
+    hists = rs_job_histograms(job);
+
+    /* Test the histograms count each command and search. */
+    assert(stats->copy_cmds > 0 && stats->lit_cmds > 0);
+    assert(match->match_searches > 0 && match->match_hits > 0);
+    assert(match->false_matches == stats->false_matches);
+    assert(histogram_total(&hists->copy_lens) == stats->copy_cmds);
+    assert(histogram_total(&hists->lit_lens) == stats->lit_cmds);
+    assert(histogram_total(&hists->probe_lens) == match->match_searches);
+    assert(histogram_total(&hists->match_gaps) > 0 || !rs_supports_timing());
+
+    /* Test the JSON has the stats, and the job's stats only if given. */
+    rs_format_stats_json(stats, NULL, json, sizeof json);
+    assert(!strncmp(json, "{\"op\": \"delta\", ", 16));
+    assert(strstr(json, "\"lit_cmds\": "));
+    assert(!strstr(json, "\"match_searches\": "));
+    assert(json[strlen(json) - 1] == '}');
+    rs_format_stats_json(stats, job, json, sizeof json);
+    assert(!strncmp(json, "{\"op\": \"delta\", ", 16));
+    assert(strstr(json, "\"match_searches\": "));
+    assert(strstr(json, "\"copy_lens\": [0, "));
+    assert(strstr(json, "\"mem_peak\": "));
+    assert(json[strlen(json) - 1] == '}');
+
+    /* Test JSON that doesn't fit is truncated and NUL-terminated. */
+    for (size = 1; size <= strlen(json) + 1; size = size * 3 + 1)
+        check_truncated(stats, job, size);
+    check_truncated(stats, job, strlen(json));
+    check_truncated(stats, job, strlen(json) + 1);
+    memset(small, 'x', sizeof small);
+    rs_format_stats_json(stats, job, small, 0);
+    assert(small[0] == 'x');
+
+    rs_job_free(job);
+    rs_free_sumset(sig);
+    fclose(old_f);
+    fclose(sig_f);
+    return 0;
+}
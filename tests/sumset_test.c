@@ -34,6 +34,11 @@ int main(int argc, char **argv)
     rs_result res;
     rs_weak_sum_t weak = 0x12345678;
     rs_strong_sum_t strong = "ABCDEF";
+    rs_match_stats_t stats;
+    rs_histogram_t probe_lens;
+    rs_hashtable_stats_t hstats;
+    rs_mem_stats_t mstats;
+    rs_long_t total;
     int i;
     unsigned char buf[256];
 
@@ -164,6 +169,16 @@ int main(int argc, char **argv)
     res = rs_sig_args(-1, &magic, &block_len, &strong_len);
     assert(res == RS_PARAM_ERROR);
 
+    /* block_len=bad for multi-resolution. */
+    magic = RS_MR_BLAKE2_SIG_MAGIC;
+    block_len = 1000;
+    strong_len = 0;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_DONE);
+    block_len = 1001;
+    res = rs_sig_args(-1, &magic, &block_len, &strong_len);
+    assert(res == RS_PARAM_ERROR);
+
     /* Test rs_signature_init() */
     /* magic=rec, block_len=rec, strong_len=max. */
     res = rs_signature_init(&sig, 0, 0, 0, -1);
@@ -175,9 +190,6 @@ int main(int argc, char **argv)
     assert(sig.size == 0);
     assert(sig.block_sigs == NULL);
     assert(sig.hashtable == NULL);
-#ifndef HASHTABLE_NSTATS
-    assert(sig.calc_strong_count == 0);
-#endif
 
     /* Blake2 magic, block_len=rec, strong_len=max. */
     res = rs_signature_init(&sig, RS_BLAKE2_SIG_MAGIC, 0, 0, -1);
@@ -259,6 +271,16 @@ int main(int argc, char **argv)
            == 0);
     rs_signature_done(&sig);
 
+    /* Test rs_signature_get_block() undoes mix32() of rollsums. */
+    res = rs_signature_init(&sig, RS_MD4_SIG_MAGIC, 16, 6, -1);
+    assert(res == RS_DONE);
+    rs_signature_add_block(&sig, weak, &strong);
+    assert(((rs_block_sig_t *)sig.block_sigs)->weak_sum != 0x12345678);
+    const void *strong_ptr;
+    assert(rs_signature_get_block(&sig, 0, &strong_ptr) == 0x12345678);
+    assert(memcmp(strong_ptr, &strong, 6) == 0);
+    rs_signature_done(&sig);
+
     /* Prepare rs_build_hash_table() and rs_signature_find_match() tests. */
     res = rs_signature_init(&sig, 0, 16, 6, -1);
     assert(res == RS_DONE);
@@ -269,9 +291,43 @@ int main(int argc, char **argv)
     }
 
     /* Test rs_build_hash_table(). */
+    assert(rs_signature_hashtable_stats(&sig, &hstats) == RS_PARAM_ERROR);
+    rs_signature_mem_stats(&sig, &mstats);
+    assert(mstats.bytes > 16 * 6 && mstats.peak == mstats.bytes);
+    total = mstats.bytes;
     rs_build_hash_table(&sig);
     assert(sig.hashtable->count == 16);
 
+    /* Test rs_signature_mem_stats() counts the hashtable's 32 buckets. */
+    total += sizeof(hashtable_t) + 32 * (sizeof(unsigned) + sizeof(void *));
+#ifndef HASHTABLE_NBLOOM
+    total += 32 / 8;
+#endif
+    rs_signature_mem_stats(&sig, &mstats);
+    assert(mstats.bytes == total);
+    assert(mstats.peak == mstats.bytes);
+
+    /* Test rs_signature_hashtable_stats(). */
+    assert(rs_signature_hashtable_stats(&sig, &hstats) == RS_DONE);
+    assert(hstats.blocks == 16);
+    assert(hstats.unique_blocks == 16);
+    assert(hstats.buckets == 32);
+    assert(hstats.load_factor == 0.5);
+    assert(hstats.dup_weak_blocks == 0);
+    assert(hstats.dup_weak_sums == 0);
+    assert(hstats.dup_weak_max == 0);
+    for (total = 0, i = 0; i < RS_HASHTABLE_PROBES; i++)
+        total += hstats.hit_probes[i];
+    assert(total == 16);
+    for (total = 0, i = 0; i < RS_HASHTABLE_PROBES; i++)
+        total += hstats.miss_probes[i];
+    assert(total == 32);
+    assert(hstats.hit_probes_mean >= 1.0);
+    assert(hstats.miss_probes_mean >= 1.0);
+#ifndef HASHTABLE_NBLOOM
+    assert(hstats.bloom_fp_rate > 0.0 && hstats.bloom_fp_rate <= 0.5);
+#endif
+
     /* Test rs_signature_find_match(). */
     /* different weak, different block. */
     assert(rs_signature_find_match(&sig, 0x12345678, &buf[2], 16) == -1);
@@ -279,10 +335,114 @@ int main(int argc, char **argv)
     assert(rs_signature_find_match(&sig, weak, &buf[2], 16) == -1);
     /* Matching weak, matching block. */
     assert(rs_signature_find_match(&sig, weak, &buf[15 * 16], 16) == 15 * 16);
+    /* Searches don't modify the signature's hashtable stats. */
 #ifndef HASHTABLE_NSTATS
-    assert(sig.calc_strong_count == 2);
+    assert(sig.hashtable->find_count == 0);
 #endif
     rs_signature_done(&sig);
 
+    /* Test rs_signature_hashtable_stats() counts blocks with the same weak
+       sum. */
+    res = rs_signature_init(&sig, 0, 16, 6, -1);
+    assert(res == RS_DONE);
+    for (i = 0; i < 3; i++) {
+        strong[0] = (unsigned char)i;
+        rs_signature_add_block(&sig, 0x12345678, &strong);
+    }
+    rs_build_hash_table(&sig);
+    assert(rs_signature_hashtable_stats(&sig, &hstats) == RS_DONE);
+    assert(hstats.unique_blocks == 3);
+    assert(hstats.dup_weak_blocks == 3);
+    assert(hstats.dup_weak_sums == 1);
+    assert(hstats.dup_weak_max == 3);
+    rs_signature_done(&sig);
+
+    /* Prepare rs_signature_find_match_near() tests with duplicate blocks. */
+    res = rs_signature_init(&sig, 0, 16, 6, -1);
+    assert(res == RS_DONE);
+    for (i = 0; i < 64; i += 16) {
+        weak = rs_signature_calc_weak_sum(&sig, &buf[i % 32], 16);
+        rs_signature_calc_strong_sum(&sig, &buf[i % 32], 16, &strong);
+        rs_signature_add_block(&sig, weak, &strong);
+    }
+    rs_build_hash_table(&sig);
+    assert(sig.hashtable->count == 2);
+    /* Duplicate blocks are only in the hashtable once. */
+    assert(rs_signature_hashtable_stats(&sig, &hstats) == RS_DONE);
+    assert(hstats.blocks == 4);
+    assert(hstats.unique_blocks == 2);
+    assert(hstats.dup_weak_blocks == 0);
+
+    /* Test rs_signature_find_match_near(). */
+    weak = rs_signature_calc_weak_sum(&sig, &buf[16], 16);
+    /* No preference gives the first duplicate. */
+    assert(rs_signature_find_match_near(&sig, weak, &buf[16], 16, -1, -1,
+                                        NULL, NULL, NULL) == 16);
+    /* Prefer duplicates in order. */
+    assert(rs_signature_find_match_near(&sig, weak, &buf[16], 16, 48, 16,
+                                        NULL, NULL, NULL) == 48);
+    assert(rs_signature_find_match_near(&sig, weak, &buf[16], 16, 16, 48,
+                                        NULL, NULL, NULL) == 16);
+    /* Preferred offsets that are not duplicates are ignored. */
+    assert(rs_signature_find_match_near(&sig, weak, &buf[16], 16, 32, 48,
+                                        NULL, NULL, NULL) == 48);
+    assert(rs_signature_find_match_near(&sig, weak, &buf[16], 16, 50, 64,
+                                        NULL, NULL, NULL) == 16);
+    /* No match ignores preferences. */
+    assert(rs_signature_find_match_near(&sig, weak, &buf[2], 16, 16, 48,
+                                        NULL, NULL, NULL) == -1);
+    /* Match stats count the search, the strong sum, and the weak matches
+       compared for the first duplicate and the preferred offset. */
+    memset(&stats, 0, sizeof stats);
+    memset(&probe_lens, 0, sizeof probe_lens);
+    assert(rs_signature_find_match_near(&sig, weak, &buf[16], 16, 48, 16,
+                                        &stats, &probe_lens, NULL) == 48);
+    assert(stats.match_searches == 1);
+    assert(stats.match_hits == 1);
+    assert(stats.match_probes >= 1);
+    assert(stats.weak_matches == 2);
+    assert(stats.strong_sums == 1);
+    assert(stats.false_matches == 0);
+    assert(probe_lens.count[0] == 0);
+    rs_signature_done(&sig);
+
+    /* Test rs_signature_init() with multi-resolution. */
+    res = rs_signature_init(&sig, RS_MR_MD4_SIG_MAGIC, 64, 8, 12 + 18 * 12);
+    assert(res == RS_DONE);
+    assert(sig.size == 2);
+    assert(sig.fine);
+    assert(sig.fine->magic == RS_RK_MD4_SIG_MAGIC);
+    assert(sig.fine->block_len == 8);
+    assert(sig.fine->strong_sum_len == 8);
+    assert(sig.fine->size == 18);
+    rs_signature_done(&sig);
+
+    /* Prepare rs_signature_find_chunk() tests with variable length chunks. */
+    res = rs_signature_init(&sig, RS_CDC_BLAKE2_SIG_MAGIC, 16, 6, -1);
+    assert(res == RS_DONE);
+    assert(rs_signature_is_cdc(&sig));
+    rs_signature_calc_strong_sum(&sig, &buf[0], 10, &strong);
+    rs_signature_add_chunk(&sig, 10, &strong);
+    rs_signature_calc_strong_sum(&sig, &buf[10], 30, &strong);
+    rs_signature_add_chunk(&sig, 30, &strong);
+    rs_signature_calc_strong_sum(&sig, &buf[0], 10, &strong);
+    rs_signature_add_chunk(&sig, 10, &strong);
+    assert(sig.count == 3);
+    assert(sig.chunk_offs[3] == 50);
+    rs_build_hash_table(&sig);
+    assert(sig.hashtable->count == 2);
+
+    /* Test rs_signature_find_chunk(). */
+    assert(rs_signature_find_chunk(&sig, &buf[0], 10, NULL, NULL, NULL) ==
+           0);
+    assert(rs_signature_find_chunk(&sig, &buf[10], 30, NULL, NULL, NULL) ==
+           10);
+    /* Different lengths or data don't match. */
+    assert(rs_signature_find_chunk(&sig, &buf[0], 11, NULL, NULL, NULL) ==
+           -1);
+    assert(rs_signature_find_chunk(&sig, &buf[10], 10, NULL, NULL, NULL) ==
+           -1);
+    rs_signature_done(&sig);
+
     return 0;
 }